@@ -3,9 +3,7 @@
 #include "mcc_generated_files/queue.h"
 #include "mcc_generated_files/interrupt_handlers.h"
 #include "mcc_generated_files/tmr1.h"
-#include "mcc_generated_files/tmr4.h"
-#include "mcc_generated_files/tmr5.h"
-time_s StartTime = { // All values in BCD
+time_s StartTime = { // All values in decimal, SetRTCCTime converts to BCD
     30, // seconds
     58, // minutes
     23, // hours
@@ -24,50 +22,80 @@ int main(void) {
 
     
     InitIOCInterrupt(); // Initialize IOC Interrupts
+    
+    // Before anything schedules a timer, the RTCC sync below does
+    InitTimerService(); // Timer1, everything periodic runs off it
+    InitTimers();
 
     I2C_Init(); // Call custom I2C Init function to start the bus
 
     SetRTCCTime(&StartTime); // Set the current time on the MCP7940
-    CurrentTime = StartTime; // Set this so our first run through doesn't trigger
-                             //  a message send
+    I2C_EngineInit(); // Everything on the bus from here on is queued
+    SyncRTCCTime(); // Load the internal RTCC from the MCP7940
     
     UART_Init();
+    AT_Init(); // The SIM800 is talked to through the AT engine
+    Modem_Init();
+    
+    TMR3_Start(); // Timer2 is started by the water measurement windows
+    Outbox_Init(); // Reports a reset left in the data EEPROM are sent again
     
-    TMR1_Start();
-    TMR2_Start();
-    TMR3_Start();
-    TMR4_Start();
-    TMR5_Start();
+    SetClockMode(CLOCK_LOW); // Doze between messages
     
+    // Finished by the main loop, like any other text
     SendTextMessage("I'm alive!", sizeof("I'm alive!"), 
             phoneNumber, sizeof(phoneNumber));
 
     
     while (1) 
     {
-
+        // Sleep until an ISR raises an event
+        WaitForEvent();
         KickWatchdog(); // Reset the watchdog timer
         
-        if(false)//if(isMidnightPassed)
+        uint16_t events = TakeEvents();
+        
+        if(events & EVENT_WORK_POSTED)
+        {
+            RunDeferredWork(); // Whatever the ISRs left for us
+        }
+        
+        if(events & EVENT_MIDNIGHT)
         {
             SendMidnightMessage();
-            isMidnightPassed = false;
         }
         
-        if((!uint16_IsQueueEmpty(&xQueue)) && (!uint16_IsQueueEmpty(&yQueue)))
+        if(events & EVENT_MODEM)
+        {
+            AT_Process(); // Whatever the SIM800 sent, and timeouts
+            Modem_Process(); // Then its power lifecycle
+        }
+        
+        if(events & EVENT_OUTBOX)
+        {
+            Outbox_Send(); // Retry the reports still waiting
+        }
+        
+        if(events & EVENT_RTCC_SYNC)
+        {
+            RetryRTCCSync();
+        }
+        
+        if(events & EVENT_ACCEL_BLOCK)
         {
-            ProcessAccelQueue();
+            // Hand the block back to the ADC ISR only once we are done
+            ProcessAccelBlock(&accelBlocks[fullAccelBlock]);
+            accelBlockIsFull = false;
         }
         
-        if(depthBufferIsFull)
+        if(events & EVENT_DEPTH_BUFFER)
         {
-            depthBufferIsFull = false;
+            // Nothing reads the depth sensor yet
         }
         
-        if(batteryBufferIsFull)
+        if(events & EVENT_BATTERY_BUFFER)
         {
             HandleBatteryBufferEvent();
-            batteryBufferIsFull = false;
         }
     }
 
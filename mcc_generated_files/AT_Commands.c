@@ -0,0 +1,428 @@
+/*
+ * File:   AT_Commands.c
+ */
+
+
+#include "xc.h"
+#include "AT_Commands.h"
+#include "UART_Functions.h"
+#include "deferred_work.h"
+#include "timer_service.h"
+
+/*
+ Non blocking AT command engine for the SIM800. Commands are queued by the
+ main loop and sent one at a time. The U1RX ISR cuts whatever the modem sends
+ back into lines, and a command finishes on the first final response (OK,
+ ERROR, +CME ERROR or +CMS ERROR) or when its timeout runs out, so each step
+ moves on as soon as the modem answers. Lines the modem sends on its own
+ (URCs) are matched against urcTable first, whether or not a command is out.
+ Everything but the timeout callback runs from AT_Process, in the main loop,
+ which is woken with EVENT_MODEM by the UART ISRs and the timeout.
+ */
+
+typedef enum {
+            AT_ENGINE_IDLE,
+            AT_ENGINE_WAIT_PROMPT, // Command sent, waiting for "> "
+            AT_ENGINE_SEND_PAYLOAD, // Prompt seen, payload going out
+            AT_ENGINE_WAIT_RESPONSE // Waiting for the final response
+} AT_ENGINE_STATE;
+
+DEFINE_QUEUE(atCmd, at_command_ptr, AT_COMMAND_QUEUE_SIZE)
+
+static atCmd_queue commandQueue;
+static at_command *currentCommand = NULL;
+static AT_ENGINE_STATE engineState = AT_ENGINE_IDLE;
+static uint8_t payloadIndex = 0;
+static soft_timer timeoutTimer;
+static volatile bool isTimedOut = false;
+
+uint8_t modemStatus = 0;
+uint16_t textsReceived = 0;
+int16_t lastTextIndex = -1;
+
+static void StartNextCommand(void);
+static void FinishCommand(AT_STATUS result);
+static void SendPayload(void);
+static void HandleLine(void);
+static bool HandleURC(void);
+static void CommandTimedOut(void);
+static void TxDrained(void);
+static void ModemReady(void);
+static void CallReady(void);
+static void SMSReady(void);
+static void SIMStatus(void);
+static void TextReceived(void);
+static void VoltageWarning(void);
+static void PoweredDown(void);
+
+typedef struct at_urc {
+    const char *prefix; // Start of the line
+    void (*handler)(void); // Reads the rest of the line in place
+} at_urc;
+
+static const at_urc urcTable[] = {
+    { "RDY", ModemReady },
+    { "Call Ready", CallReady },
+    { "SMS Ready", SMSReady },
+    { "+CPIN:", SIMStatus },
+    { "+CMTI:", TextReceived },
+    { "UNDER-VOLTAGE WARNNING", VoltageWarning }, // Sic, the SIM800 spelling
+    { "OVER-VOLTAGE WARNNING", VoltageWarning },
+    { "UNDER-VOLTAGE POWER DOWN", PoweredDown },
+    { "OVER-VOLTAGE POWER DOWN", PoweredDown },
+    { "NORMAL POWER DOWN", PoweredDown }
+};
+
+/**
+ * Description: Empties the command queue and hooks the engine up to the
+ *      UART. Call after UART_Init.
+ */
+void AT_Init(void)
+{
+    atCmd_InitQueue(&commandQueue);
+    currentCommand = NULL;
+    engineState = AT_ENGINE_IDLE;
+
+    UART_SetTxDrainedCallback(TxDrained);
+}
+
+/**
+ * Description: Queues a command for the modem. It is sent straight away if
+ *      nothing else is waiting on the modem. Main loop only.
+ * @param command: Descriptor to run, see at_command
+ * @return bool false if the queue was full, the command was not queued
+ */
+bool AT_SubmitCommand(at_command *command)
+{
+    command->status = AT_PENDING;
+    command->result = -1;
+
+    if (!atCmd_PushQueue(&commandQueue, command))
+    {
+        return false;
+    }
+
+    if (engineState == AT_ENGINE_IDLE)
+    {
+        StartNextCommand();
+    }
+
+    return true;
+}
+
+/**
+ * Description: Whether the engine has no command out or in the queue.
+ * @return bool true if idle
+ */
+bool AT_IsEngineIdle(void)
+{
+    return (engineState == AT_ENGINE_IDLE) &&
+            atCmd_IsQueueEmpty(&commandQueue);
+}
+
+/**
+ * Description: Moves the engine along. Handles every line the modem has
+ *      sent, tops up the payload going out and fails a command that has
+ *      timed out. Call from the main loop on EVENT_MODEM.
+ */
+void AT_Process(void)
+{
+    while (UART_IsLineReady())
+    {
+        HandleLine();
+        UART_DropLine();
+    }
+
+    if (engineState == AT_ENGINE_SEND_PAYLOAD)
+    {
+        SendPayload();
+    }
+
+    // A response that came in with the timeout still counts
+    if (isTimedOut && currentCommand != NULL)
+    {
+        FinishCommand(AT_TIMEOUT);
+    }
+}
+
+/**
+ * Description: Timeout timer callback, runs in the Timer1 ISR. Leaves the
+ *      command for AT_Process to fail.
+ */
+static void CommandTimedOut(void)
+{
+    isTimedOut = true;
+    RaiseEvent(EVENT_MODEM);
+}
+
+/**
+ * Description: UART TX callback, runs in the U1TX ISR once the queue is
+ *      empty. Wakes AT_Process to send more of the payload.
+ */
+static void TxDrained(void)
+{
+    if (engineState == AT_ENGINE_SEND_PAYLOAD)
+    {
+        RaiseEvent(EVENT_MODEM);
+    }
+}
+
+/**
+ * Description: Pulls the next command off the queue and sends it. Leaves
+ *      the engine idle if the queue is empty.
+ */
+static void StartNextCommand(void)
+{
+    currentCommand = atCmd_PullQueue(&commandQueue);
+    if (currentCommand == NULL)
+    {
+        engineState = AT_ENGINE_IDLE;
+        return;
+    }
+
+    if (currentCommand->payload != NULL)
+    {
+        engineState = AT_ENGINE_WAIT_PROMPT;
+    }
+    else
+    {
+        engineState = AT_ENGINE_WAIT_RESPONSE;
+    }
+
+    isTimedOut = false;
+    ScheduleTimerAt(&timeoutTimer,
+            GetTimeMS() + currentCommand->timeoutMS, CommandTimedOut);
+
+    UART_Write_Buffer((char *)currentCommand->command,
+            strlen(currentCommand->command));
+    UART_Write_Buffer("\r", 1);
+}
+
+/**
+ * Description: Hands the command back to its owner and moves on to the
+ *      next one.
+ * @param result: Status of the command
+ */
+static void FinishCommand(AT_STATUS result)
+{
+    at_command *done = currentCommand;
+
+    CancelTimer(&timeoutTimer);
+    isTimedOut = false;
+    currentCommand = NULL;
+    done->status = result;
+    if (done->callback != NULL)
+    {
+        done->callback(done);
+    }
+
+    StartNextCommand();
+}
+
+/**
+ * Description: Queues as much of the payload as the UART has room for, then
+ *      the ctrl-Z that ends it. TxDrained brings us back for the rest.
+ */
+static void SendPayload(void)
+{
+    payloadIndex += UART_WriteAsync(currentCommand->payload + payloadIndex,
+            currentCommand->payloadLength - payloadIndex);
+
+    if (payloadIndex >= currentCommand->payloadLength)
+    {
+        if (UART_WriteAsync("\x1A", 1) == 1)
+        {
+            engineState = AT_ENGINE_WAIT_RESPONSE;
+        }
+    }
+}
+
+/**
+ * Description: Reads a number from the current line, e.g. the 500 in
+ *      "+CME ERROR: 500".
+ * @param offset: Where the number starts, spaces before it are skipped
+ * @return int16_t the number, -1 if there isn't one
+ */
+static int16_t ParseNumber(uint8_t offset)
+{
+    int16_t value = -1;
+    char c;
+
+    while (UART_LineChar(offset) == ' ')
+    {
+        offset++;
+    }
+
+    while ((c = UART_LineChar(offset)) >= '0' && c <= '9')
+    {
+        if (value < 0)
+        {
+            value = 0;
+        }
+        value = value * 10 + (c - '0');
+        offset++;
+    }
+
+    return value;
+}
+
+/**
+ * Description: Acts on the current line. Lines nothing is waiting for, like
+ *      the echo of a command, are dropped.
+ */
+static void HandleLine(void)
+{
+    if (UART_LineEquals(">"))
+    {
+        if (engineState == AT_ENGINE_WAIT_PROMPT)
+        {
+            payloadIndex = 0;
+            engineState = AT_ENGINE_SEND_PAYLOAD;
+            SendPayload();
+        }
+        return;
+    }
+
+    if (HandleURC() || currentCommand == NULL)
+    {
+        return;
+    }
+
+    if (UART_LineEquals("OK"))
+    {
+        FinishCommand(AT_OK);
+    }
+    else if (UART_LineEquals("ERROR"))
+    {
+        FinishCommand(AT_ERROR);
+    }
+    else if (UART_LineStartsWith("+CME ERROR:"))
+    {
+        currentCommand->result = ParseNumber(11);
+        FinishCommand(AT_CME_ERROR);
+    }
+    else if (UART_LineStartsWith("+CMS ERROR:"))
+    {
+        currentCommand->result = ParseNumber(11);
+        FinishCommand(AT_CMS_ERROR);
+    }
+    else if (UART_LineStartsWith("+CMGS:"))
+    {
+        // Message reference, the OK follows
+        currentCommand->result = ParseNumber(6);
+    }
+}
+
+/**
+ * Description: Runs the handler for the current line if it is a URC.
+ * @return bool true if it was one
+ */
+static bool HandleURC(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < sizeof(urcTable) / sizeof(urcTable[0]); i++)
+    {
+        if (UART_LineStartsWith(urcTable[i].prefix))
+        {
+            urcTable[i].handler();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Description: RDY, sent once the SIM800 UART is up.
+ */
+static void ModemReady(void)
+{
+    modemStatus |= MODEM_STATUS_READY;
+}
+
+/**
+ * Description: Call Ready, the SIM800 is registered for calls.
+ */
+static void CallReady(void)
+{
+    modemStatus |= MODEM_STATUS_CALL_READY;
+}
+
+/**
+ * Description: SMS Ready, texts can be sent.
+ */
+static void SMSReady(void)
+{
+    modemStatus |= MODEM_STATUS_SMS_READY;
+}
+
+/**
+ * Description: +CPIN: <state>, only READY means the SIM card can be used.
+ */
+static void SIMStatus(void)
+{
+    if (UART_LineEquals("+CPIN: READY"))
+    {
+        modemStatus |= MODEM_STATUS_SIM_READY;
+    }
+    else
+    {
+        modemStatus &= ~MODEM_STATUS_SIM_READY;
+    }
+}
+
+/**
+ * Description: +CMTI: "<mem>",<index>, a text came in. Nothing reads them
+ *      yet, they are counted.
+ */
+static void TextReceived(void)
+{
+    uint8_t offset = 6;
+    char c;
+
+    while ((c = UART_LineChar(offset)) != ',' && c != '\0')
+    {
+        offset++;
+    }
+
+    textsReceived++;
+    lastTextIndex = (c == ',') ? ParseNumber(offset + 1) : -1;
+}
+
+/**
+ * Description: The supply is close to where the SIM800 powers down.
+ */
+static void VoltageWarning(void)
+{
+    modemStatus |= MODEM_STATUS_VOLTAGE_WARN;
+}
+
+/**
+ * Description: The SIM800 is powering down, nothing will answer. Whatever
+ *      is out or queued is failed now rather than left to time out, and
+ *      nothing more is sent to it.
+ */
+static void PoweredDown(void)
+{
+    at_command *dropped = currentCommand;
+
+    modemStatus = MODEM_STATUS_POWERED_DOWN;
+    CancelTimer(&timeoutTimer);
+    isTimedOut = false;
+    currentCommand = NULL;
+
+    // The engine stays busy while the callbacks run, so a command one of
+    //  them submits is queued and failed here too, not sent
+    while (dropped != NULL)
+    {
+        dropped->status = AT_POWERED_DOWN;
+        if (dropped->callback != NULL)
+        {
+            dropped->callback(dropped);
+        }
+        dropped = atCmd_PullQueue(&commandQueue);
+    }
+
+    engineState = AT_ENGINE_IDLE;
+}
@@ -0,0 +1,79 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef AT_COMMANDS_H
+#define	AT_COMMANDS_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+#include "queue.h"
+
+#define AT_COMMAND_QUEUE_SIZE   4 // Commands waiting for the modem, must be a
+                                  //  power of two
+#define AT_DEFAULT_TIMEOUT_MS   1000 // Plain commands answer in a few ms
+#define AT_CMGS_TIMEOUT_MS      60000 // SIM800 allows up to 60s for a text
+
+typedef enum {
+            AT_PENDING, // Queued or talking to the modem
+            AT_OK,
+            AT_ERROR,
+            AT_CME_ERROR, // result holds the +CME ERROR code
+            AT_CMS_ERROR, // result holds the +CMS ERROR code
+            AT_TIMEOUT, // No final response within timeoutMS
+            AT_POWERED_DOWN // The SIM800 said it was powering down
+} AT_STATUS;
+
+// modemStatus bits, set from what the SIM800 reports on its own
+#define MODEM_STATUS_READY          0x01 // RDY, the UART is up
+#define MODEM_STATUS_CALL_READY     0x02 // Call Ready
+#define MODEM_STATUS_SMS_READY      0x04 // SMS Ready
+#define MODEM_STATUS_SIM_READY      0x08 // +CPIN: READY
+#define MODEM_STATUS_VOLTAGE_WARN   0x10 // Supply is close to a limit
+#define MODEM_STATUS_POWERED_DOWN   0x20 // Said it was powering down
+
+typedef struct at_command at_command;
+typedef at_command *at_command_ptr;
+
+/*
+ One command line and the modem's answer to it. The command is sent with a
+ "\r" added. If payload is set the engine waits for the "> " prompt, sends
+ the payload and then a ctrl-Z, as AT+CMGS wants. The caller owns the
+ descriptor and both strings, and must leave them alone while status is
+ AT_PENDING. The callback runs from AT_Process, in the main loop, once the
+ final response is in.
+ */
+struct at_command {
+    const char *command; // NUL terminated, without the "\r"
+    const char *payload; // Sent after the prompt, NULL for none
+    uint8_t payloadLength;
+    uint16_t timeoutMS;
+    void (*callback)(at_command *command); // May be NULL
+    AT_STATUS status;
+    int16_t result; // +CMGS reference, or the error code, -1 if none
+};
+
+DECLARE_QUEUE(atCmd, at_command_ptr, AT_COMMAND_QUEUE_SIZE)
+
+// MODEM_STATUS bits for the current power up, cleared at each boot
+extern uint8_t modemStatus;
+// Texts the SIM800 has received (+CMTI), and where the last one is stored
+extern uint16_t textsReceived;
+extern int16_t lastTextIndex;
+
+void AT_Init(void);
+bool AT_SubmitCommand(at_command *command);
+bool AT_IsEngineIdle(void);
+void AT_Process(void);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
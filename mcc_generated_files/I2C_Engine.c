@@ -0,0 +1,327 @@
+/*
+ * File:   I2C_Engine.c
+ */
+
+
+#include "xc.h"
+#include "I2C_Engine.h"
+#include "I2C_Functions.h"
+#include "deferred_work.h"
+#include "timer_service.h"
+#include "tmr5.h"
+
+/*
+ Interrupt driven I2C master, after the TRB design in i2c1.c. Transactions
+ are queued by the main loop and run one after another by the MI2C1 ISR,
+ which gets an interrupt at the end of every start, restart, stop, byte
+ and acknowledge. Nothing waits on the bus, so the CPU is free to sample or
+ sleep for the ~1ms an RTCC read takes. A software timer fails whatever is
+ on the bus if it runs past its timeout.
+ */
+
+typedef enum {
+            I2C_ENGINE_IDLE,
+            I2C_ENGINE_WRITE_ADDR, // Start done, send address + W
+            I2C_ENGINE_WRITE_DATA, // Address or byte sent, send the next
+            I2C_ENGINE_READ_ADDR, // (Re)start done, send address + R
+            I2C_ENGINE_READ_START, // Address sent, start receiving
+            I2C_ENGINE_READ_DATA, // Byte received, acknowledge it
+            I2C_ENGINE_READ_ACKED, // ACK sent, receive the next byte
+            I2C_ENGINE_READ_NACKED, // NACK sent after the last byte, stop
+            I2C_ENGINE_STOP // Stop done, finish the transaction
+} I2C_ENGINE_STATE;
+
+DEFINE_QUEUE(i2cTr, i2c_transaction_ptr, I2C_TRANSACTION_QUEUE_SIZE)
+
+static i2cTr_queue transactionQueue;
+static i2c_transaction *currentTransaction = NULL;
+static I2C_ENGINE_STATE engineState = I2C_ENGINE_IDLE;
+static I2C_TR_STATUS engineResult = I2C_TR_PENDING;
+static uint8_t byteIndex = 0;
+static soft_timer timeoutTimer;
+
+static void StartNextTransaction(void);
+static void StopTransaction(I2C_TR_STATUS result);
+static void FinishTransaction(I2C_TR_STATUS result);
+static void StepTransaction(void);
+static void TransactionTimedOut(void);
+static void RecoverLater(I2C_TR_STATUS result);
+
+/**
+ * Description: Empties the transaction queue and enables the MI2C1
+ *      interrupt. Call after I2C_Init.
+ */
+void I2C_EngineInit(void)
+{
+    i2cTr_InitQueue(&transactionQueue);
+    currentTransaction = NULL;
+    engineState = I2C_ENGINE_IDLE;
+
+    IFS1bits.MI2C1IF = false;
+    IEC1bits.MI2C1IE = true;
+}
+
+/**
+ * Description: Queues a transaction for the bus. It starts straight away if
+ *      the bus is idle. Main loop only.
+ * @param transaction: Descriptor to run, see i2c_transaction
+ * @return bool false if the queue was full, the transaction was not queued
+ */
+bool I2C_SubmitTransaction(i2c_transaction *transaction)
+{
+    transaction->status = I2C_TR_PENDING;
+
+    if (!i2cTr_PushQueue(&transactionQueue, transaction))
+    {
+        return false;
+    }
+
+    // A busy engine pulls it when the current transaction finishes.
+    //  Only this interrupt can move the engine out of idle, so there is
+    //  no race between the check and the kick.
+    if (engineState == I2C_ENGINE_IDLE)
+    {
+        IFS1bits.MI2C1IF = true;
+    }
+
+    return true;
+}
+
+/**
+ * Description: Whether the engine has nothing on the bus or in the queue.
+ * @return bool true if idle
+ */
+bool I2C_IsEngineIdle(void)
+{
+    return (engineState == I2C_ENGINE_IDLE) &&
+            i2cTr_IsQueueEmpty(&transactionQueue);
+}
+
+/**
+ * Description: Fails the transaction on the bus once the bus has been reset.
+ *      The reset takes a few hundred microseconds of clocking, too long for
+ *      an ISR, so it is posted to the main loop with MI2C1 held off until
+ *      then.
+ * @param result: Status to fail the transaction with
+ */
+static void RecoverLater(I2C_TR_STATUS result)
+{
+    CancelTimer(&timeoutTimer);
+    IEC1bits.MI2C1IE = false;
+    if (!PostWork(WORK_I2C_RECOVER, result))
+    {
+        // No room to defer it, better a slow ISR than a stuck bus
+        I2C_RecoverBus(result);
+    }
+}
+
+/**
+ * Description: Timeout timer callback. The Timer1 ISR runs at the same
+ *      priority as MI2C1 so the two never interrupt each other.
+ */
+static void TransactionTimedOut(void)
+{
+    if (currentTransaction == NULL)
+    {
+        return;
+    }
+
+    RecoverLater(I2C_TR_TIMEOUT);
+}
+
+/**
+ * Description: Resets the bus after a timeout or a collision, clocking a
+ *      stuck SDA free, then fails the transaction that was on it. The failure
+ *      is finished by the MI2C1 ISR like any other stop, so callbacks still
+ *      run in interrupt context. Called from RunDeferredWork on
+ *      WORK_I2C_RECOVER.
+ * @param result: Status to fail the transaction with
+ */
+void I2C_RecoverBus(I2C_TR_STATUS result)
+{
+    SoftwareReset();
+    // The reset's own restart and stop collide if SDA is still held
+    I2C1STATbits.BCL = 0;
+    I2C1STATbits.IWCOL = 0;
+
+    engineResult = result;
+    engineState = I2C_ENGINE_STOP;
+    IFS1bits.MI2C1IF = true;
+    IEC1bits.MI2C1IE = true;
+}
+
+/**
+ * Description: Pulls the next transaction off the queue and starts it.
+ *      Leaves the engine idle if the queue is empty.
+ */
+static void StartNextTransaction(void)
+{
+    currentTransaction = i2cTr_PullQueue(&transactionQueue);
+    if (currentTransaction == NULL)
+    {
+        engineState = I2C_ENGINE_IDLE;
+        return;
+    }
+
+    if (currentTransaction->writeLength > 0)
+    {
+        engineState = I2C_ENGINE_WRITE_ADDR;
+    }
+    else
+    {
+        engineState = I2C_ENGINE_READ_ADDR;
+    }
+
+    ScheduleTimerAt(&timeoutTimer,
+            GetTimeMS() + currentTransaction->timeoutMS, TransactionTimedOut);
+    I2C1CONbits.SEN = 1;
+}
+
+/**
+ * Description: Sends a stop, the transaction finishes with result once it
+ *      is done.
+ * @param result: Status to finish the transaction with
+ */
+static void StopTransaction(I2C_TR_STATUS result)
+{
+    engineResult = result;
+    engineState = I2C_ENGINE_STOP;
+    I2C1CONbits.PEN = 1;
+}
+
+/**
+ * Description: Hands the transaction back to its owner and moves on to the
+ *      next one.
+ * @param result: Status of the transaction
+ */
+static void FinishTransaction(I2C_TR_STATUS result)
+{
+    i2c_transaction *done = currentTransaction;
+
+    CancelTimer(&timeoutTimer);
+    currentTransaction = NULL;
+    done->status = result;
+    if (done->callback != NULL)
+    {
+        done->callback(done);
+    }
+
+    StartNextTransaction();
+}
+
+/**
+ * Description: MI2C1 interrupt, steps the transaction on the bus along.
+ */
+void __attribute__((interrupt, no_auto_psv)) _MI2C1Interrupt(void)
+{
+    uint16_t startTicks = TMR5_Counter16BitGet();
+
+    IFS1bits.MI2C1IF = false;
+    StepTransaction();
+
+    RecordISRTime(ISR_I2C, startTicks);
+}
+
+/**
+ * Description: Moves the engine on from whatever the module just finished.
+ */
+static void StepTransaction(void)
+{
+    if (I2C1STATbits.BCL || I2C1STATbits.IWCOL)
+    {
+        // Lost the bus, the module is idle again. There is no other master,
+        //  so something is holding SDA low.
+        I2C1STATbits.BCL = 0;
+        I2C1STATbits.IWCOL = 0;
+        if (currentTransaction != NULL)
+        {
+            RecoverLater(I2C_TR_COLLISION);
+        }
+        return;
+    }
+
+    switch (engineState)
+    {
+        case I2C_ENGINE_IDLE:
+            // Kicked by I2C_SubmitTransaction
+            StartNextTransaction();
+            break;
+
+        case I2C_ENGINE_WRITE_ADDR:
+            byteIndex = 0;
+            engineState = I2C_ENGINE_WRITE_DATA;
+            I2C1TRN = currentTransaction->address << 1;
+            break;
+
+        case I2C_ENGINE_WRITE_DATA:
+            if (I2C1STATbits.ACKSTAT)
+            {
+                // Nothing written yet means the address was refused
+                StopTransaction(byteIndex == 0 ?
+                        I2C_TR_ADDRESS_NACK : I2C_TR_DATA_NACK);
+            }
+            else if (byteIndex < currentTransaction->writeLength)
+            {
+                I2C1TRN = currentTransaction->writeData[byteIndex++];
+            }
+            else if (currentTransaction->readLength > 0)
+            {
+                engineState = I2C_ENGINE_READ_ADDR;
+                I2C1CONbits.RSEN = 1;
+            }
+            else
+            {
+                StopTransaction(I2C_TR_COMPLETE);
+            }
+            break;
+
+        case I2C_ENGINE_READ_ADDR:
+            byteIndex = 0;
+            engineState = I2C_ENGINE_READ_START;
+            I2C1TRN = (currentTransaction->address << 1) | 0x01;
+            break;
+
+        case I2C_ENGINE_READ_START:
+            if (I2C1STATbits.ACKSTAT)
+            {
+                StopTransaction(I2C_TR_ADDRESS_NACK);
+            }
+            else
+            {
+                engineState = I2C_ENGINE_READ_DATA;
+                I2C1CONbits.RCEN = 1;
+            }
+            break;
+
+        case I2C_ENGINE_READ_DATA:
+            currentTransaction->readData[byteIndex++] = (uint8_t)I2C1RCV;
+            if (byteIndex < currentTransaction->readLength)
+            {
+                engineState = I2C_ENGINE_READ_ACKED;
+                I2C1CONbits.ACKDT = 0; // ACK, there is more to read
+            }
+            else
+            {
+                engineState = I2C_ENGINE_READ_NACKED;
+                I2C1CONbits.ACKDT = 1; // NACK the last byte
+            }
+            I2C1CONbits.ACKEN = 1;
+            break;
+
+        case I2C_ENGINE_READ_ACKED:
+            engineState = I2C_ENGINE_READ_DATA;
+            I2C1CONbits.RCEN = 1;
+            break;
+
+        case I2C_ENGINE_READ_NACKED:
+            StopTransaction(I2C_TR_COMPLETE);
+            break;
+
+        case I2C_ENGINE_STOP:
+            FinishTransaction(engineResult);
+            break;
+
+        default:
+            break;
+    }
+}
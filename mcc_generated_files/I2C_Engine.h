@@ -0,0 +1,65 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef I2C_ENGINE_H
+#define	I2C_ENGINE_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+#include "queue.h"
+
+#define I2C_TRANSACTION_QUEUE_SIZE  4 // Transactions waiting for the bus,
+                                      //  must be a power of two
+#define I2C_DEFAULT_TIMEOUT_MS      20 // A 100kHz transaction of a few bytes
+                                       //  takes about 1ms
+
+typedef enum {
+            I2C_TR_PENDING, // Queued or on the bus
+            I2C_TR_COMPLETE,
+            I2C_TR_ADDRESS_NACK, // Nothing answered at the address
+            I2C_TR_DATA_NACK, // The slave refused a written byte
+            I2C_TR_COLLISION, // Bus or write collision, the bus was reset
+            I2C_TR_TIMEOUT // Took longer than timeoutMS, the bus was reset
+} I2C_TR_STATUS;
+
+typedef struct i2c_transaction i2c_transaction;
+typedef i2c_transaction *i2c_transaction_ptr;
+
+/*
+ A write of writeLength bytes, then a repeated start and a read of readLength
+ bytes, in one transaction. Either length can be 0 for a plain burst write or
+ read. The caller owns the descriptor and both buffers, and must leave them
+ alone while status is I2C_TR_PENDING. The callback runs in interrupt context
+ once the transaction is done, with status set.
+ */
+struct i2c_transaction {
+    uint8_t address; // 7 bit slave address
+    uint8_t *writeData;
+    uint8_t writeLength;
+    uint8_t *readData;
+    uint8_t readLength;
+    uint16_t timeoutMS;
+    void (*callback)(i2c_transaction *transaction); // May be NULL
+    I2C_TR_STATUS status;
+};
+
+DECLARE_QUEUE(i2cTr, i2c_transaction_ptr, I2C_TRANSACTION_QUEUE_SIZE)
+
+void I2C_EngineInit(void);
+bool I2C_SubmitTransaction(i2c_transaction *transaction);
+bool I2C_IsEngineIdle(void);
+void I2C_RecoverBus(I2C_TR_STATUS result);
+void __attribute__((interrupt, no_auto_psv)) _MI2C1Interrupt(void);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
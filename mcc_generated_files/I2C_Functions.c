@@ -10,16 +10,14 @@
 #include "I2C_Functions.h"
 #include "utilities.h"
 #include "conversion.h"
-
-#define FCY         2000000UL // Instruction cycle frequency
-#include <libpic30.h>
+#include "clock.h"
 
 #define I2C_TIMEOUT_VALUE           1300
 
 /**
  * I2C_Init
  * Initializes the I2C Bus' parameters and speed
- * I2C1BRG is set to 0x0012 - ~100kHz
+ * I2C1BRG is set for I2C_BAUD_RATE (0x0013 at a 2MHz Tcy) - ~99kHz
  * I2C1CON is set to 0x0200 - not enabled, continue op in idle mode,
  *      IPMI disabled, 10 bit slave address, slew rate cont. disabled,
  *      general call address disabled, disable software clock stretch,
@@ -31,44 +29,49 @@
 void I2C_Init(void)
 {
     I2C1CON  = 0x0200;
-    I2C1BRG  = 0x0012;
+    I2C_UpdateBaud();
     
     I2C1CONbits.I2CEN = 1;
 }
 
 /**
- * Description: Gets the current time from the RTCC, returned as a time_s
- *      struct with all of the information filled.
- * @return time_s struct with current time, according to the RTCC.
- * 
- * Note: This function has no time constraint - if I2C keeps failing, it
- *          can continue forever.
+ * Description: Sets I2C1BRG for I2C_BAUD_RATE from the peripheral clock.
+ *                  Called again by SetClockMode, I2C1BRG is only written if
+ *                  it changes.
  */
-time_s I2C_GetTime(void)
+void I2C_UpdateBaud(void)
 {
-    time_s t;
-    
-    I2C_STATUS stat;
-    
-    while(stat != I2C_SUCCESS)
+    // I2C1BRG = (Fcy / Fscl - Fcy / 10MHz) - 1, the second term is the
+    //  pulse gobbler delay. Worked in tenths so that term isn't lost to the
+    //  integer divide, then rounded, 18.8 -> 0x13 at a 2MHz Tcy
+    uint32_t fcy = GetPeripheralClock();
+    uint32_t tenths = (fcy * 10) / I2C_BAUD_RATE - fcy / 1000000UL - 10;
+    uint16_t brg = (tenths + 5) / 10;
+    
+    if(I2C1BRG != brg)
     {
-        stat = I2C_NO_TRY; // Reset stat
-        // Then or = stat, if any of them are not success, we'll try again
-        stat |= StartI2C();
-        stat |= WriteI2C(0xDE); // Addr + Write
-        stat |= WriteI2C(0x00); // Addr for seconds
-        stat |= RestartI2C();
-        stat |= IdleI2C();
-        stat |= WriteI2C(0xDF); // Addr + Read
-        stat |= ReadI2C(&t.second, false);
-        stat |= ReadI2C(&t.minute, false);
-        stat |= ReadI2C(&t.hour, false);
-        stat |= ReadI2C(&t.wkDay, false);
-        stat |= ReadI2C(&t.mnDay, false);
-        stat |= ReadI2C(&t.month, false);
-        stat |= ReadI2C(&t.year, true);
-        stat |= StopI2C();
+        I2C1BRG = brg;
     }
+}
+
+/**
+ * Description: Turns the RTCC time registers, read in one burst from the
+ *      seconds register, into a time_s struct with all of the information
+ *      filled.
+ * @param regs: RTCC_TIME_REGISTERS bytes, seconds first
+ * @return time_s struct with the time, in decimal.
+ */
+time_s RTCCRegistersToTime(const uint8_t *regs)
+{
+    time_s t;
+    
+    t.second  = regs[0];
+    t.minute  = regs[1];
+    t.hour    = regs[2];
+    t.wkDay   = regs[3];
+    t.mnDay   = regs[4];
+    t.month   = regs[5];
+    t.year    = regs[6];
      
     t.second  &= 0x7F; // Remove Osc
     t.minute  &= 0x7F; // Remove unused
@@ -9,6 +9,11 @@
 #include <math.h>
 #include "constants.h"
 
+#define I2C_BAUD_RATE               100000UL // Standard mode
+#define RTCC_I2C_ADDRESS            0x6F // MCP7940, 0xDE/0xDF with R/W
+#define RTCC_SECONDS_ADDR           0x00 // First time register
+#define RTCC_TIME_REGISTERS         7 // Seconds through year
+
 typedef struct time_s time_s;
 
 struct time_s {
@@ -29,7 +34,8 @@ typedef enum {
 } I2C_STATUS;
 
 void I2C_Init(void);
-time_s I2C_GetTime(void);
+void I2C_UpdateBaud(void);
+time_s RTCCRegistersToTime(const uint8_t *regs);
 void SoftwareReset(void);
 I2C_STATUS IdleI2C(void);
 I2C_STATUS StartI2C(void);
@@ -8,9 +8,39 @@
 
 #include "xc.h"
 #include "UART_Functions.h"
+#include "clock.h"
+#include "deferred_work.h"
+#include "tmr5.h"
 
-uint8_queue TX_Queue;
-uint8_queue RX_Queue;
+/*
+ TX is interrupt driven. Writers push into TX_Queue and return, and the U1TX
+ ISR moves bytes into the 4 deep hardware FIFO whenever it has room. The ISR
+ is only enabled while there is something to send.
+ */
+DEFINE_QUEUE(uartTx, uint8_t, UART_TX_QUEUE_SIZE)
+DEFINE_QUEUE(uartRx, uint8_t, UART_RX_QUEUE_SIZE)
+
+uartTx_queue TX_Queue;
+uartRx_queue RX_Queue;
+
+uint8_t txQueueHighWater = 0;
+static void (*txDrainedCallback)(void) = NULL;
+
+/*
+ RX is cut into lines by the U1RX ISR as it comes in. Line endings are
+ dropped and each line is closed with a NULL in RX_Queue, so the main loop
+ reads whole lines in place. "> " is closed as a line of its own, the SIM800
+ sends no line ending after it. rxLinesClosed and rxLinesTaken count lines
+ the same way head and tail count bytes, the ISR only writes the first and
+ the main loop only the second.
+ */
+static uint8_t rxLineLength = 0; // Bytes of the line the ISR is building
+static volatile uint8_t rxLinesClosed = 0;
+static volatile uint8_t rxLinesTaken = 0;
+
+uint16_t rxDroppedCount = 0;
+uint16_t rxOverrunCount = 0;
+uint16_t rxFramingErrorCount = 0;
 
 /**
  * Description: Initializes UART TX & RX queues, then sets UART config
@@ -19,8 +49,8 @@ uint8_queue RX_Queue;
 void UART_Init(void)
 {
     // Assemble the queues
-    uint8_InitQueue(&TX_Queue, TX_QUEUE_SIZE);
-    uint8_InitQueue(&RX_Queue, RX_QUEUE_SIZE);
+    uartTx_InitQueue(&TX_Queue);
+    uartRx_InitQueue(&RX_Queue);
     
     // Set init blocks
     
@@ -41,166 +71,388 @@ void UART_Init(void)
      */
     U1STA   = 0x0000;
     
-    // Baud rate set @ 9600 (U1BRG = 25)
-    U1BRG = 0x0019; 
+    // Baud rate set @ 9600
+    UART_UpdateBaud();
+    
+    // Transmit is left enabled so TX idles high, the TX interrupt is only
+    //  turned on while there is something queued
+    U1STAbits.UTXEN = 1;
+    IFS0bits.U1TXIF = false;
+    IEC0bits.U1TXIE = false;
+    
+    // Enable interrupts for RX, and for overruns and framing errors
+    rxLineLength = 0;
+    rxLinesClosed = 0;
+    rxLinesTaken = 0;
+    IFS0bits.U1RXIF = false;
+    IEC0bits.U1RXIE = true;
+    IFS4bits.U1ERIF = false;
+    IEC4bits.U1ERIE = true;
     
-    // Enable interrupts for TX and RX
-    //IEC0bits.U1RXIE = 1;
-    //IEC0bits.U1TXIE = 1; 
+}
+
+/**
+ * Description: Sets U1BRG for UART_BAUD_RATE from the peripheral clock,
+ *                  rounded to the nearest divider. Called again by
+ *                  SetClockMode, U1BRG is only written if it changes.
+ */
+void UART_UpdateBaud(void)
+{
+    // BRGH = 0, so the UART samples at 16x the baud rate
+    uint32_t divider = 16UL * UART_BAUD_RATE;
+    uint16_t brg = (GetPeripheralClock() + divider / 2) / divider - 1;
     
+    if(U1BRG != brg)
+    {
+        U1BRG = brg;
+    }
 }
 
 /**
- * Description: TX ISR Handler. Pulls elements from the queue, turns off
- *                  tx interrupts when the queue is empty.
+ * Description: TX ISR Handler. Fills the hardware FIFO from the queue, and
+ *                  turns the TX interrupt off once the queue is empty. The
+ *                  last bytes may still be shifting out, see UART_WaitTxDone.
  */
 void __attribute__((interrupt, no_auto_psv)) _U1TXInterrupt(void)
 {
-    if(!uint8_IsQueueEmpty(&TX_Queue) && !U1STAbits.UTXBF)
+    uint16_t startTicks = TMR5_Counter16BitGet();
+    
+    // Clear the interrupt flag first, a byte leaving the FIFO from here on
+    //  sets it again
+    IFS0bits.U1TXIF = false;
+    
+    while(!U1STAbits.UTXBF && !uartTx_IsQueueEmpty(&TX_Queue))
     {
-        // If there is at least one element in the queue, and the TX 
-        //  buffer isn't full
-        U1TXREG = uint8_PullQueue(&TX_Queue);
-        //U1STAbits.UTXEN = 1;
+        U1TXREG = uartTx_PullQueue(&TX_Queue);
     }
-    else if(uint8_IsQueueEmpty(&TX_Queue) && U1STAbits.TRMT)
+    
+    if(uartTx_IsQueueEmpty(&TX_Queue))
     {
-        // If queue is empty and everything is transmitted, disable UTXEN
-        //U1STAbits.UTXEN = 0;
-        //IEC0bits.U1TXIE = 0;
-        return;
+        IEC0bits.U1TXIE = false;
+        if(txDrainedCallback != NULL)
+        {
+            txDrainedCallback();
+        }
     }
-    // Clear the interrupt flag
-    IFS0bits.U1TXIF = false;
+    
+    RecordISRTime(ISR_UART_TX, startTicks);
 }
 
 /**
- * Description: RX ISR Handler. Pushes new data into the queue
+ * Description: Closes the line the ISR is building. There is always room,
+ *                  the last slot in the queue is kept for it.
+ */
+static void CloseRxLine(void)
+{
+    uartRx_PushQueue(&RX_Queue, '\0');
+    rxLineLength = 0;
+    rxLinesClosed++;
+}
+
+/**
+ * Description: RX ISR Handler. Adds new data to the line being built, and
+ *                  wakes the main loop each time a line is closed.
  */
 void __attribute__((interrupt, no_auto_psv)) _U1RXInterrupt(void)
 {
+    uint16_t startTicks = TMR5_Counter16BitGet();
+    bool isLineClosed = false;
+    
     // Clear the interrupt flag
     IFS0bits.U1RXIF = false;
     
-    if(!uint8_IsQueueFull(&RX_Queue) && U1STAbits.URXDA)
+    while(U1STAbits.URXDA)
+    {
+        if(U1STAbits.FERR)
+        {
+            // No stop bit, the byte is noise, e.g. the SIM powering down
+            (void)U1RXREG;
+            rxFramingErrorCount++;
+            continue;
+        }
+        
+        uint8_t rxByte = U1RXREG;
+        
+        if(rxByte == '\r' || rxByte == '\n')
+        {
+            if(rxLineLength > 0)
+            {
+                CloseRxLine();
+                isLineClosed = true;
+            }
+        }
+        else if(rxLineLength == 0 && rxByte == ' ')
+        {
+            // Lines don't start with a space, this is the one after "> "
+        }
+        else if(uartRx_QueueCount(&RX_Queue) >= UART_RX_QUEUE_SIZE - 1)
+        {
+            // Keep the last slot to close the line with
+            rxDroppedCount++;
+        }
+        else
+        {
+            uartRx_PushQueue(&RX_Queue, rxByte);
+            rxLineLength++;
+            
+            if(rxLineLength == 1 && rxByte == '>')
+            {
+                CloseRxLine();
+                isLineClosed = true;
+            }
+        }
+    }
+    
+    if(isLineClosed)
     {
-        // If there is room in the queue and data on the bus
-        uint8_PushQueue(&RX_Queue, U1RXREG);
+        RaiseEvent(EVENT_MODEM);
     }
+    
+    RecordISRTime(ISR_UART_RX, startTicks);
 }
 
 /**
- * Description: Function to write one byte of information to UART1.
- * @param byte: Information to write.
- * @return UART_STATUS enum, indicating if the function was successful.
+ * Description: UART error ISR Handler. An overrun stops the receiver until
+ *                  OERR is cleared, which also empties the 4 deep FIFO.
+ *                  Framing errors are counted as the bytes are read.
  */
-UART_STATUS UART_Write(char byte)
+void __attribute__((interrupt, no_auto_psv)) _U1ErrInterrupt(void)
 {
-//    U1STAbits.UTXEN = 1;
-//    if(uint8_IsQueueFull(&TX_Queue))
-//    {
-//        return TX_QUEUE_FULL;
-//    }
-//    else
-//    {
-//        uint8_PushQueue(&TX_Queue, (uint8_t)byte);
-//        // Enabling TX will throw the TX Interrupt
-//        
-//        
-//        if(IEC0bits.U1TXIE == false)
-//        {
-//            IEC0bits.U1TXIE = true;
-//        }
-//        
-//        return TX_STARTED;
-//    }
-    
-//     Non-Interrupt implementation
-    U1STAbits.UTXEN = 1;
-    if(!U1STAbits.UTXBF)
+    uint16_t startTicks = TMR5_Counter16BitGet();
+    
+    IFS4bits.U1ERIF = false;
+    
+    if(U1STAbits.OERR)
     {
-        U1TXREG = byte;
-        int delayIndex;
-        for(delayIndex = 0; delayIndex < 1000; delayIndex++) {}
-        return TX_STARTED;
+        rxOverrunCount++;
+        U1STAbits.OERR = 0;
     }
-    else
+    
+    RecordISRTime(ISR_UART_ERR, startTicks);
+}
+
+/**
+ * Description: Queues one byte for UART1. Returns straight away.
+ * @param byte: Information to write.
+ * @return UART_STATUS enum, TX_QUEUE_FULL if there was no room for it.
+ */
+UART_STATUS UART_Write(char byte)
+{
+    if(UART_WriteAsync(&byte, 1) == 0)
     {
         return TX_QUEUE_FULL;
     }
+    
+    return TX_STARTED;
 }
 
 /**
- * Description: Write an entire buffer to UART. This function is blocking.
+ * Description: Queues as much of a buffer as fits and returns straight away.
+ *                  NULL chars are skipped, they aren't sent to the SIM800.
  * @param dataPtr: Pointer to data block to write
  * @param dataLen: Length of data block
- * @return UART_STATUS enum, indicating whether the function was successful.
+ * @return uint8_t number of bytes of the block used up, dataLen if it all fit
  */
-UART_STATUS UART_Write_Buffer(char *dataPtr, uint8_t dataLen)
+uint8_t UART_WriteAsync(const char *dataPtr, uint8_t dataLen)
 {
+    uint8_t i = 0;
     
-    char *pD = dataPtr;
-    int i;
     while(i < dataLen)
     {
-        if(*pD == NULL)
+        uint8_t span = 0;
+        uint8_t pushed;
+        
+        if(dataPtr[i] == '\0')
         {
             // Don't send a NULL char over the UART bus
-            pD++;
             i++;
+            continue;
         }
-        else
+        
+        // Push the run up to the next NULL char in one go
+        while((span < dataLen - i) && (dataPtr[i + span] != '\0'))
         {
-            UART_STATUS stat = UART_Write(*pD);
-            if(stat == TX_STARTED)
-            {
-                pD++;
-                i++;
-            }
+            span++;
+        }
+        pushed = uartTx_PushNQueue(&TX_Queue, (const uint8_t *)&dataPtr[i],
+                span);
+        i += pushed;
+        if(pushed < span)
+        {
+            break;
         }
     }
-//    for(i = 0; i < dataLen; i++)
-//    {
-//        UART_STATUS stat = UART_Write((char)*pD);
-//        if(stat == TX_STARTED)
-//        {
-//            // If we started TX, then we are free to move to the next char
-//            pD++;              
-//        }
-//        else
-//        {
-//            i--; // Run the loop again
-//        }
-//        
-//    }
     
-    return TX_STARTED;
+    uint8_t depth = uartTx_QueueCount(&TX_Queue);
+    if(depth > txQueueHighWater)
+    {
+        txQueueHighWater = depth;
+    }
+    
+    // The flag is set while the FIFO has room, so this interrupts straight
+    //  away if the UART is idle
+    IEC0bits.U1TXIE = true;
+    
+    return i;
 }
 
 /**
- * Description: Read the uart RX buffer into the specified buffer
- * @param dataPtr: Pointer to specified buffer
- * @param dataLen: Maximum length of data
- * @return uint8_t amount of data read from buffer
+ * Description: Write an entire buffer to UART. This function is blocking, it
+ *                  waits in Idle for room in the queue rather than spinning.
+ *                  Main loop only, the TX ISR has to run for it to return.
+ * @param dataPtr: Pointer to data block to write
+ * @param dataLen: Length of data block
+ * @return UART_STATUS enum, indicating whether the function was successful.
  */
-uint8_t UART_Read(char *dataPtr, uint8_t dataLen)
+UART_STATUS UART_Write_Buffer(char *dataPtr, uint8_t dataLen)
 {
-    char *pD = dataPtr;
+    uint8_t savedIPL = SRbits.IPL;
+    uint8_t written = UART_WriteAsync(dataPtr, dataLen);
     
-    int i;
-    for(i = 0; i < dataLen; i++)
+    while(written < dataLen)
     {
-        // If there are no entries, return how far we were
-        if(uint8_IsQueueEmpty(&RX_Queue))
+        SRbits.IPL = 7; // A byte going out still wakes us
+        if(uartTx_IsQueueFull(&TX_Queue))
         {
-            return i;
+            Idle();
         }
+        SRbits.IPL = savedIPL;
         
-        // Get an entry, put it in the pointer
-        *pD = (char)uint8_PullQueue(&RX_Queue);
-        // Then increment our pointer
-        pD++;
+        written += UART_WriteAsync(dataPtr + written, dataLen - written);
+    }
+    
+    return TX_STARTED;
+}
+
+/**
+ * Description: Sets a function for the TX ISR to call each time the queue
+ *                  runs dry. It runs in interrupt context.
+ * @param callback: Function to call, NULL for none
+ */
+void UART_SetTxDrainedCallback(void (*callback)(void))
+{
+    txDrainedCallback = callback;
+}
+
+/**
+ * Description: Whether everything queued has been sent, including the last
+ *                  byte out of the shift register.
+ * @return bool true if the UART is done transmitting
+ */
+bool UART_IsTxIdle(void)
+{
+    return uartTx_IsQueueEmpty(&TX_Queue) && U1STAbits.TRMT;
+}
+
+/**
+ * Description: Waits in Idle for everything queued to be sent, through to
+ *                  TRMT. Call before powering the modem down, or its last
+ *                  command is cut off. Main loop only, like
+ *                  UART_Write_Buffer.
+ */
+void UART_WaitTxDone(void)
+{
+    uint8_t savedIPL = SRbits.IPL;
+    
+    while(!uartTx_IsQueueEmpty(&TX_Queue))
+    {
+        SRbits.IPL = 7;
+        if(!uartTx_IsQueueEmpty(&TX_Queue))
+        {
+            Idle();
+        }
+        SRbits.IPL = savedIPL;
+    }
+    
+    // At most the 4 byte FIFO and the shift register are left, ~5ms at
+    //  9600. The TX interrupt is moved to when the shift register empties,
+    //  so that is what wakes us
+    U1STAbits.UTXISEL0 = 1;
+    while(!U1STAbits.TRMT)
+    {
+        SRbits.IPL = 7;
+        IFS0bits.U1TXIF = false;
+        IEC0bits.U1TXIE = true;
+        if(!U1STAbits.TRMT)
+        {
+            Idle();
+        }
+        SRbits.IPL = savedIPL;
+    }
+    
+    // Back to interrupting while the FIFO has room, an ISR left on finds
+    //  the queue empty and turns itself off
+    U1STAbits.UTXISEL0 = 0;
+}
+
+/**
+ * Description: Whether the ISR has closed a line the main loop hasn't dropped
+ *                  yet. The UART_Line functions all work on that line.
+ * @return bool true if there is a line to read
+ */
+bool UART_IsLineReady(void)
+{
+    return rxLinesClosed != rxLinesTaken;
+}
+
+/**
+ * Description: One char of the current line, read in place.
+ * @param offset: Position in the line
+ * @return char the char, '\0' at the end of the line or if there is none
+ */
+char UART_LineChar(uint8_t offset)
+{
+    if(!UART_IsLineReady())
+    {
+        return '\0';
+    }
+    
+    return (char)uartRx_PeekQueue(&RX_Queue, offset);
+}
+
+/**
+ * Description: Whether the current line starts with prefix.
+ * @param prefix: NULL terminated text to look for
+ * @return bool true if it matches
+ */
+bool UART_LineStartsWith(const char *prefix)
+{
+    uint8_t i;
+    
+    for(i = 0; prefix[i] != '\0'; i++)
+    {
+        if(UART_LineChar(i) != prefix[i])
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * Description: Whether the current line is exactly text.
+ * @param text: NULL terminated text to look for
+ * @return bool true if it matches
+ */
+bool UART_LineEquals(const char *text)
+{
+    return UART_LineStartsWith(text) && UART_LineChar(strlen(text)) == '\0';
+}
+
+/**
+ * Description: Drops the current line from the queue, moving on to the next.
+ */
+void UART_DropLine(void)
+{
+    static const uint8_t lineEnd = '\0';
+    
+    if(!UART_IsLineReady())
+    {
+        return;
     }
     
-    return dataLen;
+    int16_t length = uartRx_FindQueue(&RX_Queue, &lineEnd, 1);
+    uartRx_DiscardQueue(&RX_Queue, length + 1);
+    rxLinesTaken++;
 }
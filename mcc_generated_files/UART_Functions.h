@@ -7,8 +7,11 @@
 #include "mcc.h"
 #include "queue.h"
 
-#define TX_QUEUE_SIZE       16
-#define RX_QUEUE_SIZE       16
+#define UART_BAUD_RATE      9600 // SIM800 autobauds to whatever we send
+#define UART_TX_QUEUE_SIZE  128 // Bytes waiting to go out, a power of two
+                                //  no more than 128
+#define UART_RX_QUEUE_SIZE  128 // Lines from the SIM800 the main loop hasn't
+                                //  read yet, a power of two no more than 128
 
 typedef enum {
             NO_TX_RX = 0x00,
@@ -20,14 +23,36 @@ typedef enum {
             RX_FAILED = 0x40
 } UART_STATUS;
 
-extern uint8_queue TX_Queue;
-extern uint8_queue RX_Queue;
+DECLARE_QUEUE(uartTx, uint8_t, UART_TX_QUEUE_SIZE)
+DECLARE_QUEUE(uartRx, uint8_t, UART_RX_QUEUE_SIZE)
+
+extern uartTx_queue TX_Queue;
+extern uartRx_queue RX_Queue;
+
+// Most bytes that have been waiting in the TX queue at once
+extern uint8_t txQueueHighWater;
+// RX bytes lost to a full queue, to U1STA OERR and to U1STA FERR
+extern uint16_t rxDroppedCount;
+extern uint16_t rxOverrunCount;
+extern uint16_t rxFramingErrorCount;
 
 void UART_Init(void);
+void UART_UpdateBaud(void);
 UART_STATUS UART_Write(char byte);
 UART_STATUS UART_Write_Buffer(char *dataPtr,
                             uint8_t dataLen);
-uint8_t UART_Read(char *dataPtr, uint8_t dataLen);
+uint8_t UART_WriteAsync(const char *dataPtr, uint8_t dataLen);
+void UART_SetTxDrainedCallback(void (*callback)(void));
+bool UART_IsTxIdle(void);
+void UART_WaitTxDone(void);
+void __attribute__((interrupt, no_auto_psv)) _U1TXInterrupt(void);
+void __attribute__((interrupt, no_auto_psv)) _U1RXInterrupt(void);
+void __attribute__((interrupt, no_auto_psv)) _U1ErrInterrupt(void);
+bool UART_IsLineReady(void);
+char UART_LineChar(uint8_t offset);
+bool UART_LineStartsWith(const char *prefix);
+bool UART_LineEquals(const char *text);
+void UART_DropLine(void);
 
 #ifdef	__cplusplus
 extern "C" {
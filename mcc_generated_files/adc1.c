@@ -108,7 +108,7 @@ void ADC1_Initialize(void) {
     AD1CSSH = 0x0000;
 
 
-    adc1_obj.intSample = AD1CON2bits.SMPI;
+    adc1_obj.intSample = AD1CON2bits.SMPI + 1;
 
     // Enabling ADC1 interrupt.
     IEC0bits.AD1IE = 1;
@@ -200,13 +200,50 @@ void ADC1_ReferenceSelect(ADC1_REFERENCE reference) {
     AD1CON2bits.PVCFG = reference;
 }
 
+void ADC1_ScanSelect(uint16_t scanMask, uint8_t conversionsPerInterrupt) {
+    // Channels are scanned in ascending order, results land in
+    //  ADC1BUF0 upwards
+    AD1CSSL = scanMask;
+    AD1CON2bits.SMPI = conversionsPerInterrupt - 1;
+    AD1CON2bits.CSCNA = 1;
+
+    adc1_obj.intSample = conversionsPerInterrupt;
+}
+
+void ADC1_ScanDisable(void) {
+    AD1CON2bits.CSCNA = 0;
+    AD1CON2bits.SMPI = 0;
+
+    adc1_obj.intSample = 1;
+}
+
+bool ADC1_IsScanEnabled(void) {
+    return AD1CON2bits.CSCNA;
+}
+
+void ADC1_AutoSampleStart(void) {
+    AD1CON1bits.ASAM = 1;
+}
+
+void ADC1_AutoSampleStop(void) {
+    AD1CON1bits.ASAM = 0;
+}
+
 void __attribute__((__interrupt__, auto_psv)) _ADC1Interrupt(void) {
+    uint16_t startTicks = TMR5_Counter16BitGet();
+    
     // clear the ADC interrupt flag
     IFS0bits.AD1IF = false;
     
-    
+    if (ADC1_IsScanEnabled())
+    {
+        // The accelerometer scan delivers both axes in one interrupt,
+        //  stop auto-sampling before the next sequence begins
+        ADC1_AutoSampleStop();
+        ADCAccelHandler();
+    }
     // Check if we finished a conversion
-    if (ADC1_IsConversionComplete())
+    else if (ADC1_IsConversionComplete())
     {
         ADC1_Stop();
         // figure out what channel the conversion was
@@ -237,6 +274,8 @@ void __attribute__((__interrupt__, auto_psv)) _ADC1Interrupt(void) {
                         
             
     }
+    
+    RecordISRTime(ISR_ADC, startTicks);
 }
 
 
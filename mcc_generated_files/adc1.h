@@ -355,6 +355,34 @@ extern "C" {
     
     void ADC1_ReferenceSelect(ADC1_REFERENCE reference);
     
+    /**
+      @Summary
+        Enables channel scanning over the selected inputs
+
+      @Description
+        This routine loads AD1CSSL with the inputs to scan and sets SMPI so
+        that a single ADC interrupt is raised once every input in the scan
+        has been converted. Results are stored in ascending channel order
+        starting at ADC1BUF0.
+
+      @Preconditions
+        ADC1_Initializer() function should have been 
+        called before calling this function.
+
+      @Returns
+        None
+
+      @Param
+        scanMask - AD1CSSL bit mask of the inputs to scan
+        conversionsPerInterrupt - number of inputs set in scanMask
+     */
+
+    void ADC1_ScanSelect(uint16_t scanMask, uint8_t conversionsPerInterrupt);
+    void ADC1_ScanDisable(void);
+    bool ADC1_IsScanEnabled(void);
+    void ADC1_AutoSampleStart(void);
+    void ADC1_AutoSampleStop(void);
+    
 
 
 #ifdef __cplusplus  // Provide C++ Compatibility
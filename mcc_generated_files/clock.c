@@ -0,0 +1,93 @@
+/*
+ * File:   clock.c
+ */
+
+
+#include "xc.h"
+#include "clock.h"
+#include "UART_Functions.h"
+#include "I2C_Functions.h"
+
+/*
+ Owns the oscillator. The system clock is the 8MHz FRC divided by 2, so the
+ peripherals (Timer2/3/5, ADC, UART, I2C) always see a 2MHz Tcy and every
+ tick constant in constants.h holds in either mode. CLOCK_LOW only slows the
+ CPU with DOZE, which keeps the peripheral clock, so there is never a
+ timebase to fix up behind a running timer.
+
+ GetFCY is the CPU instruction rate the delay functions count in, and the
+ baud rate generators are worked out from GetPeripheralClock on every switch.
+ */
+
+static CLOCK_MODE clockMode = CLOCK_FAST;
+static uint32_t fcyHz = CLOCK_PERIPHERAL_HZ;
+
+/**
+ * Description: Sets up the oscillator in CLOCK_FAST and starts the SOSC for
+ *      the RTCC. Called by OSCILLATOR_Initialize.
+ */
+void ClockInit(void)
+{
+    // DOZEN disabled; DOZE 1:8; RCDIV FRC/2; ROI disabled; 
+    CLKDIV = 0x3100;
+    // Set the secondary oscillator
+    OSCCONbits.SOSCEN = 1;
+
+    clockMode = CLOCK_FAST;
+    fcyHz = CLOCK_PERIPHERAL_HZ;
+}
+
+/**
+ * Description: Switches the CPU speed and works out everything that depends
+ *      on it again. The UART and I2C baud rates are only rewritten if they
+ *      changed, so a byte on the wire isn't cut short.
+ * @param mode: CLOCK_LOW or CLOCK_FAST
+ */
+void SetClockMode(CLOCK_MODE mode)
+{
+    if (mode == CLOCK_LOW)
+    {
+        CLKDIVbits.DOZE = CLOCK_LOW_DOZE;
+        CLKDIVbits.DOZEN = 1;
+        fcyHz = CLOCK_PERIPHERAL_HZ >> CLOCK_LOW_DOZE;
+    }
+    else
+    {
+        CLKDIVbits.DOZEN = 0;
+        fcyHz = CLOCK_PERIPHERAL_HZ;
+    }
+
+    clockMode = mode;
+
+    // No-ops while only DOZE changes, kept for a future postscaler change
+    UART_UpdateBaud();
+    I2C_UpdateBaud();
+}
+
+/**
+ * Description: Current clock mode.
+ * @return CLOCK_MODE set by SetClockMode
+ */
+CLOCK_MODE GetClockMode(void)
+{
+    return clockMode;
+}
+
+/**
+ * Description: Instruction rate of the CPU right now, what the delay
+ *      functions count in.
+ * @return uint32_t FCY in Hz
+ */
+uint32_t GetFCY(void)
+{
+    return fcyHz;
+}
+
+/**
+ * Description: Tcy rate the peripherals run from, whatever the CPU is doing.
+ * @return uint32_t peripheral clock in Hz
+ */
+uint32_t GetPeripheralClock(void)
+{
+    return CLOCK_PERIPHERAL_HZ;
+}
@@ -0,0 +1,35 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef CLOCK_H
+#define	CLOCK_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CLOCK_PERIPHERAL_HZ     2000000UL // 8MHz FRC / 2 (RCDIV), / 2 per Tcy
+#define CLOCK_LOW_DOZE          3 // DOZE bits for CLOCK_LOW, CPU at 1:8
+
+typedef enum {
+            CLOCK_LOW, // CPU dozes, for sampling while idle
+            CLOCK_FAST // CPU at the peripheral clock, for messages and the modem
+} CLOCK_MODE;
+
+void ClockInit(void);
+void SetClockMode(CLOCK_MODE mode);
+CLOCK_MODE GetClockMode(void);
+uint32_t GetFCY(void);
+uint32_t GetPeripheralClock(void);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
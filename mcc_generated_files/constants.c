@@ -9,11 +9,30 @@
 #include "xc.h"
 #include "constants.h"
 
-const float c_MKIILiterPerDegree = .002949606; // .169 L/Rad converted to L/Deg
-// .169 L/Rad Specified in 1.0 Firmware "IWPUtilities.c"
-const float c_UpstrokeToMeters = 0.01287;
-const float c_MaxLitersToLeak = 0.01781283;
+// The scaled values are worked out by the compiler, nothing here is float at
+//  run time
+// .169 L/Rad Specified in 1.0 Firmware "IWPUtilities.c" is .002949606 L/Deg,
+//  kept as mL per hundredth of a degree in Q16
+const uint16_t c_MKIIMilliliterPerCentidegree = (uint16_t)(0.002949606 * 10.0 * 65536.0 + 0.5);
+// 0.01287 m/Deg kept as mm per hundredth of a degree in Q12
+const uint16_t c_UpstrokeMillimeterPerCentidegree = (uint16_t)(0.01287 * 10.0 * 4096.0 + 0.5);
+// 0.01781283 L leaked over the leak time, kept as mL/h * ms
+const uint32_t c_MaxLeakMilliliterHourMS = (uint32_t)(0.01781283 * 1000.0 * 3600.0 * 1000.0 + 0.5);
 
-const float c_RadToDegrees = 57.2957914; // 180 / pi()
 const int c_AdjustmentFactor = 2047; // 1/2 of 12 bit ADC
-const float c_BattADCToFloat = .00100469;
\ No newline at end of file
+// .00100469 V per count kept as mV per count in Q16
+const uint32_t c_BattADCToMillivolts = (uint32_t)(1.00469 * 65536.0 + 0.5);
+
+// atan(i / ATAN_TABLE_SIZE) in hundredths of a degree, i = 0 to ATAN_TABLE_SIZE
+//  covers the first octant, the rest is folded onto it in Atan2Centidegrees
+const uint16_t c_AtanTable[ATAN_TABLE_SIZE + 1] = {
+    0, 90, 179, 268, 358, 447, 536, 624,
+    713, 800, 888, 975, 1062, 1148, 1234, 1319,
+    1404, 1488, 1571, 1653, 1735, 1817, 1897, 1977,
+    2056, 2134, 2211, 2287, 2363, 2438, 2511, 2584,
+    2657, 2728, 2798, 2867, 2936, 3003, 3070, 3136,
+    3201, 3264, 3327, 3390, 3451, 3511, 3571, 3629,
+    3687, 3744, 3800, 3855, 3909, 3963, 4016, 4067,
+    4119, 4169, 4218, 4267, 4315, 4363, 4409, 4455,
+    4500
+};
\ No newline at end of file
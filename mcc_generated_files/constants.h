@@ -4,6 +4,7 @@
 #define	CONSTANTS_H
 
 #include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdint.h>
 
 /*
  Definitions
@@ -11,32 +12,76 @@
 
 #define BATTERY_LOW_THRESHOLD           2880 // Should be 3.5VDC [(3.5 * 4.11523) / 2.048] * 2^12
 #define MESSAGE_LENGTH                  160 // maximum length of a text message
-#define NETWORK_SEARCH_TIMEOUT_MS       300000 // Time in MS to search for
-                                               //  the network
-#define HANDLE_MOVEMENT_THRESHOLD       5 // Degrees that handle must move
-                                          //  to be considered moving
-#define TEXT_SEND_TIMEOUT_SECONDS       30 // seconds to wait for a text to send
+#define FIRMWARE_VERSION                0x20 // 2.0, major and minor nibbles,
+                                             //  sent in every report
+#define NETWORK_SEARCH_TIMEOUT_MS       300000UL // Time in MS to search for
+                                                 //  the network
+#define HANDLE_MOVEMENT_THRESHOLD       500 // Hundredths of a degree that handle
+                                            //  must move to be considered moving
 
 #define DEPTH_BUFFER_SIZE               8 // Depth sensor buffer
 #define BATTERY_BUFFER_SIZE             8 // Battery buffer
-#define Y_AXIS_BUFFER_SIZE              8 // Y axis ADC Buffer
-#define X_AXIS_BUFFER_SIZE              8 // X axis ADC Buffer
-#define ANGLES_TO_AVERAGE               10 // Defines number of angles in 
-                                           //  the float queue
-#define WATER_PERIOD_LOW_BOUND          100 // ~2.5kHz
-#define WATER_PERIOD_HIGH_BOUND         385 // ~650Hz
-#define NETLIGHT_PERIOD_LOW_BOUND       19500 // ~2.5 seconds
-#define NETLIGHT_PERIOD_HIGH_BOUND      27350 // ~3.5 seconds
+#define ACCEL_BLOCK_SIZE                8 // X/Y pairs per accelerometer block
+#define ANGLE_FILTER_SHIFT              3 // Handle angles are averaged over
+                                          //  2^ANGLE_FILTER_SHIFT samples
+#define ACCEL_SCAN_MASK                 0x8800 // AD1CSSL bits for AN15 (X axis)
+                                               //  and AN11 (Y axis)
+#define ACCEL_SCAN_CONVERSIONS          2 // Conversions per accelerometer scan
+#define ACCEL_FAST_PERIOD_MS            10 // Sample period while the handle moves
+#define ACCEL_IDLE_PERIOD_MS            100 // Sample period while the handle
+                                            //  is still
+#define ACCEL_IDLE_AFTER_MS             5000 // Time the handle must be still
+                                             //  before slowing down
+#define ACCEL_DEEP_PERIOD_MS            250 // Sample period in deep sleep
+#define DEEP_SLEEP_AFTER_MS             600000UL // Time the handle must be
+                                                 //  still and dry before deep
+                                                 //  sleep (10 minutes)
+#define TMR1_TICKS_PER_MS               31 // Timer1 runs from the 31kHz LPRC
+#define TMR5_TICKS_PER_MS               2000 // Timer5 runs from FCY, 0.5us ticks
+#define BATTERY_READ_PERIOD_MS          1800000UL // 30 minutes between
+                                                  //  battery reads
+#define ATAN_TABLE_SIZE                 64 // Segments in the first octant of
+                                           //  the atan lookup table
+#define WATER_CHECK_PERIOD_MS           500 // Time between scheduled WPS
+                                            //  measurement windows
+#define WATER_GATE_MS                   50 // Minimum time WPS edges are counted
+                                           //  for in one window
+#define WPS_WARMUP_MS                   20 // Time the WPS needs after power up
+                                           //  before its edges can be counted
+#define WATER_ON_LOW_HZ                 650 // WPS frequency band that turns
+#define WATER_ON_HIGH_HZ                2500 //  water present on
+#define WATER_OFF_LOW_HZ                550 // Wider band water present must
+#define WATER_OFF_HIGH_HZ               2700 //  leave to turn off again
+// Netlight bounds are in Timer3 ticks (128us)
+#define NETLIGHT_ON_LOW_BOUND           234 // ~30ms, every pattern is 64ms on
+#define NETLIGHT_ON_HIGH_BOUND          1172 // ~150ms
+#define NETLIGHT_GPRS_LOW_BOUND         1172 // ~150ms off, 300ms nominal
+#define NETLIGHT_GPRS_HIGH_BOUND        3906 // ~500ms
+#define NETLIGHT_SEARCH_LOW_BOUND       3906 // ~500ms off, 800ms nominal
+#define NETLIGHT_SEARCH_HIGH_BOUND      11719 // ~1.5 seconds
+#define NETLIGHT_REG_LOW_BOUND          15625 // ~2 seconds off, 3s nominal
+#define NETLIGHT_REG_HIGH_BOUND         35156 // ~4.5 seconds
+#define NETLIGHT_CONFIDENCE             2 // Blinks in a row a pattern needs
+                                          //  to change the network state
+#define NETLIGHT_QUIET_MS               5000 // No blinks for this long means
+                                             //  the network state is unknown
+#define RTCC_SYNC_HOUR                  1 // Hour the RTCC is resynced from the
+                                          //  MCP7940, clear of midnight and
+                                          //  the bin boundaries
+#define RTCC_SYNC_RETRY_MS              1000 // First retry of a failed MCP7940
+                                             //  read, doubling each try
+#define RTCC_SYNC_TRIES                 6 // Reads before the internal RTCC is
+                                          //  left to run on its own
 /*
  Constants
  */
-extern const float c_RadToDegrees;
 extern const int c_AdjustmentFactor;
 
-extern const float c_MKIILiterPerDegree;
-extern const float c_UpstrokeToMeters;
-extern const float c_MaxLitersToLeak;
-extern const float c_BattADCToFloat;
+extern const uint16_t c_MKIIMilliliterPerCentidegree;
+extern const uint16_t c_UpstrokeMillimeterPerCentidegree;
+extern const uint32_t c_MaxLeakMilliliterHourMS;
+extern const uint32_t c_BattADCToMillivolts;
+extern const uint16_t c_AtanTable[ATAN_TABLE_SIZE + 1];
 
 
 #ifdef	__cplusplus
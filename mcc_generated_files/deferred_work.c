@@ -0,0 +1,165 @@
+/*
+ * File:   deferred_work.c
+ */
+
+
+#include "xc.h"
+#include "deferred_work.h"
+#include "tmr3.h"
+#include "tmr5.h"
+
+/*
+ ISRs post a work item and return, the main loop pulls them and does the
+ slow part. There is one queue per priority, each with the same single
+ producer / single consumer scheme as queue.h. Every ISR runs at priority 4,
+ so they never interrupt each other and count as a single producer.
+ */
+typedef struct work_queue {
+    volatile work_item contents[WORK_QUEUE_SIZE];
+    volatile uint8_t head; // Next slot to post to, ISRs only
+    volatile uint8_t tail; // Next slot to pull, main loop only
+} work_queue;
+
+static work_queue workQueues[WORK_PRIORITY_COUNT];
+
+volatile uint16_t pendingEvents = 0;
+
+uint16_t isrWorstTicks[ISR_PROFILE_COUNT];
+uint8_t workQueueHighWater = 0;
+uint16_t workDropped = 0;
+
+/**
+ * Description: Empties the work queues and clears the instrumentation.
+ */
+void InitDeferredWork(void)
+{
+    uint8_t i;
+    
+    for (i = 0; i < WORK_PRIORITY_COUNT; i++)
+    {
+        workQueues[i].head = 0;
+        workQueues[i].tail = 0;
+    }
+    
+    for (i = 0; i < ISR_PROFILE_COUNT; i++)
+    {
+        isrWorstTicks[i] = 0;
+    }
+    
+    workQueueHighWater = 0;
+    workDropped = 0;
+    pendingEvents = 0;
+}
+
+/**
+ * Description: Posts a work item for the main loop, stamped with the Timer3
+ *                  count. ISR side only.
+ * @param id: What has to be done
+ * @param payload: Data for it, meaning depends on id
+ * @return bool false if the queue for its priority was full and the item
+ *                  was dropped
+ */
+bool PostWork(WORK_ID id, uint16_t payload)
+{
+    work_queue *queueP = &workQueues[id < WORK_LOW_PRIORITY_START ? 0 : 1];
+    uint8_t head = queueP->head;
+    uint8_t depth = (uint8_t)(head - queueP->tail);
+    
+    if (depth >= WORK_QUEUE_SIZE)
+    {
+        workDropped++;
+        return false;
+    }
+    
+    volatile work_item *slot = &queueP->contents[head & (WORK_QUEUE_SIZE - 1)];
+    slot->id = id;
+    slot->payload = payload;
+    slot->timestamp = TMR3_Counter16BitGet();
+    // Publish the item only once it is in place
+    queueP->head = head + 1;
+    RaiseEvent(EVENT_WORK_POSTED);
+    
+    depth++;
+    if (depth > workQueueHighWater)
+    {
+        workQueueHighWater = depth;
+    }
+    
+    return true;
+}
+
+/**
+ * Description: Pulls the oldest item of the highest priority that has one.
+ *                  Main loop only.
+ * @param item: Filled with the item
+ * @return bool false if there was no work
+ */
+bool PullWork(work_item *item)
+{
+    uint8_t i;
+    
+    for (i = 0; i < WORK_PRIORITY_COUNT; i++)
+    {
+        work_queue *queueP = &workQueues[i];
+        uint8_t tail = queueP->tail;
+        
+        if (queueP->head != tail)
+        {
+            volatile work_item *slot =
+                    &queueP->contents[tail & (WORK_QUEUE_SIZE - 1)];
+            item->id = slot->id;
+            item->payload = slot->payload;
+            item->timestamp = slot->timestamp;
+            // Free the slot only once the item has been read
+            queueP->tail = tail + 1;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * Description: Keeps the longest time an ISR has taken. Called on the way
+ *                  out of the ISR.
+ * @param isr: Which ISR
+ * @param startTicks: Timer5 count read on the way in
+ */
+void RecordISRTime(ISR_PROFILE_ID isr, uint16_t startTicks)
+{
+    uint16_t ticks = TMR5_Counter16BitGet() - startTicks;
+    
+    if (ticks > isrWorstTicks[isr])
+    {
+        isrWorstTicks[isr] = ticks;
+    }
+}
+
+/**
+ * Description: Sets event bits for the main loop. Safe from the main loop
+ *                  and the ISRs alike.
+ * @param events: EVENT_ bits to set
+ */
+void RaiseEvent(uint16_t events)
+{
+    __builtin_disi(0x3FFF); // The read-modify-write can't be interrupted
+    pendingEvents |= events;
+    __builtin_disi(0);
+}
+
+/**
+ * Description: Takes every pending event bit, leaving none set. Main loop
+ *                  only.
+ * @return uint16_t EVENT_ bits that were set
+ */
+uint16_t TakeEvents(void)
+{
+    uint16_t events;
+    
+    __builtin_disi(0x3FFF);
+    events = pendingEvents;
+    pendingEvents = 0;
+    __builtin_disi(0);
+    
+    return events;
+}
@@ -0,0 +1,84 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef DEFERRED_WORK_H
+#define	DEFERRED_WORK_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WORK_QUEUE_SIZE         8 // Items per priority, must be a power of two
+
+// Event bits the ISRs raise for the main loop
+#define EVENT_WORK_POSTED       0x0001 // There is something in a work queue
+#define EVENT_ACCEL_BLOCK       0x0002 // accelBlocks[fullAccelBlock] is full
+#define EVENT_DEPTH_BUFFER      0x0004 // depthBuffer is full
+#define EVENT_BATTERY_BUFFER    0x0008 // batteryBuffer is full
+#define EVENT_MIDNIGHT          0x0010 // The day changed on the hourly alarm
+#define EVENT_RTCC_SYNC         0x0020 // The RTCC sync retry is due
+#define EVENT_MODEM             0x0040 // The SIM800 answered, or AT_Process
+                                       //  has something to do
+#define EVENT_OUTBOX            0x0080 // Reports are due to be tried again
+
+typedef enum {
+            // High priority
+            WORK_RTCC_ALARM, // The hourly RTCC alarm went off
+            WORK_RTCC_LOADED, // The RTCC was loaded from the MCP7940
+            WORK_I2C_RECOVER, // The I2C bus is stuck, payload is the status
+                              //  to fail the transaction with
+            // Low priority, only run once nothing above is waiting
+            WORK_NETLIGHT_EDGE, // payload is the netlight level after the edge
+            WORK_NETLIGHT_QUIET, // No netlight edges for NETLIGHT_QUIET_MS
+            WORK_ID_COUNT
+} WORK_ID;
+
+#define WORK_LOW_PRIORITY_START     WORK_NETLIGHT_EDGE
+#define WORK_PRIORITY_COUNT         2
+
+typedef struct work_item {
+    uint8_t id; // WORK_ID
+    uint16_t payload;
+    uint16_t timestamp; // Timer3 count (128us ticks) when it was posted
+} work_item;
+
+typedef enum {
+            ISR_TIMER1,
+            ISR_ADC,
+            ISR_CN,
+            ISR_I2C,
+            ISR_RTCC,
+            ISR_UART_TX,
+            ISR_UART_RX,
+            ISR_UART_ERR,
+            ISR_PROFILE_COUNT
+} ISR_PROFILE_ID;
+
+// Events raised and not yet taken by the main loop
+extern volatile uint16_t pendingEvents;
+
+// Longest time each ISR has taken, in Timer5 ticks (0.5us)
+extern uint16_t isrWorstTicks[ISR_PROFILE_COUNT];
+// Most items that have been waiting in one priority at once, and how many
+//  were dropped because their queue was full
+extern uint8_t workQueueHighWater;
+extern uint16_t workDropped;
+
+void InitDeferredWork(void);
+bool PostWork(WORK_ID id, uint16_t payload);
+bool PullWork(work_item *item);
+void RecordISRTime(ISR_PROFILE_ID isr, uint16_t startTicks);
+void RaiseEvent(uint16_t events);
+uint16_t TakeEvents(void);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
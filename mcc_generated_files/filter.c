@@ -0,0 +1,54 @@
+/*
+ * File:   filter.c
+ */
+
+
+#include "xc.h"
+#include "filter.h"
+
+/**
+ * Description: Inits a moving average filter. The filter is empty until the
+ *                  first update.
+ * @param filterP: Pointer to the filter to init
+ */
+void InitMovingAverage(moving_average *filterP)
+{
+    filterP->sum = 0;
+    filterP->index = 0;
+    filterP->isPrimed = false;
+}
+
+/**
+ * Description: Adds one sample to the moving average and returns the new
+ *                  average. The oldest sample leaves the running sum as the
+ *                  new one enters it, so the cost doesn't depend on the window.
+ * @param filterP: Pointer to the filter to update
+ * @param sample: New sample
+ * @return int16_t average of the last ANGLE_FILTER_SIZE samples
+ * 
+ * Note: The first sample fills the whole window, so the average starts at
+ *          that sample instead of ramping up from 0.
+ */
+int16_t UpdateMovingAverage(moving_average *filterP, int16_t sample)
+{
+    if(!filterP->isPrimed)
+    {
+        uint8_t i;
+        for(i = 0; i < ANGLE_FILTER_SIZE; i++)
+        {
+            filterP->samples[i] = sample;
+        }
+        filterP->sum = (int32_t)sample << ANGLE_FILTER_SHIFT;
+        filterP->isPrimed = true;
+        
+        return sample;
+    }
+    
+    filterP->sum -= filterP->samples[filterP->index];
+    filterP->sum += sample;
+    filterP->samples[filterP->index] = sample;
+    // Window is a power of two, so the wrap is a mask
+    filterP->index = (filterP->index + 1) & (ANGLE_FILTER_SIZE - 1);
+    
+    return (int16_t)(filterP->sum >> ANGLE_FILTER_SHIFT);
+}
@@ -0,0 +1,35 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef FILTER_H
+#define	FILTER_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+#include "constants.h"
+
+#define ANGLE_FILTER_SIZE       (1 << ANGLE_FILTER_SHIFT)
+
+typedef struct moving_average {
+    int16_t samples[ANGLE_FILTER_SIZE];
+    int32_t sum; // Running sum of everything in samples
+    uint8_t index; // Oldest sample, overwritten by the next update
+    bool isPrimed;
+} moving_average;
+
+void InitMovingAverage(moving_average *filterP);
+int16_t UpdateMovingAverage(moving_average *filterP, int16_t sample);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
+
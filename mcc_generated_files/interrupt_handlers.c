@@ -18,27 +18,78 @@ uint8_t batteryBufferDepth = 0;
 time_s PreviousTime;
 time_s CurrentTime;
 
-uint16_queue xQueue;
-uint16_queue yQueue;
-float_queue angleQueue;
+// Ping-pong accelerometer blocks. The ADC ISR fills one while the main
+//  loop processes the other.
+accel_block accelBlocks[2];
+uint8_t fullAccelBlock = 0;
+uint16_t accelBlockOverruns = 0;
+// Current accelerometer sample period, changed by RequestAccelSamplePeriod
+uint8_t accelPeriodMS = ACCEL_FAST_PERIOD_MS;
+
+static uint8_t fillAccelBlock = 0;
+static uint8_t fillAccelIndex = 0;
+static uint8_t accelBlockLength = ACCEL_BLOCK_SIZE;
+static uint8_t requestedAccelPeriodMS = ACCEL_FAST_PERIOD_MS;
+static soft_timer accelTimer;
+static soft_timer batteryTimer;
+
+moving_average angleFilter;
 
 /**
  Event Flags
  **/
 
-bool depthBufferIsFull = false;
-bool batteryBufferIsFull = false;
-bool isMidnightPassed = false;
-bool isNetlightOn = false;
+bool accelBlockIsFull = false;
 bool isWaterPresent = false;
 
-static bool prevWPSValue = false;
+// Water presence is measured in short windows of WPS edges and cached, so
+//  nothing has to wait on the WPS to know if there is water. Windows are
+//  timed by a software timer, while Timer2 counts the WPS edges on T2CK.
+uint32_t waterCheckedMS = 0;
+static bool isWaterWindowOpen = false;
+static uint32_t waterWindowOpenMS = 0;
+static soft_timer waterTimer;
+// The WPS is powered down in deep sleep, isWaterPresent keeps its last value
+static bool isWPSPowered = true;
+
+// The netlight edges are timestamped off free running Timer3. Each on and
+//  off time pair is matched against the SIM800 blink patterns, and a pattern
+//  has to repeat NETLIGHT_CONFIDENCE times in a row before netState follows.
+NET_STATE netState = NET_UNKNOWN;
+static NET_STATE candidateNetState = NET_UNKNOWN;
+static uint8_t netConfidence = 0;
+static uint16_t netlightEdgeTicks = 0;
+static uint16_t netlightOnTicks = 0;
+static soft_timer netlightQuietTimer;
+
 static bool prevSimNetlightValue = false;
 static bool prevSimStatusValue = false;
 
+// The ADC is shared between the accelerometer scan and single battery/depth
+//  conversions. Whoever finds it busy leaves a pending request that the ADC
+//  ISR starts when the current conversion finishes.
+static bool isADCBusy = false;
+static bool isAccelScanPending = false;
+static bool isBatteryReadPending = false;
+
+// Awake time is measured off Timer5, which stops in Sleep, from the end of
+//  one WaitForEvent to the start of the next
+uint32_t activeMS = 0;
+uint32_t sleepCount = 0;
+uint32_t idleCount = 0;
+static uint16_t activeTicks = 0; // Timer5 ticks short of a whole ms
+static uint16_t wakeTicks = 0;
+static uint32_t wakeMS = 0;
+
+static void AccelTimerHandler(void);
+static void BatteryTimerHandler(void);
+static void WaterTimerHandler(void);
+static void NetlightQuietTimerHandler(void);
+static void ApplyAccelSamplePeriod(void);
+
 /**
  * Description: Initializes the CN interrupts for SIM_STATUS, SIM_NETLIGHT,
- *                  and WPS inputs - to keep track of frequencies.
+ *                  and the RTCC MFP - to keep track of frequencies and alarms.
  */
 void InitIOCInterrupt(void)
 {
@@ -51,7 +102,7 @@ void InitIOCInterrupt(void)
     // Enable specific pins
     CNEN1bits.CN9IE = true; // SimStatus Change
     CNEN1bits.CN12IE = true; // SimNetlight Change
-    CNEN2bits.CN27IE = true; // WPS Change
+    // WPS edges are counted by Timer2, not the CN interrupt
 }
 
 /**
@@ -62,35 +113,29 @@ void InitIOCInterrupt(void)
  */
 void __attribute__((interrupt, no_auto_psv)) _CNInterrupt(void)
 {
+    uint16_t startTicks = TMR5_Counter16BitGet();
+    
     // Clear the interrupt flag
     IFS1bits.CNIF = false;
     // Handle the interrupt
     IOCHandler();
+    
+    RecordISRTime(ISR_CN, startTicks);
 }
 
 /**
  * Description: CN Handler. Figures out which of the pins triggered the CN ISR.
- *                  Currently, this handler only catches positive edges for WPS
- *                  and for the netlight, but catches both for status.
+ *                  Both netlight and status edges are caught.
  */
 void IOCHandler(void)
 {
-    if (wpsMeasure_GetValue() != prevWPSValue)
-    {
-        // We must have measured a WPS event
-        
-        // Get rid of this, because we only want to measure positive change
-        //prevWPSValue = !prevWPSValue;
-        UpdateWaterStatus();
-    }
-    
     if (simNetlight_GetValue() != prevSimNetlightValue)
     {
-        // We must have measured a Netlight event
-        
-        // Get rid of this, because we only want to measure positive change
-        //prevSimNetlightValue = !prevSimNetlightValue;
-        UpdateNetStatus();
+        // We must have measured a Netlight event, the main loop times it
+        prevSimNetlightValue = !prevSimNetlightValue;
+        ScheduleTimerAt(&netlightQuietTimer, GetTimeMS() + NETLIGHT_QUIET_MS,
+                NetlightQuietTimerHandler);
+        PostWork(WORK_NETLIGHT_EDGE, prevSimNetlightValue);
     }
     
     if (simStatus_GetValue() != prevSimStatusValue)
@@ -101,201 +146,525 @@ void IOCHandler(void)
 }
 
 /**
- * Description: Function to turn off CN interrupts for the WPS. This is implemented
- *                  because the WPS sensor has a relatively high frequency, and thus
- *                  can cause problems in other processing functions if it is left
- *                  on continuously.
+ * Description: Initializes the filter used to average handle angles, and the
+ *                  deferred work queues.
  */
-void TurnOffWPSIOC(void)
+void InitQueues(void)
 {
-    CNEN2bits.CN27IE = false;
+    InitMovingAverage(&angleFilter);
+    InitDeferredWork();
 }
 
 /**
- * Description: Function to turn on CN interrupts for the WPS. This is implemented
- *                  to turn the WPS interrupts on when we need to know if there is
- *                  water once again.
+ * Description: Starts the periodic work on the timer service: accelerometer
+ *                  samples, battery reads, WPS windows (the first one right
+ *                  away) and the netlight quiet time. Call after
+ *                  InitTimerService.
  */
-void TurnOnWPSIOC(void)
+void InitTimers(void)
 {
-    CNEN2bits.CN27IE = true;
+    ScheduleTimerEvery(&accelTimer, accelPeriodMS, AccelTimerHandler);
+    ScheduleTimerEvery(&batteryTimer, BATTERY_READ_PERIOD_MS,
+            BatteryTimerHandler);
+    ScheduleTimerAt(&waterTimer, GetTimeMS(), WaterTimerHandler);
+    ScheduleTimerAt(&netlightQuietTimer, GetTimeMS() + NETLIGHT_QUIET_MS,
+            NetlightQuietTimerHandler);
 }
 
 /**
- * Description: Checks if the WPS CN interrupt is currently active.
- * @return boolean indicating whether the WPS IOC is currently active.
+ * Description: Whether everything still running can be left alone in Sleep.
+ *                  The ADC, I2C, UART and Timer2/3 run off the instruction
+ *                  clock, so an ADC conversion, an I2C transaction, a UART
+ *                  send or an AT command waiting on an answer, a WPS window
+ *                  or a blinking netlight (timed off Timer3) needs Idle.
+ *                  So does an awake SIM800, which can send a URC any time.
+ *                  Interrupts must be held off.
+ * @return bool true if Sleep is allowed
  */
-bool IsWPSIOCOn(void)
+static bool IsSleepAllowed(void)
 {
-    return (bool)CNEN2bits.CN27IE;
+    return !isADCBusy && !isWaterWindowOpen &&
+            !netlightQuietTimer.isScheduled && I2C_IsEngineIdle() &&
+            UART_IsTxIdle() && AT_IsEngineIdle() && !Modem_IsAwake();
 }
 
 /**
- * Description: Initializes the 3 queues used to track handle movements and water.
- *                  - xQueue, yQueue, and angleQueue.
+ * Description: Puts the CPU in Sleep, or Idle if something needs the
+ *                  instruction clock, until an interrupt comes in. Returns
+ *                  straight away if an event is already pending. The ISRs are
+ *                  held off while deciding, a pending one still wakes the CPU
+ *                  and runs once we are back at IPL 0.
+ *                  Timer1 wakes the CPU at least every TIMER_MAX_PERIOD_MS,
+ *                  well inside the ~135s watchdog period, so kicking it once
+ *                  a pass means it only fires if the main loop hangs. Main
+ *                  loop only.
  */
-void InitQueues(void)
+void WaitForEvent(void)
 {
-    uint16_InitQueue(&xQueue, X_AXIS_BUFFER_SIZE);
-    uint16_InitQueue(&yQueue, Y_AXIS_BUFFER_SIZE);
-    float_InitQueue(&angleQueue, ANGLES_TO_AVERAGE);
+    uint16_t awakeTicks = TMR5_Counter16BitGet() - wakeTicks;
+    uint32_t awakeMS = GetTimeMS() - wakeMS;
+    
+    // Timer5 wraps every 32ms, longer stretches are counted to the ms
+    if (awakeMS < 16)
+    {
+        awakeTicks += activeTicks;
+        activeMS += awakeTicks / TMR5_TICKS_PER_MS;
+        activeTicks = awakeTicks % TMR5_TICKS_PER_MS;
+    }
+    else
+    {
+        activeMS += awakeMS;
+    }
+    
+    SRbits.IPL = 7;
+    
+    if (pendingEvents == 0)
+    {
+        if (IsSleepAllowed())
+        {
+            sleepCount++;
+            Sleep();
+        }
+        else
+        {
+            idleCount++;
+            Idle();
+        }
+    }
+    
+    wakeTicks = TMR5_Counter16BitGet();
+    wakeMS = GetTimeMS();
+    SRbits.IPL = 0;
 }
 
 /**
- * Description: Called as part of IOC ISR if the WPS sensor is triggered.
- *                  Uses timer 2 to figure out how long since this function
- *                  was last called, and uses that value to decide if the wps
- *                  is currently reading an on or off value.
+ * Description: Decides if there is water from the number of WPS edges Timer2
+ *                  counted over a measurement window. Once water is present
+ *                  the frequency has to leave a wider band to turn it off, so
+ *                  a signal near the band edges doesn't flicker.
+ * @param edges: WPS edges counted during the window
+ * @param gateMS: Length of the window in ms
  */
-void UpdateWaterStatus(void)
+void UpdateWaterStatus(uint16_t edges, uint16_t gateMS)
 {
-    TMR2_Stop();
-    // Always compare to 0
-    uint16_t periodTicks = TMR2_Counter16BitGet();
+    // edges * 1000 / gateMS is the frequency in Hz, compared without the
+    //  divide
+    uint32_t edgesPerSecond = (uint32_t)edges * 1000;
     
-    if (periodTicks >= WATER_PERIOD_LOW_BOUND && 
-            periodTicks <= WATER_PERIOD_HIGH_BOUND)
+    if (isWaterPresent)
     {
-        isWaterPresent = true;
+        isWaterPresent =
+                edgesPerSecond >= (uint32_t)WATER_OFF_LOW_HZ * gateMS &&
+                edgesPerSecond <= (uint32_t)WATER_OFF_HIGH_HZ * gateMS;
     }
     else
     {
-        isWaterPresent = false;
+        isWaterPresent =
+                edgesPerSecond >= (uint32_t)WATER_ON_LOW_HZ * gateMS &&
+                edgesPerSecond <= (uint32_t)WATER_ON_HIGH_HZ * gateMS;
     }
+}
+
+/**
+ * Description: Opens or closes the WPS measurement window. A window is open
+ *                  for WATER_GATE_MS, with Timer2 counting WPS edges the
+ *                  whole time, and the next opens WATER_CHECK_PERIOD_MS after
+ *                  it closes. Closing a window publishes isWaterPresent and
+ *                  stamps waterCheckedMS.
+ */
+static void WaterTimerHandler(void)
+{
+    uint32_t nowMS = GetTimeMS();
     
-    // Set the timer back to zero
-    TMR2_Counter16BitSet(0);
+    if (isWaterWindowOpen)
+    {
+        TMR2_Stop();
+        isWaterWindowOpen = false;
+        UpdateWaterStatus(TMR2_Counter16BitGet(), nowMS - waterWindowOpenMS);
+        waterCheckedMS = nowMS;
+        ScheduleTimerAt(&waterTimer, nowMS + WATER_CHECK_PERIOD_MS,
+                WaterTimerHandler);
+    }
+    else
+    {
+        isWaterWindowOpen = true;
+        waterWindowOpenMS = nowMS;
+        TMR2_Counter16BitSet(0);
+        TMR2_Start();
+        ScheduleTimerAt(&waterTimer, nowMS + WATER_GATE_MS,
+                WaterTimerHandler);
+    }
+}
+
+/**
+ * Description: Asks for a water measurement window now, rather than waiting
+ *                  for the next scheduled one. Does nothing if a window is
+ *                  already open, or the WPS is powered down.
+ */
+void RequestWaterCheck(void)
+{
+    uint8_t savedIPL = SRbits.IPL;
+    SRbits.IPL = 7; // Hold off the Timer1 ISR
     
-    // Start it again for the next event
-    TMR2_Start();
+    if (isWPSPowered && !isWaterWindowOpen)
+    {
+        ScheduleTimerAt(&waterTimer, GetTimeMS(), WaterTimerHandler);
+    }
+    
+    SRbits.IPL = savedIPL;
+}
+
+/**
+ * Description: Powers the WPS down for deep sleep and stops the measurement
+ *                  windows. A window that was open is dropped without
+ *                  touching isWaterPresent.
+ */
+static void PowerDownWPS(void)
+{
+    CancelTimer(&waterTimer);
+    
+    if (isWaterWindowOpen)
+    {
+        TMR2_Stop();
+        isWaterWindowOpen = false;
+    }
+    
+    wpsControl_SetLow();
+    isWPSPowered = false;
+}
+
+/**
+ * Description: Powers the WPS back up when leaving deep sleep. The first
+ *                  window opens once the sensor has had WPS_WARMUP_MS to
+ *                  start.
+ */
+static void PowerUpWPS(void)
+{
+    wpsControl_SetHigh();
+    isWPSPowered = true;
+    ScheduleTimerAt(&waterTimer, GetTimeMS() + WPS_WARMUP_MS,
+            WaterTimerHandler);
+}
+
+/**
+ * Description: Matches one netlight on time and the off time after it to the
+ *                  SIM800 blink patterns.
+ * @param onTicks: Time the light was on, in Timer3 ticks
+ * @param offTicks: Time the light was then off, in Timer3 ticks
+ * @return NET_STATE the blink matches, NET_UNKNOWN if none
+ */
+static NET_STATE MatchNetlightPattern(uint16_t onTicks, uint16_t offTicks)
+{
+    if (onTicks < NETLIGHT_ON_LOW_BOUND || onTicks > NETLIGHT_ON_HIGH_BOUND)
+    {
+        return NET_UNKNOWN;
+    }
+    
+    if (offTicks >= NETLIGHT_GPRS_LOW_BOUND &&
+            offTicks < NETLIGHT_GPRS_HIGH_BOUND)
+    {
+        return NET_GPRS;
+    }
+    else if (offTicks >= NETLIGHT_SEARCH_LOW_BOUND &&
+            offTicks < NETLIGHT_SEARCH_HIGH_BOUND)
+    {
+        return NET_SEARCHING;
+    }
+    else if (offTicks >= NETLIGHT_REG_LOW_BOUND &&
+            offTicks < NETLIGHT_REG_HIGH_BOUND)
+    {
+        return NET_REGISTERED;
+    }
+    
+    return NET_UNKNOWN;
 }
 
 /**
- * Description: Called in the netlight ISR. Uses timer 3 to calculate how long
- *                  it has been since this function was called, and uses that
- *                  period to figure out if the netlight is currently telling
- *                  us that we have network or do not.
+ * Description: Called from the main loop for each netlight edge the CN ISR
+ *                  posted. Uses the timer 3 stamps to time how long the light
+ *                  was on, then how long it was off. Each complete blink is
+ *                  matched to a pattern, and once the same pattern is seen
+ *                  NETLIGHT_CONFIDENCE times in a row it becomes the network
+ *                  state.
+ * @param isLightOn: Level of the netlight after this edge
+ * @param edgeTicks: Timer3 count when the edge was caught
  */
-void UpdateNetStatus(void)
+void UpdateNetStatus(bool isLightOn, uint16_t edgeTicks)
 {
-    TMR3_Stop();
+    // Timer3 runs freely, so the difference is right across a wrap
+    uint16_t elapsedTicks = edgeTicks - netlightEdgeTicks;
     
-    uint16_t periodTicks = TMR3_Counter16BitGet();
+    netlightEdgeTicks = edgeTicks;
     
-    if (periodTicks >= NETLIGHT_PERIOD_LOW_BOUND &&
-            periodTicks <= NETLIGHT_PERIOD_HIGH_BOUND)
+    if (!isLightOn)
     {
-        isNetlightOn = true;
+        // The light just went off, so that was the on time
+        netlightOnTicks = elapsedTicks;
+        return;
+    }
+    
+    // The light just came on, so that was the off time and the blink is done
+    NET_STATE pattern = MatchNetlightPattern(netlightOnTicks, elapsedTicks);
+    
+    if (pattern == candidateNetState)
+    {
+        if (netConfidence < NETLIGHT_CONFIDENCE)
+        {
+            netConfidence++;
+        }
     }
     else
     {
-        isNetlightOn = false;
+        candidateNetState = pattern;
+        netConfidence = 1;
     }
     
-    TMR3_Counter16BitSet(0);
+    if (netConfidence >= NETLIGHT_CONFIDENCE)
+    {
+        netState = candidateNetState;
+    }
+}
+
+/**
+ * Description: Goes off once the netlight hasn't changed for NETLIGHT_QUIET_MS.
+ *                  It isn't blinking any pattern, so the main loop is told to
+ *                  forget the network state. Every edge pushes it back.
+ */
+static void NetlightQuietTimerHandler(void)
+{
+    PostWork(WORK_NETLIGHT_QUIET, 0);
+}
+
+/**
+ * Description: The netlight has stopped blinking, so the network state goes
+ *                  back to unknown. Main loop only.
+ */
+void ResetNetStatus(void)
+{
+    netState = NET_UNKNOWN;
+    candidateNetState = NET_UNKNOWN;
+    netConfidence = 0;
+}
+
+/**
+ * Description: Starts a scan of the X and Y accelerometer axes. The ADC
+ *                  auto-samples and converts both channels back to back and
+ *                  raises one interrupt once both results are in the buffer,
+ *                  which is handled by ADCAccelHandler.
+ */
+void StartAccelScan(void)
+{
+    isADCBusy = true;
+    isAccelScanPending = false;
     
-    TMR3_Start();
+    // Accelerometer is ratiometric to VDD
+    ADC1_ReferenceSelect(ADC1_REFERENCE_AVDD);
+    ADC1_ScanSelect(ACCEL_SCAN_MASK, ACCEL_SCAN_CONVERSIONS);
+    ADC1_AutoSampleStart();
 }
 
 /**
- * Timer1Handler Desc: Timer1 period of 10ms. When this interrupt occurs,
- *                      we read an X and Y accelerometer sample, and put them
- *                      in their respective buffers.
+ * Description: Starts a single conversion of the battery channel. The result
+ *                  is handled by ADC12Handler.
  */
-/*
- NOTE: This code is blocking.
- I don't like that, but I was unable to find a reliable way
- to make sure that the X and Y axis get sampled at near the same
- time every 10ms. I therefore deprecated ADC11 and ADC15 Handlers,
- because they are just handling the X and Y axis interrupts
- 
- These are also no longer called in adc1.c during the ISR.
+void StartBatteryRead(void)
+{
+    isADCBusy = true;
+    isBatteryReadPending = false;
+    
+    ADC1_ScanDisable();
+    // Pick the battery channel
+    ADC1_ChannelSelect(ADC1_BATTERY_SENSOR);
+    // Select 2xVBG as reference voltage
+    ADC1_ReferenceSelect(ADC1_REFERENCE_2VBG);
+    
+    ADC1_Start();
+}
+
+/**
+ * Description: Starts whichever ADC request was left pending while the ADC was
+ *                  busy. Called from the ADC ISR once a conversion is done.
  */
-void Timer1Handler(void)
+static void StartPendingADCRequest(void)
 {
-    // This function starts an ADC transaction
-    // To get accelerometer x and y values
+    isADCBusy = false;
     
-    // It should be called every 10 ms
+    if (isAccelScanPending)
+    {
+        StartAccelScan();
+    }
+    else if (isBatteryReadPending)
+    {
+        StartBatteryRead();
+    }
+}
 
+/**
+ * Description: Asks for a new accelerometer sample period. The ADC ISR applies
+ *                  it at the next block boundary so every block is taken at a
+ *                  single rate. Leaving deep sleep is applied straight away
+ *                  instead, rather than a whole deep sleep period later.
+ * @param periodMS: Sample period in ms
+ */
+void RequestAccelSamplePeriod(uint8_t periodMS)
+{
+    requestedAccelPeriodMS = periodMS;
+    
+    if (accelPeriodMS == ACCEL_DEEP_PERIOD_MS && periodMS != accelPeriodMS)
+    {
+        uint8_t savedIPL = SRbits.IPL;
+        SRbits.IPL = 7; // Hold off the Timer1 and ADC ISRs
+        
+        // Deep sleep blocks are one sample long, so with no scan converting
+        //  we are already at a block boundary. A scan that is converting
+        //  applies it as soon as it is done.
+        if (!isADCBusy && fillAccelIndex == 0)
+        {
+            ApplyAccelSamplePeriod();
+        }
+        
+        SRbits.IPL = savedIPL;
+    }
+}
 
-    // Get our ADC channels
-    ADC1_CHANNEL xChan = ADC1_XAXIS_ACCELEROMETER;
-    ADC1_CHANNEL yChan = ADC1_YAXIS_ACCELEROMETER;
+/**
+ * Description: Reschedules the sample timer for the requested period. At the idle
+ *                  and deep sleep rates every sample is handed over as its
+ *                  own block, so the main loop sees motion one period after
+ *                  it starts. The WPS is off at the deep sleep rate.
+ */
+static void ApplyAccelSamplePeriod(void)
+{
+    accelPeriodMS = requestedAccelPeriodMS;
     
-    // Change our reference to VDD
-    ADC1_ReferenceSelect(ADC1_REFERENCE_AVDD);
+    if (accelPeriodMS == ACCEL_FAST_PERIOD_MS)
+    {
+        accelBlockLength = ACCEL_BLOCK_SIZE;
+    }
+    else
+    {
+        accelBlockLength = 1;
+    }
     
-    // Select our ADC channel as X
-    ADC1_ChannelSelect(xChan);
-    // Start taking a measurement
-    ADC1_Start();
-    // Wait for measurement to complete
-    while (!ADC1_IsConversionComplete())
-    { }
-    // Stop ADC when measurement is complete
-    ADC1_Stop();
-    // Push result to xQueue
-    uint16_PushQueue(&xQueue, ADC1_ConversionResultGet());
-    // Select our ADC Channel as Y
-    ADC1_ChannelSelect(yChan);
-    // Start taking a measurement
-    ADC1_Start();
-    // Wait for measurement to complete
-    while (!ADC1_IsConversionComplete())
-    { }
-    // Stop ADC when measurement is complete
-    ADC1_Stop();
-    // Push result to yQueue
-    uint16_PushQueue(&yQueue, ADC1_ConversionResultGet());
-    
-    // Switch the reference back to the band gap
-    ADC1_ReferenceSelect(ADC1_REFERENCE_2VBG); 
+    ScheduleTimerEvery(&accelTimer, accelPeriodMS, AccelTimerHandler);
+    
+    // The deep sleep rate is only asked for once the handle is dry, so the
+    //  WPS isn't needed until it moves again
+    if (accelPeriodMS == ACCEL_DEEP_PERIOD_MS)
+    {
+        if (isWPSPowered)
+        {
+            PowerDownWPS();
+        }
+    }
+    else if (!isWPSPowered)
+    {
+        PowerUpWPS();
+    }
+}
+
+/**
+ * Description: Sample timer callback, every 10ms (ACCEL_IDLE_PERIOD_MS while
+ *                  the handle is still). Starts a scan of the X and Y
+ *                  accelerometer axes. The samples are pushed to their buffers
+ *                  by the ADC ISR, so nothing here waits on the ADC.
+ */
+static void AccelTimerHandler(void)
+{
+    if (isADCBusy)
+    {
+        // A battery read is still converting, take this sample as
+        //  soon as it is done
+        isAccelScanPending = true;
+    }
+    else
+    {
+        StartAccelScan();
+    }
 }
 
 /**
- * Description: This function is called on the period overflow of timer4, which
- *                  should occur once every 1800 s (30 minutes). This function
- *                  starts a battery ADC read, but it is completed in the ADC ISR.
+ * Description: Battery timer callback, every BATTERY_READ_PERIOD_MS (30
+ *                  minutes). This function starts a battery ADC read, but it
+ *                  is completed in the ADC ISR.
  */
-void Timer4Handler(void)
+static void BatteryTimerHandler(void)
 {
     // This function starts an ADC transaction
     // To read the battery level
     
     // It should be called every 1800 s (30 minutes))
 
-    // Pick the battery channel
-    ADC1_ChannelSelect(ADC1_BATTERY_SENSOR);
-    // Select 2xVBG as reference voltage
-    ADC1_ReferenceSelect(ADC1_REFERENCE_2VBG);
-    
-    // Start sampling, then go away, the ADC interrupt will
-    //  do all of the buffering etc.
-    ADC1_Start();
+    if (isADCBusy)
+    {
+        // Let the accelerometer scan finish first
+        isBatteryReadPending = true;
+    }
+    else
+    {
+        // Start sampling, then go away, the ADC interrupt will
+        //  do all of the buffering etc.
+        StartBatteryRead();
+    }
 }
 
 /**
- * Description: This function is called on the period overflow of timer5, which
- *                  should occur once every 1s. This function gets the current time
- *                  from the RTCC over I2C, and checks if we are in a new day.
- *                  If we are, then midnight has passed.
+ * Description: This function is called by the internal RTCC alarm at the top
+ *                  of every hour. Reading the new time can wait on the RTCC
+ *                  rolling over, so that is left to the main loop.
  */
-void Timer5Handler(void)
+void RTCCHandler(void)
 {
-    // This function handlers a timer interrupt
-    // It occurs every 1 second, and says that
-    // we need to read the RTCC over I2C
+    PostWork(WORK_RTCC_ALARM, 0);
+}
+
+/**
+ * Description: This is the interrupt handler for the accelerometer scan.
+ *                  Both axes were converted in one scan, so we store them in
+ *                  the block being filled. Once the block holds
+ *                  ACCEL_BLOCK_SIZE pairs it is handed to the main loop and
+ *                  the ISR moves on to the other block.
+ */
+void ADCAccelHandler(void)
+{
+    uint16_t results[ACCEL_SCAN_CONVERSIONS];
+    accel_block *block = &accelBlocks[fillAccelBlock];
     
-    PreviousTime = CurrentTime;
-    CurrentTime = I2C_GetTime();
+    ADC1_ConversionResultBufferGet(results);
     
-    // If the day isn't the same
-    if (PreviousTime.mnDay != CurrentTime.mnDay)
+    // Inputs are scanned in ascending order, so AN11 (Y axis) is in
+    //  ADC1BUF0 and AN15 (X axis) is in ADC1BUF1
+    block->y[fillAccelIndex] = results[0];
+    block->x[fillAccelIndex] = results[1];
+    fillAccelIndex++;
+    
+    if (fillAccelIndex == accelBlockLength)
     {
-        // Then trigger a midnight event
-        isMidnightPassed = true;
+        block->length = fillAccelIndex;
+        block->periodMS = accelPeriodMS;
+        fillAccelIndex = 0;
+        
+        if (accelBlockIsFull)
+        {
+            // The main loop is still working on the other block, so
+            //  refill this one rather than overwrite what it is reading
+            accelBlockOverruns++;
+        }
+        else
+        {
+            fullAccelBlock = fillAccelBlock;
+            fillAccelBlock ^= 1;
+            accelBlockIsFull = true;
+            RaiseEvent(EVENT_ACCEL_BLOCK);
+        }
+        
+        if (requestedAccelPeriodMS != accelPeriodMS)
+        {
+            ApplyAccelSamplePeriod();
+        }
     }
+    
+    StartPendingADCRequest();
 }
 
 /**
@@ -308,7 +677,7 @@ void ADC0Handler(void)
 {
     if (depthBufferDepth == DEPTH_BUFFER_SIZE)
     {
-        depthBufferIsFull = true;
+        RaiseEvent(EVENT_DEPTH_BUFFER);
     }
     else
     {
@@ -320,7 +689,7 @@ void ADC0Handler(void)
         // Set a flag for the main processor to do what it wants
         // with the ADC samples
         if (depthBufferDepth == DEPTH_BUFFER_SIZE)
-            depthBufferIsFull = true;
+            RaiseEvent(EVENT_DEPTH_BUFFER);
     }
 }
 
@@ -333,7 +702,7 @@ void ADC12Handler(void)
 {
     if (batteryBufferDepth == BATTERY_BUFFER_SIZE)
     {
-        batteryBufferIsFull = true;
+        RaiseEvent(EVENT_BATTERY_BUFFER);
     }
     else
     {
@@ -345,6 +714,8 @@ void ADC12Handler(void)
         // Set a flag for the main processor to do what it wants
         // with the ADC samples
         if (batteryBufferDepth == BATTERY_BUFFER_SIZE)
-            batteryBufferIsFull = true;
+            RaiseEvent(EVENT_BATTERY_BUFFER);
     }
+    
+    StartPendingADCRequest();
 }
@@ -6,10 +6,31 @@
 #include <xc.h> // include processor files - each processor file is guarded.
 #include "constants.h"
 #include "I2C_Functions.h"
+#include "I2C_Engine.h"
+#include "deferred_work.h"
+#include "timer_service.h"
+#include "UART_Functions.h"
+#include "AT_Commands.h"
+#include "modem.h"
 #include "queue.h"
+#include "filter.h"
 #include "adc1.h"
 #include "mcc.h"
 
+typedef enum {
+            NET_UNKNOWN, // Off, or not blinking a pattern we know
+            NET_SEARCHING, // 64ms on, 800ms off
+            NET_REGISTERED, // 64ms on, 3s off
+            NET_GPRS // 64ms on, 300ms off
+} NET_STATE;
+
+typedef struct accel_block {
+    uint16_t x[ACCEL_BLOCK_SIZE];
+    uint16_t y[ACCEL_BLOCK_SIZE];
+    uint8_t length; // Number of valid pairs
+    uint8_t periodMS; // Sample period the pairs were taken at
+} accel_block;
+
 extern uint16_t depthBuffer[DEPTH_BUFFER_SIZE];
 extern uint16_t batteryBuffer[BATTERY_BUFFER_SIZE];
 
@@ -19,40 +40,53 @@ extern uint8_t batteryBufferDepth;
 extern time_s PreviousTime;
 extern time_s CurrentTime;
 
-extern uint16_queue xQueue;
-extern uint16_queue yQueue;
-extern float_queue angleQueue;
+extern accel_block accelBlocks[2];
+extern uint8_t fullAccelBlock;
+extern uint16_t accelBlockOverruns;
+extern uint8_t accelPeriodMS;
+
+extern moving_average angleFilter;
 
 /**
  Event Flags
  **/
 
-extern bool depthBufferIsFull;
-extern bool batteryBufferIsFull;
-extern bool isMidnightPassed;
+// The main loop owns accelBlocks[fullAccelBlock] while this is set
+extern bool accelBlockIsFull;
 
-extern bool isNetlightOn;
+extern NET_STATE netState;
 extern bool isWaterPresent;
 
+// GetTimeMS when isWaterPresent was last measured
+extern uint32_t waterCheckedMS;
+
+// Time the main loop has been awake, and how many times it went to Sleep and
+//  Idle. Time spent in low power is GetTimeMS() - activeMS.
+extern uint32_t activeMS;
+extern uint32_t sleepCount;
+extern uint32_t idleCount;
+
 void InitIOCInterrupt(void);
 void __attribute__((interrupt, no_auto_psv)) _CNInterrupt(void);
 void IOCHandler(void);
-void TurnOffWPSIOC(void);
-void TurnOnWPSIOC(void);
-bool IsWPSIOCOn(void);
 
 void InitQueues(void);
+void InitTimers(void);
+void WaitForEvent(void);
+
+void UpdateWaterStatus(uint16_t edges, uint16_t gateMS);
+void RequestWaterCheck(void);
+void UpdateNetStatus(bool isLightOn, uint16_t edgeTicks);
+void ResetNetStatus(void);
 
-void UpdateWaterStatus(void);
-void UpdateNetStatus(void);
+void StartAccelScan(void);
+void RequestAccelSamplePeriod(uint8_t periodMS);
+void StartBatteryRead(void);
 
-void Timer1Handler(void);
-void Timer4Handler(void);
-void Timer5Handler(void);
+void RTCCHandler(void);
+void ADCAccelHandler(void);
 void ADC0Handler(void);
-void ADC11Handler(void);
 void ADC12Handler(void);
-void ADC15Handler(void);
 
 #ifdef	__cplusplus
 extern "C" {
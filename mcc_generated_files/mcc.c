@@ -98,7 +98,7 @@ void SYSTEM_Initialize(void) {
     INTERRUPT_Initialize();
     ADC1_Initialize();
     //I2C1_Initialize(); // Will be called by my custom function
-    //RTCC_Initialize();
+    RTCC_Initialize();
     TMR1_Initialize();
     TMR2_Initialize();
     TMR3_Initialize();
@@ -109,10 +109,8 @@ void SYSTEM_Initialize(void) {
 }
 
 void OSCILLATOR_Initialize(void) {
-    // DOZEN disabled; DOZE 1:8; RCDIV FRC/2; ROI disabled; 
-    CLKDIV = 0x3100;
-    // Set the secondary oscillator
-    OSCCONbits.SOSCEN = 1;
+    // FRC/2, the SOSC for the RTCC, CLOCK_FAST to start
+    ClockInit();
 }
 
 /**
@@ -59,6 +59,7 @@ SUBSTITUTE GOODS, TECHNOLOGY, SERVICES, OR ANY CLAIMS BY THIRD PARTIES
 #include "tmr3.h"
 #include "tmr5.h"
 #include "tmr4.h"
+#include "clock.h"
 //#include "uart1.h"
 //#include "constants.h"
 //#include "I2C_Functions.h"
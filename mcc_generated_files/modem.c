@@ -0,0 +1,707 @@
+/*
+ * File:   modem.c
+ */
+
+
+#include "xc.h"
+#include "modem.h"
+#include "AT_Commands.h"
+#include "utilities.h"
+
+/*
+ Power lifecycle of the SIM800. A user asks for the modem with
+ Modem_Request and gets its callback once the modem is on the network, then
+ hands it back with Modem_Release. Rather than powering off, the modem is
+ put in slow clock sleep (AT+CSCLK=2) and stays registered, so the next
+ request only has to wake it. It is powered down after MODEM_SLEEP_HOLD_MS
+ with no request, or straight away on a low battery.
+
+ Every wait has a timeout. A boot that doesn't answer is powered off and
+ tried again, up to MODEM_BOOT_TRIES, and a power down STATUS doesn't follow
+ falls back from AT+CPOWD=1 to PWRKEY. Everything runs from Modem_Process in
+ the main loop, the timer callbacks only raise EVENT_MODEM.
+ */
+
+typedef enum {
+            STEP_OFF,
+            STEP_PWRKEY_ON, // PWRKEY held low to start it
+            STEP_WAIT_STATUS_ON, // PWRKEY released, waiting for STATUS
+            STEP_WAIT_UART, // STATUS is up, waiting for the UART
+            STEP_SYNC, // "AT" until it answers, autobauding or waking
+            STEP_SETUP, // Settings sent after a boot or wake
+            STEP_SEARCHING, // Waiting for the netlight to show registered
+            STEP_REGISTERED,
+            STEP_SLEEP_ENTER, // AT+CSCLK=2 sent
+            STEP_SLEEP,
+            STEP_POWER_DOWN_AT, // AT+CPOWD=1 sent
+            STEP_PWRKEY_OFF, // PWRKEY held low to stop it
+            STEP_WAIT_STATUS_OFF // Waiting for STATUS to drop
+} MODEM_STEP;
+
+uint16_t modemBootFailures = 0;
+uint16_t modemPowerFailures = 0;
+
+static MODEM_STEP step = STEP_OFF;
+static void (*requestCallback)(bool isRegistered) = NULL;
+static bool isRequested = false; // Waiting to call requestCallback
+static bool isInUse = false; // Between the callback and Modem_Release
+static bool isColdBoot = false; // STEP_SYNC and STEP_SETUP after a boot
+static bool isPwrKeyTried = false; // Power down has fallen back to PWRKEY
+static uint8_t bootTries = 0;
+static uint8_t syncTries = 0;
+
+static soft_timer stepTimer; // Timeout or pulse length of the current step
+static volatile bool isStepTimerDue = false;
+static soft_timer pollTimer; // Wakes Modem_Process to check the pins
+static uint32_t pollPeriodMS = 0;
+
+static uint32_t onMS = 0; // Time STATUS was up since Modem_ResetOnTime, up
+                          //  to onSinceMS if it is up now
+static uint32_t onSinceMS = 0;
+static bool isOnCounted = false;
+
+static void ModemCommandDone(at_command *command);
+static at_command syncCommand = {
+    "AT", // Sets the baud rate, or wakes it from sleep
+    NULL, 0,
+    MODEM_SYNC_TIMEOUT_MS,
+    ModemCommandDone,
+    AT_OK, -1
+};
+static at_command echoOffCommand = {
+    "ATE0", // Stop the SIM800 echoing everything back
+    NULL, 0,
+    AT_DEFAULT_TIMEOUT_MS,
+    ModemCommandDone,
+    AT_OK, -1
+};
+static at_command textModeCommand = {
+    "AT+CMGF=1", // Text mode
+    NULL, 0,
+    AT_DEFAULT_TIMEOUT_MS,
+    ModemCommandDone,
+    AT_OK, -1
+};
+static at_command clockOnCommand = {
+    "AT+CSCLK=0", // Stay awake while in use
+    NULL, 0,
+    AT_DEFAULT_TIMEOUT_MS,
+    ModemCommandDone,
+    AT_OK, -1
+};
+static at_command slowClockCommand = {
+    "AT+CSCLK=2", // Sleep once the UART has been quiet for 5s
+    NULL, 0,
+    AT_DEFAULT_TIMEOUT_MS,
+    ModemCommandDone,
+    AT_OK, -1
+};
+static at_command powerDownCommand = {
+    "AT+CPOWD=1", // Normal power down, answered by NORMAL POWER DOWN
+    NULL, 0,
+    MODEM_POWER_DOWN_TIMEOUT_MS,
+    ModemCommandDone,
+    AT_OK, -1
+};
+
+/**
+ * Description: Step timer callback, runs in the Timer1 ISR.
+ */
+static void StepTimerDue(void)
+{
+    isStepTimerDue = true;
+    RaiseEvent(EVENT_MODEM);
+}
+
+/**
+ * Description: Poll timer callback, runs in the Timer1 ISR.
+ */
+static void PollTimerDue(void)
+{
+    RaiseEvent(EVENT_MODEM);
+}
+
+/**
+ * Description: Moves to a new step with a timeout, or none if timeoutMS is 0.
+ * @param newStep: Step to move to
+ * @param timeoutMS: Time until isStepTimerDue
+ */
+static void EnterStep(MODEM_STEP newStep, uint32_t timeoutMS)
+{
+    step = newStep;
+    isStepTimerDue = false;
+
+    if (timeoutMS > 0)
+    {
+        ScheduleTimerAt(&stepTimer, GetTimeMS() + timeoutMS, StepTimerDue);
+    }
+    else
+    {
+        CancelTimer(&stepTimer);
+    }
+}
+
+/**
+ * Description: Whether STATUS should be high in the current step.
+ */
+static bool IsStatusExpected(void)
+{
+    return (step >= STEP_WAIT_UART) && (step <= STEP_SLEEP);
+}
+
+/**
+ * Description: Sets the pin polling rate for the current step.
+ */
+static void UpdatePolling(void)
+{
+    uint32_t periodMS;
+
+    switch (step)
+    {
+        case STEP_OFF:
+            periodMS = 0;
+            break;
+
+        case STEP_REGISTERED:
+        case STEP_SLEEP:
+            periodMS = MODEM_SLEEP_POLL_MS;
+            break;
+
+        default:
+            periodMS = MODEM_POLL_MS;
+            break;
+    }
+
+    if (periodMS == pollPeriodMS)
+    {
+        return;
+    }
+
+    pollPeriodMS = periodMS;
+    if (periodMS > 0)
+    {
+        ScheduleTimerEvery(&pollTimer, periodMS, PollTimerDue);
+    }
+    else
+    {
+        CancelTimer(&pollTimer);
+    }
+}
+
+/**
+ * Description: Gives the waiting user its answer.
+ * @param isRegistered: Whether the modem is on the network for it
+ */
+static void AnswerRequest(bool isRegistered)
+{
+    isRequested = false;
+    isInUse = isRegistered;
+    bootTries = 0;
+
+    if (requestCallback != NULL)
+    {
+        requestCallback(isRegistered);
+    }
+}
+
+/**
+ * Description: Starts counting modem on time, from when STATUS comes up.
+ */
+static void CountOn(void)
+{
+    if (!isOnCounted)
+    {
+        isOnCounted = true;
+        onSinceMS = GetTimeMS();
+    }
+}
+
+/**
+ * Description: Starts a cold boot with a PWRKEY pulse. If STATUS is already
+ *      up, e.g. after a reset of the PIC, it goes straight to syncing.
+ */
+static void StartBoot(void)
+{
+    modemStatus = 0; // Filled in again by the URCs as it starts up
+    simVioPin_SetHigh();
+
+    if (IsSimOn())
+    {
+        CountOn();
+        EnterStep(STEP_WAIT_UART, 1);
+        return;
+    }
+
+    simPwrKey_SetLow();
+    EnterStep(STEP_PWRKEY_ON, MODEM_PWRKEY_ON_MS);
+}
+
+/**
+ * Description: Sends "AT" until the modem answers. It sets the baud rate
+ *      after a boot, and wakes the modem from sleep, where the first bytes
+ *      are lost.
+ * @param isCold: true after a boot, so the settings are sent again
+ */
+static void StartSync(bool isCold)
+{
+    isColdBoot = isCold;
+    syncTries = 0;
+    EnterStep(STEP_SYNC, 0);
+
+    if (!AT_SubmitCommand(&syncCommand))
+    {
+        syncCommand.status = AT_ERROR;
+        ModemCommandDone(&syncCommand);
+    }
+}
+
+/**
+ * Description: Counts the modem as off.
+ */
+static void TurnedOff(void)
+{
+    simPwrKey_SetHigh();
+    if (isOnCounted)
+    {
+        isOnCounted = false;
+        onMS += GetTimeMS() - onSinceMS;
+    }
+    isInUse = false;
+    EnterStep(STEP_OFF, 0);
+}
+
+/**
+ * Description: Holds PWRKEY low to power the modem down.
+ */
+static void PressPwrKeyOff(void)
+{
+    // Let the last command finish going out first
+    UART_WaitTxDone();
+
+    isPwrKeyTried = true;
+    simPwrKey_SetLow();
+    EnterStep(STEP_PWRKEY_OFF, MODEM_PWRKEY_OFF_MS);
+}
+
+/**
+ * Description: Powers the modem down, with AT+CPOWD=1 if it is listening
+ *      or PWRKEY if it is asleep or hasn't answered.
+ */
+static void PowerDownModem(void)
+{
+    isPwrKeyTried = false;
+
+    if (!IsSimOn())
+    {
+        TurnedOff();
+    }
+    else if (step == STEP_SLEEP || step < STEP_SETUP)
+    {
+        PressPwrKeyOff();
+    }
+    else
+    {
+        EnterStep(STEP_POWER_DOWN_AT, 0);
+        if (!AT_SubmitCommand(&powerDownCommand))
+        {
+            PressPwrKeyOff();
+        }
+    }
+}
+
+/**
+ * Description: Counts a boot that failed, and gives up on the request once
+ *      it has had MODEM_BOOT_TRIES.
+ */
+static void CountBootFailure(void)
+{
+    modemBootFailures++;
+    bootTries++;
+
+    if (bootTries >= MODEM_BOOT_TRIES && isRequested)
+    {
+        AnswerRequest(false);
+    }
+}
+
+/**
+ * Description: A boot didn't get as far as answering. The modem is powered
+ *      off, and booted again if there are tries left.
+ */
+static void BootFailed(void)
+{
+    CountBootFailure();
+
+    isPwrKeyTried = false;
+    if (IsSimOn())
+    {
+        PressPwrKeyOff();
+    }
+    else
+    {
+        simPwrKey_SetHigh();
+        TurnedOff();
+    }
+}
+
+/**
+ * Description: AT engine callback for the modem's own commands. Each is
+ *      only acted on in the step that sent it.
+ * @param command: The finished command
+ */
+static void ModemCommandDone(at_command *command)
+{
+    bool isOK = (command->status == AT_OK);
+
+    if (command->status == AT_POWERED_DOWN)
+    {
+        // It is going off on its own, or as asked by AT+CPOWD=1. Nothing
+        //  more is sent, wait for STATUS to drop
+        if (step != STEP_WAIT_STATUS_OFF)
+        {
+            if (step < STEP_REGISTERED)
+            {
+                CountBootFailure();
+            }
+            isPwrKeyTried = false;
+            EnterStep(STEP_WAIT_STATUS_OFF, MODEM_STATUS_TIMEOUT_MS);
+        }
+        return;
+    }
+
+    switch (step)
+    {
+        case STEP_SYNC:
+            if (isOK)
+            {
+                EnterStep(STEP_SETUP, 0);
+                if (isColdBoot)
+                {
+                    AT_SubmitCommand(&echoOffCommand);
+                    AT_SubmitCommand(&textModeCommand);
+                }
+                AT_SubmitCommand(&clockOnCommand);
+            }
+            else if (++syncTries < MODEM_SYNC_TRIES)
+            {
+                AT_SubmitCommand(&syncCommand);
+            }
+            else if (isColdBoot)
+            {
+                BootFailed();
+            }
+            else
+            {
+                // Won't wake, start it again from cold
+                PowerDownModem();
+            }
+            break;
+
+        case STEP_SETUP:
+            if (!isOK)
+            {
+                BootFailed();
+            }
+            else if (command == &clockOnCommand)
+            {
+                EnterStep(STEP_SEARCHING, NETWORK_SEARCH_TIMEOUT_MS);
+            }
+            break;
+
+        case STEP_SLEEP_ENTER:
+            if (isOK)
+            {
+                EnterStep(STEP_SLEEP, MODEM_SLEEP_HOLD_MS);
+            }
+            else
+            {
+                PowerDownModem();
+            }
+            break;
+
+        case STEP_POWER_DOWN_AT:
+            // Not answered with NORMAL POWER DOWN, STATUS may still drop
+            EnterStep(STEP_WAIT_STATUS_OFF, MODEM_STATUS_TIMEOUT_MS);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Description: Sets the modem up as off. Call after AT_Init.
+ */
+void Modem_Init(void)
+{
+    simPwrKey_SetHigh();
+    step = STEP_OFF;
+    isRequested = false;
+    isInUse = false;
+    isOnCounted = false;
+    onMS = 0;
+}
+
+/**
+ * Description: Asks for the modem. It is booted, or woken, as needed and
+ *      callback is called from the main loop once it is on the network or
+ *      has failed to get there. Only one user at a time.
+ * @param callback: Told whether the modem is registered. If it is, the user
+ *      must call Modem_Release when done with it.
+ * @return bool false if someone else has the modem
+ */
+bool Modem_Request(void (*callback)(bool isRegistered))
+{
+    if (isRequested || isInUse)
+    {
+        return false;
+    }
+
+    requestCallback = callback;
+    isRequested = true;
+    bootTries = 0;
+    RaiseEvent(EVENT_MODEM);
+
+    return true;
+}
+
+/**
+ * Description: Hands the modem back. It is put to sleep, registered, for
+ *      the next request, or powered down if the battery is low.
+ */
+void Modem_Release(void)
+{
+    isInUse = false;
+
+    if (step != STEP_REGISTERED)
+    {
+        return;
+    }
+
+    if (isBatteryLow)
+    {
+        PowerDownModem();
+    }
+    else
+    {
+        EnterStep(STEP_SLEEP_ENTER, 0);
+        if (!AT_SubmitCommand(&slowClockCommand))
+        {
+            PowerDownModem();
+        }
+    }
+    UpdatePolling();
+}
+
+/**
+ * Description: Powers the modem down now, unless it is off or in use.
+ */
+void Modem_PowerDown(void)
+{
+    if (isInUse || step == STEP_OFF || step >= STEP_POWER_DOWN_AT)
+    {
+        return;
+    }
+
+    PowerDownModem();
+    UpdatePolling();
+}
+
+/**
+ * Description: Where the modem is in its power lifecycle.
+ * @return MODEM_STATE
+ */
+MODEM_STATE Modem_GetState(void)
+{
+    switch (step)
+    {
+        case STEP_OFF:
+            return MODEM_OFF;
+
+        case STEP_SYNC:
+            return isColdBoot ? MODEM_BOOTING : MODEM_SLEEP; // Waking
+
+        case STEP_SETUP:
+            return isColdBoot ? MODEM_READY : MODEM_SLEEP;
+
+        case STEP_SEARCHING:
+            return MODEM_READY;
+
+        case STEP_REGISTERED:
+        case STEP_SLEEP_ENTER:
+            return MODEM_REGISTERED;
+
+        case STEP_SLEEP:
+            return MODEM_SLEEP;
+
+        case STEP_POWER_DOWN_AT:
+        case STEP_PWRKEY_OFF:
+        case STEP_WAIT_STATUS_OFF:
+            return MODEM_POWERING_DOWN;
+
+        default:
+            return MODEM_BOOTING;
+    }
+}
+
+/**
+ * Description: Whether the modem may talk to us, so the UART has to be kept
+ *      running. Asleep it only wakes when we send something.
+ * @return bool true unless it is off or asleep
+ */
+bool Modem_IsAwake(void)
+{
+    return (step != STEP_OFF) && (step != STEP_SLEEP);
+}
+
+/**
+ * Description: Moves the modem along on timeouts and pin changes, and gives
+ *      a waiting user the modem once it is registered. Call from the main
+ *      loop on EVENT_MODEM, after AT_Process.
+ */
+void Modem_Process(void)
+{
+    bool isDue = isStepTimerDue;
+    isStepTimerDue = false;
+
+    if (IsStatusExpected() && !IsSimOn())
+    {
+        // Crashed, or powered itself down, e.g. on under-voltage
+        if (step < STEP_REGISTERED)
+        {
+            BootFailed();
+        }
+        else
+        {
+            TurnedOff();
+        }
+    }
+
+    switch (step)
+    {
+        case STEP_PWRKEY_ON:
+            if (isDue)
+            {
+                simPwrKey_SetHigh();
+                EnterStep(STEP_WAIT_STATUS_ON, MODEM_STATUS_TIMEOUT_MS);
+            }
+            break;
+
+        case STEP_WAIT_STATUS_ON:
+            if (IsSimOn())
+            {
+                CountOn();
+                EnterStep(STEP_WAIT_UART, MODEM_UART_READY_MS);
+            }
+            else if (isDue)
+            {
+                BootFailed();
+            }
+            break;
+
+        case STEP_WAIT_UART:
+            if (isDue || (modemStatus & MODEM_STATUS_READY))
+            {
+                StartSync(true);
+            }
+            break;
+
+        case STEP_SEARCHING:
+            if (IsSimOnNetwork())
+            {
+                EnterStep(STEP_REGISTERED, 0);
+            }
+            else if (isDue)
+            {
+                if (isRequested)
+                {
+                    AnswerRequest(false);
+                }
+                PowerDownModem();
+            }
+            break;
+
+        case STEP_SLEEP:
+            if (isDue)
+            {
+                // Nobody has needed it for a while
+                PowerDownModem();
+            }
+            break;
+
+        case STEP_PWRKEY_OFF:
+            if (isDue)
+            {
+                simPwrKey_SetHigh();
+                EnterStep(STEP_WAIT_STATUS_OFF, MODEM_STATUS_TIMEOUT_MS);
+            }
+            break;
+
+        case STEP_WAIT_STATUS_OFF:
+            if (!IsSimOn())
+            {
+                TurnedOff();
+            }
+            else if (isDue)
+            {
+                if (!isPwrKeyTried)
+                {
+                    PressPwrKeyOff();
+                }
+                else
+                {
+                    // Leave it be, a request will try a boot again
+                    modemPowerFailures++;
+                    TurnedOff();
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (isRequested)
+    {
+        if (step == STEP_OFF)
+        {
+            StartBoot();
+        }
+        else if (step == STEP_SLEEP)
+        {
+            StartSync(false);
+        }
+        else if (step == STEP_REGISTERED)
+        {
+            AnswerRequest(true);
+        }
+    }
+
+    UpdatePolling();
+}
+
+/**
+ * Description: Time the modem has been powered, STATUS up, since
+ *      Modem_ResetOnTime.
+ * @return uint32_t time in seconds
+ */
+uint32_t Modem_GetOnSeconds(void)
+{
+    uint32_t totalMS = onMS;
+
+    if (isOnCounted)
+    {
+        totalMS += GetTimeMS() - onSinceMS;
+    }
+
+    return totalMS / 1000;
+}
+
+/**
+ * Description: Starts counting modem on time again, called once a day.
+ */
+void Modem_ResetOnTime(void)
+{
+    onMS = 0;
+    onSinceMS = GetTimeMS();
+}
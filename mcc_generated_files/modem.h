@@ -0,0 +1,59 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef MODEM_H
+#define	MODEM_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MODEM_PWRKEY_ON_MS          1200 // SIM800 wants PWRKEY low >1s to start
+#define MODEM_PWRKEY_OFF_MS         1500 // and 1s-33s to power down
+#define MODEM_STATUS_TIMEOUT_MS     5000 // STATUS follows PWRKEY within ~2s
+#define MODEM_UART_READY_MS         3000 // UART is up ~3s after STATUS, or
+                                         //  once RDY is seen
+#define MODEM_SYNC_TIMEOUT_MS       500 // Per "AT" while autobauding or waking
+#define MODEM_SYNC_TRIES            6
+#define MODEM_POWER_DOWN_TIMEOUT_MS 5000 // AT+CPOWD=1 to STATUS low
+#define MODEM_BOOT_TRIES            2 // Cold boots before a request fails
+#define MODEM_POLL_MS               100 // STATUS and netlight checks while
+                                        //  booting, searching or powering down
+#define MODEM_SLEEP_POLL_MS         10000 // STATUS checks while asleep
+#define MODEM_SLEEP_HOLD_MS         1800000UL // Asleep this long with no
+                                              //  request and it is turned off
+
+typedef enum {
+            MODEM_OFF,
+            MODEM_BOOTING, // PWRKEY pulse through to the UART answering
+            MODEM_READY, // Answering AT, searching for the network
+            MODEM_REGISTERED, // On the network, in use
+            MODEM_SLEEP, // Registered, slow clocked (AT+CSCLK=2) until needed
+            MODEM_POWERING_DOWN
+} MODEM_STATE;
+
+// Modem power ups that didn't answer, and power downs STATUS never followed
+extern uint16_t modemBootFailures;
+extern uint16_t modemPowerFailures;
+
+void Modem_Init(void);
+bool Modem_Request(void (*callback)(bool isRegistered));
+void Modem_Release(void);
+void Modem_PowerDown(void);
+MODEM_STATE Modem_GetState(void);
+bool Modem_IsAwake(void);
+void Modem_Process(void);
+uint32_t Modem_GetOnSeconds(void);
+void Modem_ResetOnTime(void);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
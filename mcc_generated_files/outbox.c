@@ -0,0 +1,555 @@
+/*
+ * File:   outbox.c
+ */
+
+
+#include "xc.h"
+#include "outbox.h"
+#include "utilities.h"
+#include "deferred_work.h"
+#include "timer_service.h"
+#include "clock.h"
+
+/*
+ Store and forward for the daily reports. Each report is written to its own
+ slot of the data EEPROM with a sequence number and a CRC, so it outlives a
+ reset or a dead battery, and it is only erased once the modem has answered
+ +CMGS for the text it went out in. Sending takes the modem once and sends
+ every report waiting, oldest first, packed as many to a text as fit (see
+ report_codec.c).
+ A send that fails is tried again after OUTBOX_RETRY_MIN_MS, doubling each
+ time up to OUTBOX_RETRY_MAX_MS, and a report added while a retry is waiting
+ goes out with it rather than on its own.
+
+ A slot is its sequence word, the report and a CRC16 over both. The
+ sequence word is written last and erased first, so a slot is only ever
+ seen as either empty or complete. When every slot is full the oldest
+ report is written over.
+ */
+
+#define OUTBOX_EMPTY            0xFFFF // Sequence word of an erased slot
+#define OUTBOX_REPORT_WORDS     (sizeof(daily_report) / 2)
+#define OUTBOX_CRC_WORD         (OUTBOX_REPORT_WORDS + 1)
+#define OUTBOX_CRC_SEED         0xFFFF // CRC16-CCITT
+#define OUTBOX_CRC_POLY         0x1021
+
+#define NVM_ERASE_WORD          0x4058 // WREN, ERASE, one data EEPROM word
+#define NVM_WRITE_WORD          0x4004 // WREN, one data EEPROM word
+
+static uint16_t __attribute__((space(eedata)))
+        outboxSlots[OUTBOX_SLOT_COUNT][OUTBOX_SLOT_WORDS];
+
+// Sequence number of the report in each slot, OUTBOX_EMPTY if there isn't one
+static uint16_t slotSequence[OUTBOX_SLOT_COUNT];
+static uint16_t nextSequence = 0;
+
+// The reports in the text that is going out
+static uint8_t batchSlots[OUTBOX_SLOT_COUNT];
+static uint16_t batchSequences[OUTBOX_SLOT_COUNT];
+static uint8_t batchCount = 0;
+
+static bool isSending = false;
+static uint32_t retryMS = OUTBOX_RETRY_MIN_MS;
+static soft_timer retryTimer;
+static CLOCK_MODE savedMode = CLOCK_LOW;
+
+uint16_t outboxReportsAdded = 0;
+uint16_t outboxReportsSent = 0;
+uint16_t outboxReportsLost = 0;
+
+static void RetryDue(void);
+static void ModemReady(bool isRegistered);
+static void SendNextBatch(void);
+static void SendDone(at_command *command);
+static void FinishSending(bool isDelivered);
+static void BackOff(void);
+
+static char outboxMessage[MESSAGE_LENGTH];
+static char sendCommandString[32]; // AT+CMGS="<phone number>"
+static at_command sendCommand = {
+    sendCommandString,
+    outboxMessage, 0, // Length set for each batch
+    AT_CMGS_TIMEOUT_MS,
+    SendDone,
+    AT_OK, -1
+};
+
+/**
+ * Description: Table offset of a word of a slot in the data EEPROM.
+ * @param slot: Slot number
+ * @param word: Word within the slot
+ * @return uint16_t offset for the table read and write builtins
+ */
+static uint16_t SlotOffset(uint8_t slot, uint8_t word)
+{
+    return __builtin_tbloffset(outboxSlots) +
+            ((slot * OUTBOX_SLOT_WORDS) + word) * 2;
+}
+
+/**
+ * Description: Reads one word of a slot.
+ * @param slot: Slot number
+ * @param word: Word within the slot
+ * @return uint16_t the word
+ */
+static uint16_t ReadWord(uint8_t slot, uint8_t word)
+{
+    TBLPAG = __builtin_tblpage(outboxSlots);
+
+    return __builtin_tblrdl(SlotOffset(slot, word));
+}
+
+/**
+ * Description: Runs the NVM operation set up in NVMCON, and waits the ~4ms
+ *      it takes.
+ */
+static void RunNVM(void)
+{
+    __builtin_disi(0x3FFF); // The unlock sequence can't be interrupted
+    __builtin_write_NVM();
+    __builtin_disi(0);
+
+    while (NVMCONbits.WR)
+    {
+        // Cleared by the hardware once the cell is done
+    }
+}
+
+/**
+ * Description: Erases a word of a slot if it needs it, then writes it.
+ *      Writing OUTBOX_EMPTY only erases. Words that already hold the value
+ *      are left alone, it saves time and wear.
+ * @param slot: Slot number
+ * @param word: Word within the slot
+ * @param value: What to leave there
+ */
+static void WriteWord(uint8_t slot, uint8_t word, uint16_t value)
+{
+    uint16_t offset = SlotOffset(slot, word);
+    uint16_t current = ReadWord(slot, word);
+
+    if (current == value)
+    {
+        return;
+    }
+
+    if (current != OUTBOX_EMPTY)
+    {
+        NVMCON = NVM_ERASE_WORD;
+        __builtin_tblwtl(offset, OUTBOX_EMPTY);
+        RunNVM();
+    }
+
+    if (value != OUTBOX_EMPTY)
+    {
+        NVMCON = NVM_WRITE_WORD;
+        __builtin_tblwtl(offset, value);
+        RunNVM();
+    }
+}
+
+/**
+ * Description: Adds one word to a CRC16-CCITT, high byte first.
+ * @param crc: CRC so far
+ * @param word: Next word
+ * @return uint16_t the new CRC
+ */
+static uint16_t UpdateCRC(uint16_t crc, uint16_t word)
+{
+    uint8_t i;
+
+    crc ^= word;
+    for (i = 0; i < 16; i++)
+    {
+        if (crc & 0x8000)
+        {
+            crc = (crc << 1) ^ OUTBOX_CRC_POLY;
+        }
+        else
+        {
+            crc <<= 1;
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * Description: Empties a slot by erasing its sequence word.
+ * @param slot: Slot number
+ */
+static void EraseSlot(uint8_t slot)
+{
+    WriteWord(slot, 0, OUTBOX_EMPTY);
+    slotSequence[slot] = OUTBOX_EMPTY;
+}
+
+/**
+ * Description: Reads the report in a slot and checks its CRC. A slot that
+ *      fails is emptied and counted as lost.
+ * @param slot: Slot number
+ * @param report: Where to put the report, may be NULL to only check it
+ * @return bool true if the report is good
+ */
+static bool ReadSlot(uint8_t slot, daily_report *report)
+{
+    uint16_t *words = (uint16_t *)report;
+    uint16_t sequence = ReadWord(slot, 0);
+    uint16_t crc = UpdateCRC(OUTBOX_CRC_SEED, sequence);
+    uint16_t word;
+    uint8_t i;
+
+    for (i = 0; i < OUTBOX_REPORT_WORDS; i++)
+    {
+        word = ReadWord(slot, i + 1);
+        crc = UpdateCRC(crc, word);
+        if (report != NULL)
+        {
+            words[i] = word;
+        }
+    }
+
+    if (crc != ReadWord(slot, OUTBOX_CRC_WORD))
+    {
+        EraseSlot(slot);
+        outboxReportsLost++;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Description: How many reports were added after the one in a slot.
+ * @param slot: Slot number, must not be empty
+ * @return uint16_t its age, the oldest report has the largest
+ */
+static uint16_t SlotAge(uint8_t slot)
+{
+    // Sequence numbers wrap, the difference doesn't care
+    return nextSequence - slotSequence[slot];
+}
+
+/**
+ * Description: Finds the slot holding the oldest report.
+ * @return uint8_t slot number, OUTBOX_SLOT_COUNT if the outbox is empty
+ */
+static uint8_t OldestSlot(void)
+{
+    uint8_t slot;
+    uint8_t oldest = OUTBOX_SLOT_COUNT;
+
+    for (slot = 0; slot < OUTBOX_SLOT_COUNT; slot++)
+    {
+        if (slotSequence[slot] != OUTBOX_EMPTY &&
+                (oldest == OUTBOX_SLOT_COUNT ||
+                SlotAge(slot) > SlotAge(oldest)))
+        {
+            oldest = slot;
+        }
+    }
+
+    return oldest;
+}
+
+/**
+ * Description: Reads back the reports in the data EEPROM, dropping any with
+ *      a bad CRC, and sets a send going after OUTBOX_BUSY_RETRY_MS if any
+ *      are waiting. Call after Modem_Init and InitTimerService.
+ */
+void Outbox_Init(void)
+{
+    uint8_t slot;
+    uint16_t sequence;
+    bool isAny = false;
+
+    BuildTextCommand(sendCommandString, sizeof(sendCommandString),
+            phoneNumber, sizeof(phoneNumber));
+
+    for (slot = 0; slot < OUTBOX_SLOT_COUNT; slot++)
+    {
+        sequence = ReadWord(slot, 0);
+        slotSequence[slot] = OUTBOX_EMPTY;
+
+        if (sequence == OUTBOX_EMPTY || !ReadSlot(slot, NULL))
+        {
+            continue;
+        }
+
+        slotSequence[slot] = sequence;
+        if (!isAny || (int16_t)(sequence - nextSequence) >= 0)
+        {
+            nextSequence = sequence + 1;
+            isAny = true;
+        }
+    }
+
+    if (nextSequence == OUTBOX_EMPTY)
+    {
+        nextSequence = 0;
+    }
+
+    if (isAny)
+    {
+        // Whatever was sent at boot goes first
+        ScheduleTimerAt(&retryTimer, GetTimeMS() + OUTBOX_BUSY_RETRY_MS,
+                RetryDue);
+    }
+}
+
+/**
+ * Description: Writes a report to the data EEPROM to be sent. It is sent
+ *      straight away, unless a failed send is waiting to be retried, then
+ *      it goes out with the retry. Main loop only, the EEPROM writes block
+ *      for ~0.2s.
+ * @param report: Report to keep, copied
+ * @return bool false if the outbox was full and the oldest report was
+ *      written over
+ */
+bool Outbox_Add(const daily_report *report)
+{
+    const uint16_t *words = (const uint16_t *)report;
+    uint16_t crc = UpdateCRC(OUTBOX_CRC_SEED, nextSequence);
+    bool isRoom = true;
+    uint8_t slot;
+    uint8_t i;
+
+    for (slot = 0; slot < OUTBOX_SLOT_COUNT; slot++)
+    {
+        if (slotSequence[slot] == OUTBOX_EMPTY)
+        {
+            break;
+        }
+    }
+
+    if (slot == OUTBOX_SLOT_COUNT)
+    {
+        slot = OldestSlot();
+        outboxReportsLost++;
+        isRoom = false;
+    }
+
+    EraseSlot(slot);
+    for (i = 0; i < OUTBOX_REPORT_WORDS; i++)
+    {
+        WriteWord(slot, i + 1, words[i]);
+        crc = UpdateCRC(crc, words[i]);
+    }
+    WriteWord(slot, OUTBOX_CRC_WORD, crc);
+    WriteWord(slot, 0, nextSequence);
+
+    slotSequence[slot] = nextSequence;
+    nextSequence++;
+    if (nextSequence == OUTBOX_EMPTY)
+    {
+        nextSequence = 0;
+    }
+    outboxReportsAdded++;
+
+    if (!retryTimer.isScheduled)
+    {
+        Outbox_Send();
+    }
+
+    return isRoom;
+}
+
+/**
+ * Description: How many reports are waiting to be sent.
+ * @return uint8_t number of full slots
+ */
+uint8_t Outbox_Count(void)
+{
+    uint8_t slot;
+    uint8_t count = 0;
+
+    for (slot = 0; slot < OUTBOX_SLOT_COUNT; slot++)
+    {
+        if (slotSequence[slot] != OUTBOX_EMPTY)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Description: Asks for the modem to send every waiting report, unless a
+ *      send is already going. Called from the main loop on EVENT_OUTBOX.
+ */
+void Outbox_Send(void)
+{
+    if (isSending || Outbox_Count() == 0)
+    {
+        return;
+    }
+
+    CancelTimer(&retryTimer);
+
+    if (!Modem_Request(ModemReady))
+    {
+        // Someone else has the modem, it isn't the network's fault
+        ScheduleTimerAt(&retryTimer, GetTimeMS() + OUTBOX_BUSY_RETRY_MS,
+                RetryDue);
+        return;
+    }
+
+    isSending = true;
+}
+
+/**
+ * Description: Whether reports are on their way out.
+ * @return bool true while the outbox has the modem
+ */
+bool Outbox_IsSending(void)
+{
+    return isSending;
+}
+
+/**
+ * Description: Retry timer callback, runs in the Timer1 ISR.
+ */
+static void RetryDue(void)
+{
+    RaiseEvent(EVENT_OUTBOX);
+}
+
+/**
+ * Description: Modem callback. Starts on the first text if the modem made
+ *      it onto the network, otherwise backs off.
+ * @param isRegistered: Whether the modem is ours to use
+ */
+static void ModemReady(bool isRegistered)
+{
+    if (!isRegistered)
+    {
+        isSending = false;
+        BackOff();
+        return;
+    }
+
+    // Talking to the modem is done at full speed
+    savedMode = GetClockMode();
+    SetClockMode(CLOCK_FAST);
+
+    SendNextBatch();
+}
+
+/**
+ * Description: Packs the oldest waiting reports into one text and sends it.
+ *      Hands the modem back once there is nothing left.
+ */
+static void SendNextBatch(void)
+{
+    daily_report report;
+    report_message packed;
+    uint8_t i;
+    uint8_t slot;
+
+    batchCount = 0;
+    Report_Begin(&packed, FIRMWARE_VERSION);
+
+    while ((slot = OldestSlot()) != OUTBOX_SLOT_COUNT)
+    {
+        if (!ReadSlot(slot, &report))
+        {
+            continue;
+        }
+
+        if (!Report_Add(&packed, &report))
+        {
+            break; // Full, the rest go in the next text
+        }
+
+        batchSlots[batchCount] = slot;
+        batchSequences[batchCount] = slotSequence[slot];
+        batchCount++;
+
+        // Hidden from OldestSlot until the batch is done with
+        slotSequence[slot] = OUTBOX_EMPTY;
+    }
+
+    // Put back what was hidden, the slots are only emptied on +CMGS
+    for (i = 0; i < batchCount; i++)
+    {
+        slotSequence[batchSlots[i]] = batchSequences[i];
+    }
+
+    if (batchCount == 0)
+    {
+        FinishSending(true);
+        return;
+    }
+
+    sendCommand.payloadLength = Report_ToText(&packed, outboxMessage);
+    if (!AT_SubmitCommand(&sendCommand))
+    {
+        SendDone(&sendCommand);
+    }
+}
+
+/**
+ * Description: AT engine callback for AT+CMGS. The reports in the text are
+ *      only let go of once the modem has answered with a message
+ *      reference, then the next text goes. Anything else is a failed send.
+ * @param command: The finished command
+ */
+static void SendDone(at_command *command)
+{
+    uint8_t i;
+
+    if (command->status != AT_OK || command->result < 0)
+    {
+        FinishSending(false);
+        return;
+    }
+
+    for (i = 0; i < batchCount; i++)
+    {
+        // Unless it was written over while the text was going out
+        if (slotSequence[batchSlots[i]] == batchSequences[i])
+        {
+            EraseSlot(batchSlots[i]);
+            outboxReportsSent++;
+        }
+    }
+
+    SendNextBatch();
+}
+
+/**
+ * Description: Hands the modem back. After a delivery the backoff starts
+ *      over, after a failure the next try is set up.
+ * @param isDelivered: Whether everything waiting went out
+ */
+static void FinishSending(bool isDelivered)
+{
+    Modem_Release();
+    SetClockMode(savedMode);
+    isSending = false;
+
+    if (isDelivered)
+    {
+        retryMS = OUTBOX_RETRY_MIN_MS;
+    }
+    else
+    {
+        BackOff();
+    }
+}
+
+/**
+ * Description: Schedules a retry, each one waiting twice as long as the
+ *      last up to OUTBOX_RETRY_MAX_MS.
+ */
+static void BackOff(void)
+{
+    ScheduleTimerAt(&retryTimer, GetTimeMS() + retryMS, RetryDue);
+
+    retryMS *= 2;
+    if (retryMS > OUTBOX_RETRY_MAX_MS)
+    {
+        retryMS = OUTBOX_RETRY_MAX_MS;
+    }
+}
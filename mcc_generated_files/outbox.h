@@ -0,0 +1,40 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef OUTBOX_H
+#define	OUTBOX_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+#include "report_codec.h"
+
+#define OUTBOX_SLOT_COUNT       10 // Reports kept, 10 x 48 bytes of the 512
+                                   //  byte data EEPROM
+#define OUTBOX_SLOT_WORDS       24 // Sequence, report, CRC and a spare word
+#define OUTBOX_RETRY_MIN_MS     900000UL // First retry after a failed send
+#define OUTBOX_RETRY_MAX_MS     14400000UL // Retries back off to this
+#define OUTBOX_BUSY_RETRY_MS    60000 // Someone else had the modem
+
+// Reports written, sent, and lost to a full outbox or a bad CRC
+extern uint16_t outboxReportsAdded;
+extern uint16_t outboxReportsSent;
+extern uint16_t outboxReportsLost;
+
+void Outbox_Init(void);
+bool Outbox_Add(const daily_report *report);
+uint8_t Outbox_Count(void);
+void Outbox_Send(void);
+bool Outbox_IsSending(void);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
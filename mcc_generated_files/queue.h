@@ -8,56 +8,206 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define UINT16_QUEUE_SIZE       8
-#define UINT8_QUEUE_SIZE        16
-#define FLOAT_QUEUE_SIZE        12
+/*
+ Ring buffer generator. DECLARE_QUEUE goes in a header and gives the
+ <prefix>_queue type and prototypes, DEFINE_QUEUE goes in one .c file and
+ gives the functions.
+ 
+ Each queue has one producer and one consumer, e.g. an ISR pushing and the
+ main loop pulling. The producer only ever writes head and the consumer only
+ ever writes tail, so neither side has to turn interrupts off. head and tail
+ run freely and are masked on use, so size must be a power of two, at most
+ 128 so the uint8_t difference between them is always the element count.
+ DEFINE_QUEUE won't build with any other size.
+ */
+#define DECLARE_QUEUE(prefix, type, size)                                      \
+typedef struct prefix##_queue {                                                \
+    volatile type contents[size];                                              \
+    volatile uint8_t head; /* Next slot to push, producer only */              \
+    volatile uint8_t tail; /* Next slot to pull, consumer only */              \
+} prefix##_queue;                                                              \
+                                                                               \
+void prefix##_InitQueue(prefix##_queue *queueP);                               \
+uint8_t prefix##_QueueCount(prefix##_queue *queueP);                           \
+bool prefix##_IsQueueEmpty(prefix##_queue *queueP);                            \
+bool prefix##_IsQueueFull(prefix##_queue *queueP);                             \
+void prefix##_ClearQueue(prefix##_queue *queueP);                              \
+bool prefix##_PushQueue(prefix##_queue *queueP, type element);                 \
+type prefix##_PullQueue(prefix##_queue *queueP);                               \
+uint8_t prefix##_PushNQueue(prefix##_queue *queueP, const type *data,          \
+        uint8_t count);                                                        \
+uint8_t prefix##_PullNQueue(prefix##_queue *queueP, type *data, uint8_t count);\
+type prefix##_PeekQueue(prefix##_queue *queueP, uint8_t offset);               \
+int16_t prefix##_FindQueue(prefix##_queue *queueP, const type *token,          \
+        uint8_t tokenLen);                                                     \
+void prefix##_DiscardQueue(prefix##_queue *queueP, uint8_t count);
 
-typedef struct uint16_queue {
-    uint16_t contents[UINT16_QUEUE_SIZE];
-    int front;
-    int back;
-    int maxSize;
-    int cnt;
-} uint16_queue;
-
-typedef struct uint8_queue {
-    uint8_t contents[UINT8_QUEUE_SIZE];
-    int front;
-    int back;
-    int maxSize;
-    int cnt;
-} uint8_queue;
-
-typedef struct float_queue {
-    float contents[FLOAT_QUEUE_SIZE];
-    int front;
-    int back;
-    int maxSize;
-    int cnt;
-} float_queue;
-
-bool uint16_InitQueue(uint16_queue *queueP, uint8_t queueSize);
-bool uint16_IsQueueEmpty(uint16_queue *queueP);
-bool uint16_IsQueueFull(uint16_queue *queueP);
-bool uint16_ClearQueue(uint16_queue *queueP);
-bool uint16_PushQueue(uint16_queue *queueP, uint16_t element);
-uint16_t uint16_PullQueue(uint16_queue *queueP);
-
-bool uint8_InitQueue(uint8_queue *queueP, uint8_t queueSize);
-bool uint8_IsQueueEmpty(uint8_queue *queueP);
-bool uint8_IsQueueFull(uint8_queue *queueP);
-bool uint8_ClearQueue(uint8_queue *queueP);
-bool uint8_PushQueue(uint8_queue *queueP, uint8_t element);
-uint8_t uint8_PullQueue(uint8_queue *queueP);
-
-bool float_InitQueue(float_queue *queueP, uint8_t queueSize);
-bool float_IsQueueEmpty(float_queue *queueP);
-bool float_IsQueueFull(float_queue *queueP);
-bool float_ClearQueue(float_queue *queueP);
-bool float_PushQueue(float_queue *queueP, float element);
-float float_PullQueue(float_queue *queueP);
-float float_AverageQueueElements(float_queue *queueP);
+/*
+ * <prefix>_InitQueue: Empties the queue. Call before either side uses it.
+ * <prefix>_QueueCount: Number of elements in the queue. Safe from either side.
+ * <prefix>_IsQueueEmpty / IsQueueFull: Safe from either side.
+ * <prefix>_ClearQueue: Consumer side. Drops everything pushed so far.
+ * <prefix>_PushQueue: Producer side. Returns false if the queue was full.
+ * <prefix>_PullQueue: Consumer side. Returns 0 if the queue was empty.
+ * <prefix>_PushNQueue: Producer side. Copies in as many of count elements as
+ *                      fit and publishes them with one head store. Returns
+ *                      the number pushed.
+ * <prefix>_PullNQueue: Consumer side. Copies out up to count elements and
+ *                      frees them with one tail store. Returns the number
+ *                      pulled.
+ * <prefix>_PeekQueue: Consumer side. Element offset places from the front,
+ *                     left in the queue. Returns 0 past the end.
+ * <prefix>_FindQueue: Consumer side. Offset from the front of the first match
+ *                     of token, searched in place. Returns -1 if not found.
+ * <prefix>_DiscardQueue: Consumer side. Drops up to count elements from the
+ *                        front.
+ */
+#define DEFINE_QUEUE(prefix, type, size)                                       \
+/* Fails to build unless size is a power of two from 1 to 128 */              \
+typedef char prefix##_queue_size_check                                         \
+        [((size) > 0 && (size) <= 128 && ((size) & ((size) - 1)) == 0) ?       \
+        1 : -1];                                                               \
+                                                                               \
+void prefix##_InitQueue(prefix##_queue *queueP)                                \
+{                                                                              \
+    queueP->head = 0;                                                          \
+    queueP->tail = 0;                                                          \
+}                                                                              \
+                                                                               \
+uint8_t prefix##_QueueCount(prefix##_queue *queueP)                            \
+{                                                                              \
+    return (uint8_t)(queueP->head - queueP->tail);                             \
+}                                                                              \
+                                                                               \
+bool prefix##_IsQueueEmpty(prefix##_queue *queueP)                             \
+{                                                                              \
+    return (queueP->head == queueP->tail);                                     \
+}                                                                              \
+                                                                               \
+bool prefix##_IsQueueFull(prefix##_queue *queueP)                              \
+{                                                                              \
+    return (prefix##_QueueCount(queueP) >= (size));                            \
+}                                                                              \
+                                                                               \
+void prefix##_ClearQueue(prefix##_queue *queueP)                               \
+{                                                                              \
+    queueP->tail = queueP->head;                                               \
+}                                                                              \
+                                                                               \
+bool prefix##_PushQueue(prefix##_queue *queueP, type element)                  \
+{                                                                              \
+    uint8_t head = queueP->head;                                               \
+    if ((uint8_t)(head - queueP->tail) >= (size))                              \
+    {                                                                          \
+        return false; /* We can't push to the queue, its full */               \
+    }                                                                          \
+    queueP->contents[head & ((size) - 1)] = element;                           \
+    /* Publish the element only once it is in place */                         \
+    queueP->head = head + 1;                                                   \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+type prefix##_PullQueue(prefix##_queue *queueP)                                \
+{                                                                              \
+    uint8_t tail = queueP->tail;                                               \
+    if (queueP->head == tail)                                                  \
+    {                                                                          \
+        return 0;                                                              \
+    }                                                                          \
+    type element = queueP->contents[tail & ((size) - 1)];                      \
+    /* Free the slot only once the element has been read */                    \
+    queueP->tail = tail + 1;                                                   \
+    return element;                                                            \
+}                                                                              \
+                                                                               \
+uint8_t prefix##_PushNQueue(prefix##_queue *queueP, const type *data,          \
+        uint8_t count)                                                         \
+{                                                                              \
+    uint8_t head = queueP->head;                                               \
+    uint8_t space = (size) - (uint8_t)(head - queueP->tail);                   \
+    uint8_t i;                                                                 \
+    if (count > space)                                                         \
+    {                                                                          \
+        count = space;                                                         \
+    }                                                                          \
+    /* Element by element, so every store stays volatile and lands before */   \
+    /* the head store below */                                                 \
+    for (i = 0; i < count; i++)                                                \
+    {                                                                          \
+        queueP->contents[(uint8_t)(head + i) & ((size) - 1)] = data[i];        \
+    }                                                                          \
+    queueP->head = head + count;                                               \
+    return count;                                                              \
+}                                                                              \
+                                                                               \
+uint8_t prefix##_PullNQueue(prefix##_queue *queueP, type *data, uint8_t count) \
+{                                                                              \
+    uint8_t tail = queueP->tail;                                               \
+    uint8_t used = (uint8_t)(queueP->head - tail);                             \
+    uint8_t i;                                                                 \
+    if (count > used)                                                          \
+    {                                                                          \
+        count = used;                                                          \
+    }                                                                          \
+    /* Every element is read before the tail store frees its slot */           \
+    for (i = 0; i < count; i++)                                                \
+    {                                                                          \
+        data[i] = queueP->contents[(uint8_t)(tail + i) & ((size) - 1)];        \
+    }                                                                          \
+    queueP->tail = tail + count;                                               \
+    return count;                                                              \
+}                                                                              \
+                                                                               \
+type prefix##_PeekQueue(prefix##_queue *queueP, uint8_t offset)                \
+{                                                                              \
+    uint8_t tail = queueP->tail;                                               \
+    if (offset >= (uint8_t)(queueP->head - tail))                              \
+    {                                                                          \
+        return 0;                                                              \
+    }                                                                          \
+    return queueP->contents[(uint8_t)(tail + offset) & ((size) - 1)];          \
+}                                                                              \
+                                                                               \
+int16_t prefix##_FindQueue(prefix##_queue *queueP, const type *token,          \
+        uint8_t tokenLen)                                                      \
+{                                                                              \
+    uint8_t tail = queueP->tail;                                               \
+    uint8_t used = (uint8_t)(queueP->head - tail);                             \
+    uint8_t i, j;                                                              \
+    if ((tokenLen == 0) || (tokenLen > used))                                  \
+    {                                                                          \
+        return -1;                                                             \
+    }                                                                          \
+    for (i = 0; i <= (uint8_t)(used - tokenLen); i++)                          \
+    {                                                                          \
+        for (j = 0; j < tokenLen; j++)                                         \
+        {                                                                      \
+            if (queueP->contents[(uint8_t)(tail + i + j) & ((size) - 1)] !=    \
+                    token[j])                                                  \
+            {                                                                  \
+                break;                                                         \
+            }                                                                  \
+        }                                                                      \
+        if (j == tokenLen)                                                     \
+        {                                                                      \
+            return i;                                                          \
+        }                                                                      \
+    }                                                                          \
+    return -1;                                                                 \
+}                                                                              \
+                                                                               \
+void prefix##_DiscardQueue(prefix##_queue *queueP, uint8_t count)              \
+{                                                                              \
+    uint8_t tail = queueP->tail;                                               \
+    uint8_t used = (uint8_t)(queueP->head - tail);                             \
+    if (count > used)                                                          \
+    {                                                                          \
+        count = used;                                                          \
+    }                                                                          \
+    queueP->tail = tail + count;                                               \
+}
 
 #ifdef	__cplusplus
 extern "C" {
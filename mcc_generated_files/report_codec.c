@@ -0,0 +1,512 @@
+/*
+ * File:   report_codec.c
+ */
+
+
+#ifdef __XC16__
+#include "xc.h"
+#endif
+#include <string.h>
+#include "report_codec.h"
+
+/*
+ Packs daily reports into as few text messages as possible. A message is a
+ 3 byte header (format version, how many bytes follow the header, firmware
+ version) and then one record per report. Record fields are varints, 7 bits
+ a byte, low bits first, with the top bit set on every byte but the last.
+ Changes are zigzag coded first, so a small step either way stays one byte.
+
+ A record is
+     day            days since 1 Jan 2000 for the first report in the
+                    message, the change from the report before after that
+     leakRate, longestPrime, batteryMV
+     volume         each bin as the change from the bin before
+     fastMinutes, idleMinutes, modemSeconds
+     diagnostics    one byte, not a varint
+
+ The bytes go out as base 85, 4 bytes to 5 characters, big end first, and a
+ short last group of n bytes as n + 1 characters. Every character is one
+ septet in the GSM 7 bit alphabet, so a text holds 128 bytes, about 3 days
+ of reports against 1 as ASCII. The header length lets the reader put back
+ spaces a gateway trimmed off the end.
+
+ The same file builds on the PC, without __XC16__, where Report_Decode is
+ compiled in to read the messages back.
+ */
+
+static const char reportAlphabet[REPORT_BASE + 1] =
+        "0123456789"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        "abcdefghijklmnopqrstuvwxyz"
+        "!#$%&()*+-;<=>?_'\",./: ";
+
+static const uint16_t daysBeforeMonth[12] = {
+    0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+};
+
+/**
+ * Description: Writes a value as a varint.
+ * @param bytes: Where it goes, needs room for 5 bytes
+ * @param value: Value to write
+ * @return uint8_t bytes written
+ */
+static uint8_t PutVarint(uint8_t *bytes, uint32_t value)
+{
+    uint8_t length = 0;
+
+    while (value >= 0x80)
+    {
+        bytes[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = (uint8_t)value;
+
+    return length;
+}
+
+/**
+ * Description: Maps a signed change onto an unsigned one, 0, -1, 1, -2...
+ *      become 0, 1, 2, 3... so it stays short as a varint.
+ * @param value: Change to map
+ * @return uint32_t the mapped value
+ */
+static uint32_t ZigZag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**
+ * Description: Days since 1 Jan 2000. Good through 2099, as the RTCC is.
+ * @param year: Years since 2000
+ * @param month: 1 to 12
+ * @param day: Day of the month, from 1
+ * @return uint16_t the day index
+ */
+uint16_t Report_DayIndex(uint8_t year, uint8_t month, uint8_t day)
+{
+    // 2000 was a leap year, so leap days before this year are every 4th
+    uint16_t index = ((uint16_t)year * 365) + ((year + 3) / 4);
+
+    if (month < 1 || month > 12)
+    {
+        month = 1;
+    }
+
+    index += daysBeforeMonth[month - 1];
+    if ((month > 2) && ((year % 4) == 0))
+    {
+        index++;
+    }
+
+    return index + day - 1;
+}
+
+/**
+ * Description: Starts an empty message.
+ * @param message: Message to start
+ * @param firmware: Firmware version that goes in the header
+ */
+void Report_Begin(report_message *message, uint8_t firmware)
+{
+    message->bytes[0] = REPORT_FORMAT_VERSION;
+    message->bytes[1] = 0;
+    message->bytes[2] = firmware;
+    message->length = REPORT_HEADER_BYTES;
+    message->count = 0;
+    message->lastDay = 0;
+}
+
+/**
+ * Description: Packs a report onto the end of a message, if there is room.
+ * @param message: Message to add to
+ * @param report: Report to pack
+ * @return bool false if it didn't fit, the message is left as it was
+ */
+bool Report_Add(report_message *message, const daily_report *report)
+{
+    uint8_t record[REPORT_RECORD_MAX_BYTES];
+    uint8_t length = 0;
+    uint16_t day = Report_DayIndex(report->year, report->month, report->day);
+    int32_t previous = 0;
+    uint8_t i;
+
+    if (message->count == 0)
+    {
+        length += PutVarint(record, day);
+    }
+    else
+    {
+        length += PutVarint(record,
+                ZigZag((int32_t)day - (int32_t)message->lastDay));
+    }
+
+    length += PutVarint(record + length, report->leakRate);
+    length += PutVarint(record + length, report->longestPrime);
+    length += PutVarint(record + length, report->batteryMV);
+
+    for (i = 0; i < 12; i++)
+    {
+        length += PutVarint(record + length,
+                ZigZag((int32_t)report->volume[i] - previous));
+        previous = report->volume[i];
+    }
+
+    length += PutVarint(record + length, report->fastMinutes);
+    length += PutVarint(record + length, report->idleMinutes);
+    length += PutVarint(record + length, report->modemSeconds);
+    record[length++] = report->diagnostics;
+
+    if (message->length + length > REPORT_MAX_BYTES)
+    {
+        return false;
+    }
+
+    memcpy(message->bytes + message->length, record, length);
+    message->length += length;
+    message->bytes[1] = message->length - REPORT_HEADER_BYTES;
+    message->count++;
+    message->lastDay = day;
+
+    return true;
+}
+
+/**
+ * Description: Characters it takes to send some bytes.
+ * @param byteCount: Bytes to send
+ * @return uint8_t characters of text
+ */
+uint8_t Report_TextLength(uint8_t byteCount)
+{
+    uint8_t extra = byteCount % 4;
+
+    return ((byteCount / 4) * 5) + ((extra != 0) ? (extra + 1) : 0);
+}
+
+/**
+ * Description: Turns a message into text. It isn't NULL terminated.
+ * @param message: Message to send
+ * @param text: Where the text goes, Report_TextLength(message->length)
+ *      characters, at most REPORT_TEXT_LENGTH
+ * @return uint8_t length of the text
+ */
+uint8_t Report_ToText(const report_message *message, char *text)
+{
+    uint8_t in;
+    uint8_t out = 0;
+    uint8_t count;
+    uint8_t i;
+    uint32_t group;
+    char digits[5];
+
+    for (in = 0; in < message->length; in += 4)
+    {
+        count = message->length - in;
+        if (count > 4)
+        {
+            count = 4;
+        }
+
+        // A short group is padded with zeros, and only count + 1 of its
+        //  characters are needed to get the bytes back
+        group = 0;
+        for (i = 0; i < 4; i++)
+        {
+            group <<= 8;
+            if (i < count)
+            {
+                group |= message->bytes[in + i];
+            }
+        }
+
+        for (i = 5; i > 0; i--)
+        {
+            digits[i - 1] = reportAlphabet[group % REPORT_BASE];
+            group /= REPORT_BASE;
+        }
+
+        memcpy(text + out, digits, count + 1);
+        out += count + 1;
+    }
+
+    return out;
+}
+
+#ifndef __XC16__
+
+/**
+ * Description: Reads a varint.
+ * @param bytes: Message bytes
+ * @param length: Bytes in the message
+ * @param at: Where it starts, moved past it
+ * @param value: Where the value goes
+ * @return bool false if the message ended inside it, or it is too long
+ */
+static bool GetVarint(const uint8_t *bytes, uint8_t length, uint8_t *at,
+        uint32_t *value)
+{
+    uint8_t shift = 0;
+    uint8_t byte;
+
+    *value = 0;
+    do
+    {
+        if (*at >= length || shift > 28)
+        {
+            return false;
+        }
+
+        byte = bytes[(*at)++];
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return true;
+}
+
+/**
+ * Description: Reads a varint that has to fit 16 bits.
+ * @param bytes: Message bytes
+ * @param length: Bytes in the message
+ * @param at: Where it starts, moved past it
+ * @param value: Where the value goes
+ * @return bool false if it is bad or too big
+ */
+static bool GetVarint16(const uint8_t *bytes, uint8_t length, uint8_t *at,
+        uint16_t *value)
+{
+    uint32_t wide;
+
+    if (!GetVarint(bytes, length, at, &wide) || wide > 0xFFFF)
+    {
+        return false;
+    }
+
+    *value = (uint16_t)wide;
+    return true;
+}
+
+/**
+ * Description: Undoes ZigZag.
+ * @param value: Mapped value
+ * @return int32_t the signed change
+ */
+static int32_t UnZigZag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/**
+ * Description: Turns a day index back into a date.
+ * @param index: Days since 1 Jan 2000
+ * @param report: Report to put the date in
+ */
+static void DayIndexToDate(uint16_t index, daily_report *report)
+{
+    uint8_t year = 0;
+    uint8_t month = 1;
+    uint16_t days;
+
+    while (index >= (days = ((year % 4) == 0) ? 366 : 365))
+    {
+        index -= days;
+        year++;
+    }
+
+    while (month < 12)
+    {
+        days = daysBeforeMonth[month] - daysBeforeMonth[month - 1];
+        if ((month == 2) && ((year % 4) == 0))
+        {
+            days++;
+        }
+        if (index < days)
+        {
+            break;
+        }
+        index -= days;
+        month++;
+    }
+
+    report->year = year;
+    report->month = month;
+    report->day = (uint8_t)(index + 1);
+}
+
+/**
+ * Description: Turns text back into bytes.
+ * @param text: Text to read
+ * @param textLength: Characters of text
+ * @param bytes: Where the bytes go, room for REPORT_MAX_BYTES
+ * @return int16_t bytes read, -1 if the text isn't a message
+ */
+static int16_t TextToBytes(const char *text, uint8_t textLength,
+        uint8_t *bytes)
+{
+    uint8_t in;
+    uint8_t out = 0;
+    uint8_t count;
+    uint8_t i;
+    uint64_t group;
+    const char *digit;
+
+    for (in = 0; in < textLength; in += 5)
+    {
+        count = textLength - in;
+        if (count > 5)
+        {
+            count = 5;
+        }
+        if (count == 1)
+        {
+            return -1; // No group is ever one character
+        }
+
+        // A short group is padded with the top digit, undoing the zeros
+        group = 0;
+        for (i = 0; i < 5; i++)
+        {
+            group *= REPORT_BASE;
+            if (i < count)
+            {
+                digit = strchr(reportAlphabet, text[in + i]);
+                if (text[in + i] == '\0' || digit == NULL)
+                {
+                    return -1;
+                }
+                group += digit - reportAlphabet;
+            }
+            else
+            {
+                group += REPORT_BASE - 1;
+            }
+        }
+
+        if (group > 0xFFFFFFFFUL)
+        {
+            return -1;
+        }
+
+        for (i = 0; i < count - 1; i++)
+        {
+            bytes[out++] = (uint8_t)(group >> (24 - (8 * i)));
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Description: Reads the reports back out of a message's text. PC only.
+ * @param text: Text of the message
+ * @param textLength: Characters of text, spaces trimmed off the end are
+ *      put back
+ * @param reports: Where the reports go
+ * @param maxReports: Room at reports
+ * @param firmware: Where the firmware version goes
+ * @return uint8_t reports read, 0 if the text isn't a good message or
+ *      there wasn't room
+ */
+uint8_t Report_Decode(const char *text, uint8_t textLength,
+        daily_report *reports, uint8_t maxReports, uint8_t *firmware)
+{
+    char padded[REPORT_TEXT_LENGTH];
+    uint8_t bytes[REPORT_MAX_BYTES];
+    uint8_t length;
+    uint8_t needed;
+    uint8_t at = REPORT_HEADER_BYTES;
+    uint8_t count = 0;
+    uint8_t i;
+    int32_t day = 0;
+    uint32_t value;
+    int32_t previous;
+    daily_report *report;
+
+    if (textLength > REPORT_TEXT_LENGTH ||
+            textLength < Report_TextLength(REPORT_HEADER_BYTES))
+    {
+        return 0;
+    }
+
+    // The header says how long the message is
+    memcpy(padded, text, textLength);
+    if (TextToBytes(padded, Report_TextLength(REPORT_HEADER_BYTES),
+            bytes) < 0 || bytes[0] != REPORT_FORMAT_VERSION)
+    {
+        return 0;
+    }
+
+    if (bytes[1] > REPORT_MAX_BYTES - REPORT_HEADER_BYTES)
+    {
+        return 0;
+    }
+    length = REPORT_HEADER_BYTES + bytes[1];
+    needed = Report_TextLength(length);
+    if (textLength > needed)
+    {
+        return 0;
+    }
+
+    memset(padded + textLength, ' ', needed - textLength);
+    if (TextToBytes(padded, needed, bytes) != length)
+    {
+        return 0;
+    }
+    *firmware = bytes[2];
+
+    while (at < length)
+    {
+        if (count == maxReports)
+        {
+            return 0;
+        }
+        report = &reports[count];
+
+        if (!GetVarint(bytes, length, &at, &value))
+        {
+            return 0;
+        }
+        day = (count == 0) ? (int32_t)value : (day + UnZigZag(value));
+        if (day < 0 || day > 0xFFFF)
+        {
+            return 0;
+        }
+        DayIndexToDate((uint16_t)day, report);
+
+        if (!GetVarint16(bytes, length, &at, &report->leakRate) ||
+                !GetVarint16(bytes, length, &at, &report->longestPrime) ||
+                !GetVarint16(bytes, length, &at, &report->batteryMV))
+        {
+            return 0;
+        }
+
+        previous = 0;
+        for (i = 0; i < 12; i++)
+        {
+            if (!GetVarint(bytes, length, &at, &value))
+            {
+                return 0;
+            }
+            previous += UnZigZag(value);
+            if (previous < 0 || previous > 0xFFFF)
+            {
+                return 0;
+            }
+            report->volume[i] = (uint16_t)previous;
+        }
+
+        if (!GetVarint16(bytes, length, &at, &report->fastMinutes) ||
+                !GetVarint16(bytes, length, &at, &report->idleMinutes) ||
+                !GetVarint(bytes, length, &at, &report->modemSeconds) ||
+                at >= length)
+        {
+            return 0;
+        }
+        report->diagnostics = bytes[at++];
+
+        count++;
+    }
+
+    return count;
+}
+
+#endif
@@ -0,0 +1,80 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef REPORT_CODEC_H
+#define	REPORT_CODEC_H
+
+#ifdef __XC16__ // The codec is built on the PC too, where there is no xc.h
+#include <xc.h> // include processor files - each processor file is guarded.  
+#endif
+#include <stdbool.h>
+#include <stdint.h>
+
+#define REPORT_FORMAT_VERSION   1
+#define REPORT_TEXT_LENGTH      160 // One text message
+#define REPORT_MAX_BYTES        128 // What base 85 fits in REPORT_TEXT_LENGTH
+#define REPORT_HEADER_BYTES     3 // Format version, length, firmware version
+#define REPORT_RECORD_MAX_BYTES 60 // A report with every field at its largest
+#define REPORT_BASE             85
+
+// daily_report diagnostics bits, for the day the report covers
+#define REPORT_DIAG_BATTERY_LOW     0x01 // The battery was low at midnight
+#define REPORT_DIAG_MODEM_FAILED    0x02 // A modem boot or power down failed
+#define REPORT_DIAG_REPORT_LOST     0x04 // The outbox lost a report
+#define REPORT_DIAG_UART_ERRORS     0x08 // Bytes from the SIM800 were lost
+
+typedef struct daily_report daily_report;
+
+/*
+ One day of pumping as it is kept until it has been sent. Values are
+ scaled to fit 16 bits. The size must stay a whole number of words, it is
+ written to the EEPROM a word at a time.
+ */
+struct daily_report {
+    uint8_t year; // Day the report covers, from the RTCC
+    uint8_t month;
+    uint8_t day;
+    uint8_t diagnostics; // REPORT_DIAG bits
+    uint16_t leakRate; // Fastest leak, tenths of L/hr
+    uint16_t longestPrime; // Tenths of a meter
+    uint16_t batteryMV; // Average battery voltage
+    uint16_t volume[12]; // Each 2 hour bin, tenths of liters
+    uint16_t fastMinutes; // At the fast accelerometer sample rate
+    uint16_t idleMinutes; // At the idle sample rate
+    uint32_t modemSeconds; // Modem powered
+};
+
+typedef struct report_message report_message;
+
+/*
+ Reports packed for one text message, before they are turned into text.
+ */
+struct report_message {
+    uint8_t bytes[REPORT_MAX_BYTES]; // Header, then one record per report
+    uint8_t length;
+    uint8_t count; // Reports in it
+    uint16_t lastDay; // Day index of the last report, the next is a delta
+};
+
+void Report_Begin(report_message *message, uint8_t firmware);
+bool Report_Add(report_message *message, const daily_report *report);
+uint8_t Report_TextLength(uint8_t byteCount);
+uint8_t Report_ToText(const report_message *message, char *text);
+uint16_t Report_DayIndex(uint8_t year, uint8_t month, uint8_t day);
+
+#ifndef __XC16__
+uint8_t Report_Decode(const char *text, uint8_t textLength,
+        daily_report *reports, uint8_t maxReports, uint8_t *firmware);
+#endif
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
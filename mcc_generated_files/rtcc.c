@@ -1,194 +1,181 @@
-//
-///**
-//  RTCC Generated Driver API Header File
-//
-//  @Company:
-//    Microchip Technology Inc.
-//
-//  @File Name:
-//    rtcc.c
-//
-//  @Summary:
-//    This is the generated header file for the RTCC driver using MPLAB Code Configurator
-//
-//  @Description:
-//    This header file provides APIs for driver for RTCC.
-//    Generation Information :
-//        Product Revision  :  MPLAB Code Configurator - v2.25.2
-//        Device            :  PIC24F32KA302
-//        Driver Version    :  0.5
-//    The generated drivers are tested against the following:
-//        Compiler          :  XC16 v1.24
-//        MPLAB 	          :  MPLAB X v2.35 or v3.00
-// */
-//
-///*
-//Copyright (c) 2013 - 2015 released Microchip Technology Inc.  All rights reserved.
-//
-//Microchip licenses to you the right to use, modify, copy and distribute
-//Software only when embedded on a Microchip microcontroller or digital signal
-//controller that is integrated into your product or third party product
-//(pursuant to the sublicense terms in the accompanying license agreement).
-//
-//You should refer to the license agreement accompanying this Software for
-//additional information regarding your rights and obligations.
-//
-//SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
-//EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY WARRANTY OF
-//MERCHANTABILITY, TITLE, NON-INFRINGEMENT AND FITNESS FOR A PARTICULAR PURPOSE.
-//IN NO EVENT SHALL MICROCHIP OR ITS LICENSORS BE LIABLE OR OBLIGATED UNDER
-//CONTRACT, NEGLIGENCE, STRICT LIABILITY, CONTRIBUTION, BREACH OF WARRANTY, OR
-//OTHER LEGAL EQUITABLE THEORY ANY DIRECT OR INDIRECT DAMAGES OR EXPENSES
-//INCLUDING BUT NOT LIMITED TO ANY INCIDENTAL, SPECIAL, INDIRECT, PUNITIVE OR
-//CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, COST OF PROCUREMENT OF
-//SUBSTITUTE GOODS, TECHNOLOGY, SERVICES, OR ANY CLAIMS BY THIRD PARTIES
-//(INCLUDING BUT NOT LIMITED TO ANY DEFENSE THEREOF), OR OTHER SIMILAR COSTS.
-// */
-//
-//
-///**
-// Section: Included Files
-// */
-//
-//#include <xc.h>
-//#include "rtcc.h"
-//
-///**
-//// Section: Driver Interface Function Definitions
-// */
-//
-//
-//void RTCC_Initialize(void) {
-//    // Turn on the secondary oscillator
-//    __builtin_write_OSCCONL(0x02);
-//
-//    // Set the RTCWREN bit
-//    __builtin_write_RTCWEN();
-//
-//    RCFGCALbits.RTCEN = 0;
-//
-//    // set Thu Sep 24 11:03:00 EDT 2015
-//    RCFGCALbits.RTCPTR = 3; // start the sequence
-//    RTCVAL = 0x15; // YEAR
-//    RTCVAL = 0x924; // MONTH-1/DAY-1
-//    RTCVAL = 0x411; // WEEKDAY/HOURS
-//    RTCVAL = 0x300; // MINUTES/SECONDS
-//
-//    // set Thu Sep 24 00:00:00 EDT 2015
-//    ALCFGRPTbits.ALRMEN = 0;
-//    ALCFGRPTbits.ALRMPTR = 2;
-//    ALRMVAL = 0x924;
-//    ALRMVAL = 0x400;
-//    ALRMVAL = 0x0;
-//
-//    // ALRMEN enabled; ARPT 0x00; AMASK Every Half Second; CHIME disabled; ALRMPTR MIN_SEC; 
-//    ALCFGRPT = 0x8000;
-//    // PWCPOL disabled; PWCEN disabled; RTCOUT Alarm Pulse; RTCCLK SOSC; 
-//    RTCPWC = 0x0000;
-//
-//    // PADCFG1 0; 
-//    PADCFG1 = 0x0000;
-//
-//    // Enable RTCC, clear RTCWREN
-//    RCFGCALbits.RTCEN = 1;
-//    RCFGCALbits.RTCWREN = 0;
-//
-//    IEC3bits.RTCIE = 1;
-//}
-//
-///**
-//    void DRV_RTCC_Initialize (void)
-// */
-//void DRV_RTCC_Initialize(void) {
-//    RTCC_Initialize();
-//}
-//
-///**
-// This function implements RTCC_TimeGet. It access the 
-// registers of  RTCC and writes to them the values provided 
-// in the function argument currentTime
-// */
-//
-//bool RTCC_TimeGet(struct tm *currentTime) {
-//    uint16_t register_value;
-//    if (RCFGCALbits.RTCSYNC) {
-//        return false;
-//    }
-//
-//    // Set the RTCWREN bit
-//    __builtin_write_RTCWEN();
-//
-//    RCFGCALbits.RTCPTR = 3;
-//    register_value = RTCVAL;
-//    currentTime->tm_year = ((((register_value & 0x00FF) & 0xF0) >> 4)* 10 + ((register_value & 0x00FF) & 0x0F));
-//    RCFGCALbits.RTCPTR = 2;
-//    register_value = RTCVAL;
-//    currentTime->tm_mon = (((((register_value & 0xFF00) >> 8) & 0xF0) >> 4)* 10 + (((register_value & 0xFF00) >> 8) & 0x0F));
-//    currentTime->tm_mday = ((((register_value & 0x00FF) & 0xF0) >> 4)* 10 + ((register_value & 0x00FF) & 0x0F));
-//    RCFGCALbits.RTCPTR = 1;
-//    register_value = RTCVAL;
-//    currentTime->tm_wday = (((((register_value & 0xFF00) >> 8) & 0xF0) >> 4)* 10 + (((register_value & 0xFF00) >> 8) & 0x0F));
-//    currentTime->tm_hour = ((((register_value & 0x00FF) & 0xF0) >> 4)* 10 + ((register_value & 0x00FF) & 0x0F));
-//    RCFGCALbits.RTCPTR = 0;
-//    register_value = RTCVAL;
-//    currentTime->tm_min = (((((register_value & 0xFF00) >> 8) & 0xF0) >> 4)* 10 + (((register_value & 0xFF00) >> 8) & 0x0F));
-//    currentTime->tm_sec = ((((register_value & 0x00FF) & 0xF0) >> 4)* 10 + ((register_value & 0x00FF) & 0x0F));
-//    RCFGCALbits.RTCWREN = 0;
-//
-//    return true;
-//}
-//
-///**
-//    bool DRV_RTCC_TimeGet(struct tm *currentTime)
-// */
-//bool DRV_RTCC_TimeGet(struct tm *currentTime) {
-//    return (RTCC_TimeGet(currentTime));
-//}
-//
-///**
-// This function sets the RTCC value
-// */
-//void RTCC_TimeSet(struct tm * initialTime) {
-//    // Set the RTCWREN bit
-//    __builtin_write_RTCWEN();
-//
-//    RCFGCALbits.RTCEN = 0;
-//
-//    IFS3bits.RTCIF = false;
-//    IEC3bits.RTCIE = 0;
-//
-//    // set RTCC initial time
-//    RCFGCALbits.RTCPTR = 3; // start the sequence
-//    RTCVAL = initialTime->tm_year; // YEAR
-//    RTCVAL = (initialTime->tm_mon << 8) | initialTime->tm_mday; // MONTH-1/DAY-1
-//    RTCVAL = (initialTime->tm_wday << 8) | initialTime->tm_hour; // WEEKDAY/HOURS
-//    RTCVAL = (initialTime->tm_min << 8) | initialTime->tm_sec; // MINUTES/SECONDS   
-//
-//    // Enable RTCC, clear RTCWREN         
-//    RCFGCALbits.RTCEN = 1;
-//    RCFGCALbits.RTCWREN = 0;
-//
-//    IEC3bits.RTCIE = 1;
-//
-//}
-//
-///* Function:
-//    void __attribute__ ( ( interrupt, no_auto_psv ) ) _ISR _RTCCInterrupt( void )
-//
-//  Summary:
-//    Interrupt Service Routine for the RTCC Peripheral
-//
-//  Description:
-//    This is the interrupt service routine for the RTCC peripheral. Add in code if 
-//    required in the ISR. 
-// */
-//
-//void __attribute__((interrupt, no_auto_psv)) _ISR _RTCCInterrupt(void) {
-//    /* TODO : Add interrupt handling code */
-//    IFS3bits.RTCIF = false;
-//}
-//
-//
-///**
-// End of File
-// */
+
+/**
+  RTCC Generated Driver API Header File
+
+  @Company:
+    Microchip Technology Inc.
+
+  @File Name:
+    rtcc.c
+
+  @Summary:
+    This is the generated header file for the RTCC driver using MPLAB Code Configurator
+
+  @Description:
+    This header file provides APIs for driver for RTCC.
+    Generation Information :
+        Product Revision  :  MPLAB Code Configurator - v2.25.2
+        Device            :  PIC24F32KA302
+        Driver Version    :  0.5
+    The generated drivers are tested against the following:
+        Compiler          :  XC16 v1.24
+        MPLAB 	          :  MPLAB X v2.35 or v3.00
+ */
+
+/*
+Copyright (c) 2013 - 2015 released Microchip Technology Inc.  All rights reserved.
+
+Microchip licenses to you the right to use, modify, copy and distribute
+Software only when embedded on a Microchip microcontroller or digital signal
+controller that is integrated into your product or third party product
+(pursuant to the sublicense terms in the accompanying license agreement).
+
+You should refer to the license agreement accompanying this Software for
+additional information regarding your rights and obligations.
+
+SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY WARRANTY OF
+MERCHANTABILITY, TITLE, NON-INFRINGEMENT AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL MICROCHIP OR ITS LICENSORS BE LIABLE OR OBLIGATED UNDER
+CONTRACT, NEGLIGENCE, STRICT LIABILITY, CONTRIBUTION, BREACH OF WARRANTY, OR
+OTHER LEGAL EQUITABLE THEORY ANY DIRECT OR INDIRECT DAMAGES OR EXPENSES
+INCLUDING BUT NOT LIMITED TO ANY INCIDENTAL, SPECIAL, INDIRECT, PUNITIVE OR
+CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, COST OF PROCUREMENT OF
+SUBSTITUTE GOODS, TECHNOLOGY, SERVICES, OR ANY CLAIMS BY THIRD PARTIES
+(INCLUDING BUT NOT LIMITED TO ANY DEFENSE THEREOF), OR OTHER SIMILAR COSTS.
+ */
+
+
+/**
+ Section: Included Files
+ */
+
+#include <xc.h>
+#include "rtcc.h"
+#include "conversion.h"
+#include "interrupt_handlers.h"
+
+/**
+// Section: Driver Interface Function Definitions
+ */
+
+
+void RTCC_Initialize(void) {
+    // The secondary oscillator is turned on by OSCILLATOR_Initialize
+
+    // Set the RTCWREN bit
+    __builtin_write_RTCWEN();
+
+    RCFGCALbits.RTCEN = 0;
+
+    // Alarm at xx:00:00
+    ALCFGRPTbits.ALRMEN = 0;
+    ALCFGRPTbits.ALRMPTR = 0;
+    ALRMVAL = 0x0000; // MINUTES/SECONDS
+
+    // ALRMEN enabled; ARPT 0x00; AMASK Every Hour; CHIME enabled; ALRMPTR MIN_SEC; 
+    ALCFGRPT = 0xD400;
+    // PWCPOL disabled; PWCEN disabled; RTCOUT Alarm Pulse; RTCCLK SOSC; 
+    RTCPWC = 0x0000;
+
+    // PADCFG1 0; 
+    PADCFG1 = 0x0000;
+
+    // Enable RTCC, clear RTCWREN
+    RCFGCALbits.RTCEN = 1;
+    RCFGCALbits.RTCWREN = 0;
+
+    // The alarm interrupt is enabled once the time has been loaded
+    IFS3bits.RTCIF = false;
+}
+
+/**
+    void DRV_RTCC_Initialize (void)
+ */
+void DRV_RTCC_Initialize(void) {
+    RTCC_Initialize();
+}
+
+/**
+ This function implements RTCC_TimeGet. It reads the 
+ registers of RTCC and writes their values, in decimal, 
+ to the function argument currentTime
+ */
+
+bool RTCC_TimeGet(time_s *currentTime) {
+    uint16_t register_value;
+    if (RCFGCALbits.RTCSYNC) {
+        return false;
+    }
+
+    RCFGCALbits.RTCPTR = 3;
+    register_value = RTCVAL;
+    currentTime->year = BcdToDec(register_value & 0x00FF);
+    RCFGCALbits.RTCPTR = 2;
+    register_value = RTCVAL;
+    currentTime->month = BcdToDec(register_value >> 8);
+    currentTime->mnDay = BcdToDec(register_value & 0x00FF);
+    RCFGCALbits.RTCPTR = 1;
+    register_value = RTCVAL;
+    currentTime->wkDay = BcdToDec(register_value >> 8);
+    currentTime->hour = BcdToDec(register_value & 0x00FF);
+    RCFGCALbits.RTCPTR = 0;
+    register_value = RTCVAL;
+    currentTime->minute = BcdToDec(register_value >> 8);
+    currentTime->second = BcdToDec(register_value & 0x00FF);
+
+    return true;
+}
+
+/**
+    bool DRV_RTCC_TimeGet(time_s *currentTime)
+ */
+bool DRV_RTCC_TimeGet(time_s *currentTime) {
+    return (RTCC_TimeGet(currentTime));
+}
+
+/**
+ This function sets the RTCC value
+ */
+void RTCC_TimeSet(time_s * initialTime) {
+    // Set the RTCWREN bit
+    __builtin_write_RTCWEN();
+
+    RCFGCALbits.RTCEN = 0;
+
+    // set RTCC initial time
+    RCFGCALbits.RTCPTR = 3; // start the sequence
+    RTCVAL = DecToBcd(initialTime->year); // YEAR
+    RTCVAL = ((uint16_t)DecToBcd(initialTime->month) << 8) | DecToBcd(initialTime->mnDay); // MONTH-1/DAY-1
+    RTCVAL = ((uint16_t)DecToBcd(initialTime->wkDay) << 8) | DecToBcd(initialTime->hour); // WEEKDAY/HOURS
+    RTCVAL = ((uint16_t)DecToBcd(initialTime->minute) << 8) | DecToBcd(initialTime->second); // MINUTES/SECONDS   
+
+    // Enable RTCC, clear RTCWREN         
+    RCFGCALbits.RTCEN = 1;
+    RCFGCALbits.RTCWREN = 0;
+}
+
+/* Function:
+    void __attribute__ ( ( interrupt, no_auto_psv ) ) _ISR _RTCCInterrupt( void )
+
+  Summary:
+    Interrupt Service Routine for the RTCC Peripheral
+
+  Description:
+    This is the interrupt service routine for the RTCC peripheral. The alarm
+    chimes at the top of every hour.
+ */
+
+void __attribute__((interrupt, no_auto_psv)) _ISR _RTCCInterrupt(void) {
+    uint16_t startTicks = TMR5_Counter16BitGet();
+
+    RTCCHandler();
+    IFS3bits.RTCIF = false;
+
+    RecordISRTime(ISR_RTCC, startTicks);
+}
+
+
+/**
+ End of File
+ */
@@ -1,169 +1,171 @@
-///**
-//  RTCC Generated Driver API Header File
-//
-//  Company:
-//    Microchip Technology Inc.
-//
-//  File Name:
-//    rtcc.h
-//
-//  @Summary
-//    This is the generated header file for the RTCC driver using MPLAB Code Configurator
-//
-//  @Description
-//    This header file provides APIs for driver for RTCC.
-//    Generation Information :
-//        Product Revision  :  MPLAB Code Configurator - v2.25.2
-//        Device            :  PIC24F32KA302
-//        Driver Version    :  0.5
-//    The generated drivers are tested against the following:
-//        Compiler          :  XC16 v1.24
-//        MPLAB 	          :  MPLAB X v2.35 or v3.00
-// */
-//
-///*
-//Copyright (c) 2013 - 2015 released Microchip Technology Inc.  All rights reserved.
-//
-//Microchip licenses to you the right to use, modify, copy and distribute
-//Software only when embedded on a Microchip microcontroller or digital signal
-//controller that is integrated into your product or third party product
-//(pursuant to the sublicense terms in the accompanying license agreement).
-//
-//You should refer to the license agreement accompanying this Software for
-//additional information regarding your rights and obligations.
-//
-//SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
-//EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY WARRANTY OF
-//MERCHANTABILITY, TITLE, NON-INFRINGEMENT AND FITNESS FOR A PARTICULAR PURPOSE.
-//IN NO EVENT SHALL MICROCHIP OR ITS LICENSORS BE LIABLE OR OBLIGATED UNDER
-//CONTRACT, NEGLIGENCE, STRICT LIABILITY, CONTRIBUTION, BREACH OF WARRANTY, OR
-//OTHER LEGAL EQUITABLE THEORY ANY DIRECT OR INDIRECT DAMAGES OR EXPENSES
-//INCLUDING BUT NOT LIMITED TO ANY INCIDENTAL, SPECIAL, INDIRECT, PUNITIVE OR
-//CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, COST OF PROCUREMENT OF
-//SUBSTITUTE GOODS, TECHNOLOGY, SERVICES, OR ANY CLAIMS BY THIRD PARTIES
-//(INCLUDING BUT NOT LIMITED TO ANY DEFENSE THEREOF), OR OTHER SIMILAR COSTS.
-// */
-//
-//#ifndef _RTCC_H
-//#define _RTCC_H
-//
-//
-///**
-// Section: Included Files
-// */
-//
-//
-//#include <stdbool.h>
-//#include <stdint.h>
-//#include <time.h>
-//
-//#ifdef __cplusplus  // Provide C++ Compatibility
-//
-//extern "C" {
-//
-//#endif
-//
-//    /**
-//     Section: Interface Routines
-//     */
-//
-//    /**
-//      @Summary
-//        Initializes and enables RTCC peripheral
-//
-//      @Description
-//        This function sets a time in the RTCC and enables 
-//        RTCC for operation. It will also configure the Alarm settings.
-//
-//      @Preconditions
-//        None
-//
-//      @Param
-//        None
-//
-//      @Returns
-//        None
-//
-//      @Example
-//        <code>
-//        struct tm currentTime;
-//
-//        RTCC_Initialize();
-//
-//        while(!RTCC_TimeGet(&currentTime))
-//        {
-//            // Do something
-//        }
-//        </code>
-//     */
-//
-//    void RTCC_Initialize(void);
-//    /**
-//        void DRV_RTCC_Initialize(void)
-//     */
-//    void DRV_RTCC_Initialize(void) __attribute__((deprecated("\nThis will be removed in future MCC releases. \nUse RTCC_Initialize instead. ")));
-//
-//    /**
-//      @Summary
-//        Returns the current time from the RTCC peripheral
-//
-//      @Description
-//        This function returns the current time from the RTCC peripheral. This
-//        function uses the C library type struct tm parameter.
-//
-//      @Preconditions
-//        None
-//
-//      @Param
-//        currentTime - This the parameter which gets filled in by the function. The
-//        values are set by reading the hardware peripheral
-//
-//      @Returns
-//        Whether the data is available or not, true if the data is available.
-//        false if the data is not available.
-//
-//      @Example
-//        Refer to the example for the function RTCC_Initialize
-//     */
-//
-//    bool RTCC_TimeGet(struct tm * currentTime);
-//    /**
-//        bool DRV_RTCC_TimeGet(struct tm * currentTime)
-//     */
-//    bool DRV_RTCC_TimeGet(struct tm * currentTime) __attribute__((deprecated("\nThis will be removed in future MCC releases. \nUse RTCC_TimeGet instead. ")));
-//
-//
-//    /**
-//      @Summary
-//        Sets the initial time for the RTCC peripheral
-//
-//      @Description
-//        This function sets the initial time for the RTCC peripheral. This
-//        function uses the C library type struct tm parameter.
-//
-//      @Preconditions
-//        None
-//
-//      @Param
-//        initialTime - This parameter sets the values.
-//
-//      @Returns
-//        None
-//
-//      @Example
-//        Refer to the example for the function RTCC_Initialize
-//     */
-//
-//    void RTCC_TimeSet(struct tm * initialTime);
-//
-//#ifdef __cplusplus  // Provide C++ Compatibility
-//
-//}
-//
-//#endif
-//
-//#endif // _RTCC_H
-//
-///**
-// End of File
-// */
+/**
+  RTCC Generated Driver API Header File
+
+  Company:
+    Microchip Technology Inc.
+
+  File Name:
+    rtcc.h
+
+  @Summary
+    This is the generated header file for the RTCC driver using MPLAB Code Configurator
+
+  @Description
+    This header file provides APIs for driver for RTCC.
+    Generation Information :
+        Product Revision  :  MPLAB Code Configurator - v2.25.2
+        Device            :  PIC24F32KA302
+        Driver Version    :  0.5
+    The generated drivers are tested against the following:
+        Compiler          :  XC16 v1.24
+        MPLAB 	          :  MPLAB X v2.35 or v3.00
+ */
+
+/*
+Copyright (c) 2013 - 2015 released Microchip Technology Inc.  All rights reserved.
+
+Microchip licenses to you the right to use, modify, copy and distribute
+Software only when embedded on a Microchip microcontroller or digital signal
+controller that is integrated into your product or third party product
+(pursuant to the sublicense terms in the accompanying license agreement).
+
+You should refer to the license agreement accompanying this Software for
+additional information regarding your rights and obligations.
+
+SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY WARRANTY OF
+MERCHANTABILITY, TITLE, NON-INFRINGEMENT AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL MICROCHIP OR ITS LICENSORS BE LIABLE OR OBLIGATED UNDER
+CONTRACT, NEGLIGENCE, STRICT LIABILITY, CONTRIBUTION, BREACH OF WARRANTY, OR
+OTHER LEGAL EQUITABLE THEORY ANY DIRECT OR INDIRECT DAMAGES OR EXPENSES
+INCLUDING BUT NOT LIMITED TO ANY INCIDENTAL, SPECIAL, INDIRECT, PUNITIVE OR
+CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, COST OF PROCUREMENT OF
+SUBSTITUTE GOODS, TECHNOLOGY, SERVICES, OR ANY CLAIMS BY THIRD PARTIES
+(INCLUDING BUT NOT LIMITED TO ANY DEFENSE THEREOF), OR OTHER SIMILAR COSTS.
+ */
+
+#ifndef _RTCC_H
+#define _RTCC_H
+
+
+/**
+ Section: Included Files
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "I2C_Functions.h"
+
+#ifdef __cplusplus  // Provide C++ Compatibility
+
+extern "C" {
+
+#endif
+
+    /**
+     Section: Interface Routines
+     */
+
+    /**
+      @Summary
+        Initializes and enables RTCC peripheral
+
+      @Description
+        This function enables the RTCC off the SOSC and sets the alarm
+        to chime at the top of every hour. The time is loaded separately
+        with RTCC_TimeSet.
+
+      @Preconditions
+        None
+
+      @Param
+        None
+
+      @Returns
+        None
+
+      @Example
+        <code>
+        time_s currentTime;
+
+        RTCC_Initialize();
+        RTCC_TimeSet(&bootTime);
+
+        while(!RTCC_TimeGet(&currentTime))
+        {
+            // Do something
+        }
+        </code>
+     */
+
+    void RTCC_Initialize(void);
+    /**
+        void DRV_RTCC_Initialize(void)
+     */
+    void DRV_RTCC_Initialize(void) __attribute__((deprecated("\nThis will be removed in future MCC releases. \nUse RTCC_Initialize instead. ")));
+
+    /**
+      @Summary
+        Returns the current time from the RTCC peripheral
+
+      @Description
+        This function returns the current time from the RTCC peripheral, in
+        decimal.
+
+      @Preconditions
+        None
+
+      @Param
+        currentTime - This the parameter which gets filled in by the function. The
+        values are set by reading the hardware peripheral
+
+      @Returns
+        Whether the data is available or not, true if the data is available.
+        false if the data is not available (the RTCC is about to roll over).
+
+      @Example
+        Refer to the example for the function RTCC_Initialize
+     */
+
+    bool RTCC_TimeGet(time_s * currentTime);
+    /**
+        bool DRV_RTCC_TimeGet(time_s * currentTime)
+     */
+    bool DRV_RTCC_TimeGet(time_s * currentTime) __attribute__((deprecated("\nThis will be removed in future MCC releases. \nUse RTCC_TimeGet instead. ")));
+
+
+    /**
+      @Summary
+        Sets the initial time for the RTCC peripheral
+
+      @Description
+        This function sets the time of the RTCC peripheral from a decimal
+        time_s.
+
+      @Preconditions
+        None
+
+      @Param
+        initialTime - This parameter sets the values.
+
+      @Returns
+        None
+
+      @Example
+        Refer to the example for the function RTCC_Initialize
+     */
+
+    void RTCC_TimeSet(time_s * initialTime);
+
+#ifdef __cplusplus  // Provide C++ Compatibility
+
+}
+
+#endif
+
+#endif // _RTCC_H
+
+/**
+ End of File
+ */
@@ -0,0 +1,306 @@
+/*
+ * File:   timer_service.c
+ */
+
+
+#include "xc.h"
+#include "timer_service.h"
+#include "tmr1.h"
+
+/*
+ Software timers on Timer1, clocked from the 31kHz LPRC so it keeps running
+ in Sleep. Rather than ticking at a fixed rate, PR1 is set for the soonest
+ deadline, so Timer1 only interrupts when a timer is due (or every
+ TIMER_MAX_PERIOD_MS with nothing scheduled). Pending timers are kept in a
+ list sorted by deadline.
+
+ The list and the timebase are shared by the main loop, the Timer1 ISR and
+ the other ISRs, which schedule and cancel timers of their own (CN, ADC and
+ MI2C1). Turning T1IE off would only keep Timer1 out, so every change to
+ the list is made at IPL 7, as WaitForEvent does, and the old IPL is put
+ back after. ISRs don't nest, so from an ISR it only adds a few cycles.
+ */
+
+static soft_timer *timerList = NULL; // Soonest deadline first
+static uint32_t baseMS = 0; // Time when Timer1 last started from 0
+static uint16_t tickPeriodMS = TIMER_MAX_PERIOD_MS; // Time PR1 is set for
+
+/**
+ * Description: Holds off every interrupt while the list is changed.
+ * @return uint8_t the IPL to hand back to UnlockTimers
+ */
+static uint8_t LockTimers(void)
+{
+    uint8_t savedIPL = SRbits.IPL;
+
+    SRbits.IPL = 7;
+    return savedIPL;
+}
+
+/**
+ * Description: Lets interrupts back in at the IPL from before LockTimers.
+ * @param savedIPL: What LockTimers returned
+ */
+static void UnlockTimers(uint8_t savedIPL)
+{
+    SRbits.IPL = savedIPL;
+}
+
+/**
+ * Description: Compares two deadlines, correct across the uint32_t wrap.
+ * @return bool true if a is before b
+ */
+static bool IsBefore(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/**
+ * Description: Current time, including what Timer1 has counted since
+ *      baseMS. Interrupts must be locked out.
+ */
+static uint32_t CurrentTimeMS(void)
+{
+    uint32_t nowMS = baseMS + TMR1_Counter16BitGet() / TMR1_TICKS_PER_MS;
+
+    if (IFS0bits.T1IF)
+    {
+        // The period ended and Timer1 restarted, but the ISR hasn't run
+        nowMS += tickPeriodMS;
+    }
+
+    return nowMS;
+}
+
+/**
+ * Description: Puts a timer in the list after any with the same deadline.
+ *      Interrupts must be locked out.
+ */
+static void InsertTimer(soft_timer *timer)
+{
+    soft_timer **linkP = &timerList;
+
+    while (*linkP != NULL && !IsBefore(timer->deadlineMS, (*linkP)->deadlineMS))
+    {
+        linkP = &(*linkP)->next;
+    }
+
+    timer->next = *linkP;
+    *linkP = timer;
+    timer->isScheduled = true;
+}
+
+/**
+ * Description: Takes a timer out of the list. Interrupts must be locked out.
+ */
+static void RemoveTimer(soft_timer *timer)
+{
+    soft_timer **linkP = &timerList;
+
+    while (*linkP != NULL)
+    {
+        if (*linkP == timer)
+        {
+            *linkP = timer->next;
+            break;
+        }
+        linkP = &(*linkP)->next;
+    }
+
+    timer->isScheduled = false;
+}
+
+/**
+ * Description: Sets PR1 for the soonest deadline. The whole ms Timer1 has
+ *      counted so far move into baseMS, and the part of a ms left over stays
+ *      in the counter so nothing is lost. Interrupts must be locked out.
+ */
+static void ProgramNextDeadline(void)
+{
+    uint16_t delayMS = TIMER_MAX_PERIOD_MS;
+
+    if (IFS0bits.T1IF)
+    {
+        // Finished a period the ISR hasn't seen, anything due in it is
+        //  picked up a ms from now
+        IFS0bits.T1IF = false;
+        baseMS += tickPeriodMS;
+    }
+
+    uint16_t elapsedTicks = TMR1_Counter16BitGet();
+    uint16_t elapsedMS = elapsedTicks / TMR1_TICKS_PER_MS;
+    baseMS += elapsedMS;
+
+    if (timerList != NULL)
+    {
+        int32_t untilMS = (int32_t)(timerList->deadlineMS - baseMS);
+
+        if (untilMS < 1)
+        {
+            delayMS = 1;
+        }
+        else if (untilMS < TIMER_MAX_PERIOD_MS)
+        {
+            delayMS = untilMS;
+        }
+    }
+
+    // The counter resets on the tick after it matches PR1
+    tickPeriodMS = delayMS;
+    TMR1_Period16BitSet(delayMS * TMR1_TICKS_PER_MS - 1);
+    TMR1_Counter16BitSet(elapsedTicks - elapsedMS * TMR1_TICKS_PER_MS);
+}
+
+/**
+ * Description: Starts Timer1 with nothing scheduled. Call before any timer
+ *      is scheduled, a timer that was is dropped and marked as not
+ *      scheduled, so its owner can schedule it again.
+ */
+void InitTimerService(void)
+{
+    uint8_t savedIPL = LockTimers();
+    soft_timer *timer;
+
+    for (timer = timerList; timer != NULL; timer = timer->next)
+    {
+        timer->isScheduled = false;
+    }
+    timerList = NULL;
+    baseMS = 0;
+    tickPeriodMS = TIMER_MAX_PERIOD_MS;
+
+    TMR1_Period16BitSet(TIMER_MAX_PERIOD_MS * TMR1_TICKS_PER_MS - 1);
+    TMR1_Counter16BitSet(0);
+    IFS0bits.T1IF = false;
+    TMR1_Start();
+
+    UnlockTimers(savedIPL);
+}
+
+/**
+ * Description: Time since InitTimerService, to the ms. Wraps after 49 days.
+ * @return uint32_t time in ms
+ */
+uint32_t GetTimeMS(void)
+{
+    uint8_t savedIPL = LockTimers();
+
+    uint32_t nowMS = CurrentTimeMS();
+
+    UnlockTimers(savedIPL);
+    return nowMS;
+}
+
+/**
+ * Description: Schedules a one shot timer, moving it if it was already
+ *      scheduled. A deadline that has passed goes off within a ms.
+ * @param timer: Timer to schedule
+ * @param deadlineMS: GetTimeMS value to go off at
+ * @param callback: Called from the Timer1 ISR at the deadline
+ */
+void ScheduleTimerAt(soft_timer *timer, uint32_t deadlineMS,
+        void (*callback)(void))
+{
+    uint8_t savedIPL = LockTimers();
+
+    if (timer->isScheduled)
+    {
+        RemoveTimer(timer);
+    }
+
+    timer->deadlineMS = deadlineMS;
+    timer->periodMS = 0;
+    timer->callback = callback;
+    InsertTimer(timer);
+
+    if (timerList == timer)
+    {
+        // New soonest deadline
+        ProgramNextDeadline();
+    }
+
+    UnlockTimers(savedIPL);
+}
+
+/**
+ * Description: Schedules a timer to go off every periodMS, the first time
+ *      periodMS from now. Deadlines are kept in step with the first one.
+ * @param timer: Timer to schedule
+ * @param periodMS: Time between calls, in ms
+ * @param callback: Called from the Timer1 ISR each period
+ */
+void ScheduleTimerEvery(soft_timer *timer, uint32_t periodMS,
+        void (*callback)(void))
+{
+    uint8_t savedIPL = LockTimers();
+
+    if (timer->isScheduled)
+    {
+        RemoveTimer(timer);
+    }
+
+    timer->deadlineMS = CurrentTimeMS() + periodMS;
+    timer->periodMS = periodMS;
+    timer->callback = callback;
+    InsertTimer(timer);
+
+    if (timerList == timer)
+    {
+        ProgramNextDeadline();
+    }
+
+    UnlockTimers(savedIPL);
+}
+
+/**
+ * Description: Stops a timer. Does nothing if it wasn't scheduled.
+ * @param timer: Timer to stop
+ */
+void CancelTimer(soft_timer *timer)
+{
+    uint8_t savedIPL = LockTimers();
+
+    if (timer->isScheduled)
+    {
+        // Timer1 may still wake for its deadline, it just finds nothing due
+        RemoveTimer(timer);
+    }
+
+    UnlockTimers(savedIPL);
+}
+
+/**
+ * Description: Called from the Timer1 ISR at the end of each period. Runs
+ *      every timer that is due, reschedules the periodic ones and sets PR1
+ *      for the next deadline.
+ */
+void TimerServiceTick(void)
+{
+    // Count the period here, so ProgramNextDeadline doesn't count it again
+    IFS0bits.T1IF = false;
+    baseMS += tickPeriodMS;
+
+    while (timerList != NULL && !IsBefore(baseMS, timerList->deadlineMS))
+    {
+        soft_timer *timer = timerList;
+
+        timerList = timer->next;
+        timer->isScheduled = false;
+
+        if (timer->periodMS != 0)
+        {
+            timer->deadlineMS += timer->periodMS;
+            if (!IsBefore(baseMS, timer->deadlineMS))
+            {
+                // Fell more than a period behind, skip what was missed
+                timer->deadlineMS = baseMS + timer->periodMS;
+            }
+            InsertTimer(timer);
+        }
+
+        // The callback may schedule timers, including this one
+        timer->callback();
+    }
+
+    ProgramNextDeadline();
+}
@@ -0,0 +1,47 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef TIMER_SERVICE_H
+#define	TIMER_SERVICE_H
+
+#include <xc.h> // include processor files - each processor file is guarded.  
+#include <stdbool.h>
+#include <stdint.h>
+#include "constants.h"
+
+#define TIMER_MAX_PERIOD_MS     2000 // Longest Timer1 can sleep, PR1 is 16 bit
+
+typedef struct soft_timer soft_timer;
+
+/*
+ A software timer on the Timer1 timebase. The caller owns the struct, and
+ the callback runs in the Timer1 ISR once the deadline has passed.
+ */
+struct soft_timer {
+    uint32_t deadlineMS;
+    uint32_t periodMS; // 0 for a one shot
+    void (*callback)(void);
+    soft_timer *next; // Next deadline, service only
+    bool isScheduled;
+};
+
+void InitTimerService(void);
+uint32_t GetTimeMS(void);
+void ScheduleTimerAt(soft_timer *timer, uint32_t deadlineMS,
+        void (*callback)(void));
+void ScheduleTimerEvery(soft_timer *timer, uint32_t periodMS,
+        void (*callback)(void));
+void CancelTimer(soft_timer *timer);
+void TimerServiceTick(void);
+
+#ifdef	__cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    // TODO If C++ is being used, regular C code needs function names to have C 
+    // linkage so the functions can be used by the c code. 
+
+#ifdef	__cplusplus
+}
+#endif /* __cplusplus */
+
+#endif	/* XC_HEADER_TEMPLATE_H */
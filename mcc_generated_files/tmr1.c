@@ -109,6 +109,7 @@ void DRV_TMR1_Initialize(void) {
 
 void __attribute__((interrupt, no_auto_psv)) _T1Interrupt() {
     /* Check if the Timer Interrupt/Status is set */
+    uint16_t startTicks = TMR5_Counter16BitGet();
 
     //***User Area Begin
 
@@ -121,6 +122,8 @@ void __attribute__((interrupt, no_auto_psv)) _T1Interrupt() {
     tmr1_obj.count++;
     tmr1_obj.timerElapsed = true;
     IFS0bits.T1IF = false;
+
+    RecordISRTime(ISR_TIMER1, startTicks);
 }
 
 void TMR1_Period16BitSet(uint16_t value) {
@@ -175,7 +178,7 @@ uint16_t DRV_TMR1_Counter16BitGet(void) {
 
 void TMR1_CallBack(void) {
     // Add your custom callback code here
-    Timer1Handler();
+    TimerServiceTick();
 }
 
 void TMR1_Start(void) {
@@ -85,12 +85,12 @@ static TMR_OBJ tmr2_obj;
 
 
 void TMR2_Initialize(void) {
-    //TSIDL disabled; TGATE disabled; TCS FOSC/2; TCKPS 1:8; T32 disabled; TON disabled; 
-    T2CON = 0x0010;
+    //TSIDL disabled; TGATE disabled; TCS T2CK; TCKPS 1:1; T32 disabled; TON disabled; 
+    T2CON = 0x0002;
     //TMR2 0; 
     TMR2 = 0x0000;
-    //Period Value = 262.136 ms; PR2 65534; 
-    PR2 = 0xFFFE;
+    //Counts WPS edges, PR2 65535; 
+    PR2 = 0xFFFF;
 
 
     tmr2_obj.timerElapsed = false;
@@ -89,8 +89,8 @@ void TMR3_Initialize(void) {
     T3CON = 0x8030;
     //TMR3 0; 
     TMR3 = 0x0000;
-    //Period Value = 8.388 s; PR3 65534; 
-    PR3 = 0xFFFE;
+    //Period Value = 8.388 s; PR3 65535; Free running for netlight timestamps
+    PR3 = 0xFFFF;
 
 
     tmr3_obj.timerElapsed = false;
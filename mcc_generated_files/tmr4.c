@@ -87,15 +87,16 @@ static TMR_OBJ tmr4_obj;
 
 
 void TMR4_Initialize(void) {
-    //TSIDL disabled; TGATE disabled; TCS T4CK; TCKPS 1:64; T32 disabled; TON enabled; 
-    T4CON = 0x8022;
+    // Battery reads moved to the timer service, Timer4 is free
+    //TSIDL disabled; TGATE disabled; TCS T4CK; TCKPS 1:64; T32 disabled; TON disabled; 
+    T4CON = 0x0022;
     //TMR4 0; 
     TMR4 = 0x0000;
     //Period Value = 1800.000 s; PR4 28125; 
     PR4 = 0x6DDD;
 
     IFS1bits.T4IF = false;
-    IEC1bits.T4IE = true;
+    IEC1bits.T4IE = false;
 
     tmr4_obj.timerElapsed = false;
 
@@ -176,7 +177,6 @@ uint16_t DRV_TMR4_Counter16BitGet(void) {
 
 void TMR4_CallBack(void) {
     // Add your custom callback code here
-    Timer4Handler();
 }
 
 void TMR4_Start(void) {
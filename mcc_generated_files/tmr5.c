@@ -86,15 +86,16 @@ static TMR_OBJ tmr5_obj;
 
 
 void TMR5_Initialize(void) {
-    //TSIDL disabled; TGATE disabled; TCS FOSC/2; TCKPS 1:256; TON enabled; 
-    T5CON = 0x8030;
+    // Free running, ISR durations are timed off it in 0.5us ticks
+    //TSIDL disabled; TGATE disabled; TCS FOSC/2; TCKPS 1:1; TON enabled; 
+    T5CON = 0x8000;
     //TMR5 0; 
     TMR5 = 0x0000;
-    //Period Value = 999.936 ms; PR5 7812; 
-    PR5 = 0x1E84;
+    //Period Value = 32.768 ms; PR5 65535; 
+    PR5 = 0xFFFF;
 
     IFS1bits.T5IF = false;
-    IEC1bits.T5IE = true;
+    IEC1bits.T5IE = false;
 
     tmr5_obj.timerElapsed = false;
 
@@ -175,7 +176,6 @@ uint16_t DRV_TMR5_Counter16BitGet(void) {
 
 void TMR5_CallBack(void) {
     // Add your custom callback code here
-    Timer5Handler();
 }
 
 void TMR5_Start(void) {
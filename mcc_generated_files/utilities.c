@@ -7,109 +7,14 @@
 
 
 #include "xc.h"
-#include "math.h"
 #include "string.h"
 #include "utilities.h"
+#include "clock.h"
+#include "timer_service.h"
+#include "tmr5.h"
 
-#define FCY         4000000UL // Instruction cycle frequency
 #include <libpic30.h>
 
-char TextMessageString[MESSAGE_LENGTH] = {
-    '(', '"', 't', '"', ':', '"', 'd', '"', ',', '"', 'd', '"', ':', '(', '"',
-    'l', '"', ':',
-    '0', // Leakage
-    '0',
-    '0',
-    '.',
-    '0',
-    ',', '"', 'p', '"', ':',
-    '0', // Longest Prime
-    '0',
-    '.',
-    '0',
-    '0',
-    ',', '"', 'b', '"', ':', 
-    '0', // Battery Voltage
-    '.',
-    '0',
-    '0',
-    '0',
-    ',', '"', 'v', '"', ':',
-    0x3C, // '<' sign 
-    '0', // Volume 1
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 2
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 3
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 4
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 5
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 6
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 7
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 8
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 9
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 10
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 11
-    '0',
-    '0',
-    '.',
-    '0',
-    ',',
-    '0', // Volume 12
-    '0',
-    '0',
-    '.',
-    '0',
-    '>', ')', ')'
-};
-
 char phoneNumber[] = "+13018737202"; //"+17178211882";
 
 bool isBatteryLow = false;
@@ -117,9 +22,18 @@ bool isBatteryLow = false;
 uint32_t batteryAccumulator = 0;
 uint16_t batteryAccumAmt = 0;
 
-float volumeArray[12] = { 0 };
-float fastestLeakRate = 0;
-float longestPrime = 0;
+uint32_t volumeArray[12] = { 0 };
+uint32_t fastestLeakRate = 0;
+uint32_t longestPrime = 0;
+// Fraction of a mL (Q16) not yet added to a volume bin
+static uint16_t volumeFraction = 0;
+// mL (Q16) leaked over one sample period at the fastest leak rate
+static uint32_t leakPerSample = 0;
+
+uint32_t fastRateMS = 0;
+uint32_t idleRateMS = 0;
+
+uint16_t atan2WorstTicks = 0;
 
 /**
  * Description: Delays the processor by the specified number of microseconds.
@@ -127,7 +41,15 @@ float longestPrime = 0;
  */
 void DelayUS(int us)
 {
-    __delay_us(us);
+    // FCY changes with the clock mode, so the cycles are counted at runtime
+    uint32_t cycles = (uint32_t)us * (GetFCY() / 1000) / 1000;
+    
+    // __delay32 can't do less than 12
+    if(cycles < 12)
+    {
+        cycles = 12;
+    }
+    __delay32(cycles);
 }
 
 /**
@@ -138,7 +60,12 @@ void DelayUS(int us)
 void DelayMS(int ms)
 {
     KickWatchdog();
-    __delay_ms(ms);
+    if(ms > 0)
+    {
+        // FCY changes with the clock mode, so the cycles are counted at
+        //  runtime
+        __delay32((uint32_t)ms * (GetFCY() / 1000));
+    }
 }
 
 /**
@@ -169,184 +96,164 @@ void KickWatchdog(void)
  *                  angle.
  * @param xAxis: 12 bit ADC value from xAxis
  * @param yAxis: 12 bit ADC value from yAxis
- * @return float indicating current handle angle.
+ * @return int16_t current handle angle in hundredths of a degree.
  * 
  * Note: Angle Limits are 20 and -30 degrees, because those are approximate pump limits.
  */
-float GetHandleAngle(uint16_t xAxis, uint16_t yAxis)
+int16_t GetHandleAngle(uint16_t xAxis, uint16_t yAxis)
 {
     signed int xValue = xAxis - c_AdjustmentFactor;
     signed int yValue = yAxis - c_AdjustmentFactor;
     
-    float angle = atan2(yValue, xValue) * c_RadToDegrees;
+    uint16_t startTicks = TMR5_Counter16BitGet();
+    int16_t angle = Atan2Centidegrees(yValue, xValue);
+    uint16_t ticks = TMR5_Counter16BitGet() - startTicks;
     
-    if (angle > 20)
+    if (ticks > atan2WorstTicks)
     {
-        angle = 20;
+        atan2WorstTicks = ticks;
     }
-    else if (angle < -30)
+    
+    if (angle > 2000)
     {
-        angle = -30;
+        angle = 2000;
+    }
+    else if (angle < -3000)
+    {
+        angle = -3000;
     }
     
     return angle;
 }
 
 /**
- * Description: Takes volume accumulator bins and pushes them as ASCII to the
- *                  text message.
- * 
- * Note: Format of each volume element is XXX.X Liters
+ * Description: Integer atan2. The vector is folded into the first octant, where
+ *                  y/x is looked up in c_AtanTable with linear interpolation,
+ *                  then unfolded back to its quadrant. Error is within two
+ *                  hundredth of a degree for 12 bit ADC deltas.
+ * @param y: Signed y component (at most 12 bits of magnitude)
+ * @param x: Signed x component (at most 12 bits of magnitude)
+ * @return int16_t angle of the vector in hundredths of a degree, -18000 to 18000
  */
-void UpdateMessageVolume(void)
+int16_t Atan2Centidegrees(int16_t y, int16_t x)
 {
-    // 49 is the starting location for volume 1
-    int i, loc = 49;
+    uint16_t absX = (x < 0) ? -x : x;
+    uint16_t absY = (y < 0) ? -y : y;
+    uint16_t num, den;
+    bool isSwapped = absY > absX;
     
-    for(i = 0; i < 12; i++)
+    if (absX == 0 && absY == 0)
     {
-        // Do the i-th element of the volume array
-        FloatToAscii(volumeArray[i], 1, &(TextMessageString[loc]), 5);
-        // increment our location in the volume array to the next value
-        loc += 6;
+        return 0; // Same as atan2(0, 0)
     }
-}
-
-/**
- * Description: Takes the total battery voltage accumulated throughout the day,
- *                  and converts it to ASCII in the text message array.
- */
-void UpdateMessageBattery(void)
-{
-    float avgBatVoltage = 0;
-    if(batteryAccumAmt != 0)
+    
+    // Always divide the smaller by the larger so the ratio is 0 to 1
+    if (isSwapped)
     {
-        // Get the average battery voltage
-        //  throughout the day
-        avgBatVoltage = batteryAccumulator / 
-                batteryAccumAmt;
+        num = absX;
+        den = absY;
+    }
+    else
+    {
+        num = absY;
+        den = absX;
     }
     
-    float avgBat = TurnBattADCToFloat(avgBatVoltage);
+    // Ratio in Q14, 0 to 16384
+    uint16_t ratio = __builtin_divud((uint32_t)num << 14, den);
+    // Top bits pick the table segment, the low 8 bits interpolate in it
+    uint8_t index = ratio >> 8;
+    uint16_t frac = ratio & 0xFF;
+    int16_t angle = c_AtanTable[index];
     
-    // Update the text message
-    //  38 is the first position of battery voltage
-    FloatToAscii(avgBat, 3, &(TextMessageString[38]), 5);
+    if (frac != 0)
+    {
+        angle += ((c_AtanTable[index + 1] - c_AtanTable[index]) * frac) >> 8;
+    }
+    
+    if (isSwapped)
+    {
+        angle = 9000 - angle;
+    }
+    if (x < 0)
+    {
+        angle = 18000 - angle;
+    }
+    if (y < 0)
+    {
+        angle = -angle;
+    }
+    
+    return angle;
 }
 
 /**
- * Description: Turns a raw battery ADC value to a floating point.
+ * Description: Turns a raw battery ADC value to millivolts.
  * @param avgBatVoltage: Raw ADC value to convert
- * @return float representation of that battery voltage.
+ * @return uint32_t battery voltage in millivolts.
  */
-float TurnBattADCToFloat(uint32_t avgBatVoltage)
+uint32_t TurnBattADCToMillivolts(uint32_t avgBatVoltage)
 {
-    return avgBatVoltage * c_BattADCToFloat;
+    return (avgBatVoltage * c_BattADCToMillivolts) >> 16;
 }
 
 /**
- * Description: Takes the longest prime global value and pushes it to the text
- *                  message as an ASCII representation
- */
-void UpdateMessagePrime(void)
-{
-    // Update the text message
-    //  28 is the first digit of the prime in text message
-    FloatToAscii(longestPrime, 1, &(TextMessageString[28]), 5); // Assumes priming is always less than 1000
-}
-
-/**
- * Description: Takes the fastest leak rate in L/s and pushes it to the text
- *                  message as an ASCII representation of L/hr
+ * Description: Converts an unsigned integer to zero padded ASCII. Values too
+ *                  big for the field are written as all 9's.
+ * @param value: Integer value to convert
+ * @param dataPtr: char pointer to put the data
+ * @param dataLen: Number of digits to write
  */
-void UpdateMessageLeakage(void)
+void UintToAscii(uint32_t value, char *dataPtr, uint8_t dataLen)
 {
-    // Update the text message
-    //  18 is the first position of the leakage in text message
-    //  3600 multiplier converts from L/sec to L/Hr
-    FloatToAscii((fastestLeakRate * 3600), 1, &(TextMessageString[18]), 5);
+    if(value >= TenToPower(dataLen))
+    {
+        value = TenToPower(dataLen) - 1;
+    }
+    
+    int i;
+    for(i = dataLen - 1; i >= 0; i--)
+    {
+        dataPtr[i] = (char)((value % 10) + '0');
+        value /= 10;
+    }
 }
 
 /**
- * Description: Converts a floating point value to ASCII
- * @param value: Float value to convert
+ * Description: Converts a fixed point value to zero padded ASCII with a
+ *                  decimal point. If the whole part doesn't fit, decimal
+ *                  places are dropped to make room.
+ * @param value: Value scaled by 10^decimalPrecision
  * @param decimalPrecision: Number of digits after the decimal point
  * @param dataPtr: char pointer to put the data
  * @param dataLen: Total length of the data (including the decimal pt)
  * 
- * Example: Value x = 100.10, call FtoA(x, 2, ptr, 6);
+ * Example: Value x = 100.10, call FixedToAscii(10010, 2, ptr, 6);
  */
-void FloatToAscii(float value, uint8_t decimalPrecision,
+void FixedToAscii(uint32_t value, uint8_t decimalPrecision,
         char *dataPtr, uint8_t dataLen)
 {
-    // multiply value by 10^precision, then load into 32 bit int
-    uint32_t endValue;
-    
-    // This is int with correct decimal precision
-    endValue = (uint32_t)(value * TenToPower(decimalPrecision));
-    int nDigits = NumDigits(endValue);
-    
-    char *pD = dataPtr;
-    
-    while(IsBinTooSmall(value, decimalPrecision, dataLen))
+    // Give up decimal places until the whole part fits
+    while((decimalPrecision > 0) && (value >= TenToPower(dataLen - 1)))
     {
+        value /= 10;
         decimalPrecision--;
     }
     
-    while(IsNumberTooBig(endValue, dataLen))
+    if(decimalPrecision == 0)
     {
-        // If number is too big, put a zero in front
-        *pD = '0';
-        // move ptr
-        pD++;
-        // Reduce dataLen to compensate
-        dataLen--;
+        // No decimal point, so every position is a digit
+        UintToAscii(value, dataPtr, dataLen);
     }
-    
-    int i;
-    for (i = 0; i < dataLen; i++)
+    else
     {
-        if(i + 1 == (dataLen - decimalPrecision))
-            *pD = '.'; // This is the decimal point
-        else
-        {
-            uint32_t diviser = TenToPower(nDigits - (i + 1));
-            //uint32_t diviser = TenToPower(nDigits - 1);
-            int singleDigitVal = endValue / diviser;
-            // We'll need this for the next iteration
-            endValue %= diviser;
-            
-            // Get the value of the digit
-            *pD = (char)(singleDigitVal + 48);
-        }
-        
-        // We always have to increment the pointer
-        pD++;
+        uint8_t pointLoc = dataLen - (decimalPrecision + 1);
+        uint32_t diviser = TenToPower(decimalPrecision);
         
+        UintToAscii(value / diviser, dataPtr, pointLoc);
+        dataPtr[pointLoc] = '.'; // This is the decimal point
+        UintToAscii(value % diviser, &(dataPtr[pointLoc + 1]), decimalPrecision);
     }
-    
-}
-
-/**
- * Description: Returns the number of digits in the specified 32 bit integer
- * @param num: 32 bit integer
- * @return int number of digits
- */
-int NumDigits(uint32_t num)
-{
-    if (num < 0) return 1;
-    if (num < 10) return 1;
-    if (num < 100) return 2;
-    if (num < 1000) return 3;
-    if (num < 10000) return 4;
-    if (num < 100000) return 5;
-    if (num < 1000000) return 6;
-    if (num < 10000000) return 7;
-    if (num < 100000000) return 8;
-    if (num < 1000000000) return 9;
-    
-    // If we are above 9 digits (32 bit uints go to 4,294,967,295)
-    return 10;
 }
 
 /**
@@ -366,58 +273,6 @@ uint32_t TenToPower(int exponent)
     return val;
 }
 
-/**
- * Description: Checks if value is too small to fit into dataLen bytes
- * @param value: Value to check
- * @param dataLen: Length of bytes that value must fit in
- * @return bool indicating whether it fits or not.
- */
-bool IsNumberTooBig(uint32_t value, uint8_t dataLen)
-{
-    // if value < 10^(dataLen-2): we're checking if value won't fit
-    //  within the bounds of dataLen.
-    // Example: 12.2345 w/ prec 2 dataLen 6 will hand this function
-    //  122345. We have 6 locations and 2 decimal precision, so without
-    //  padding 0's on the front, we would return 122.34 from floatToAscii.
-    // This function helps floatToAscii by telling it that we need to pad
-    //  a zero, and thus return 012.23 in our dataLen of 6.
-    // dataLen would be -1 logically
-    if(value < TenToPower(dataLen-1)) // Changed to -1 to follow logic 10/10/15 KK
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
-
-/**
- * Description: Checks if value is too high to fit into the specified bin w/ prec as spefieid
- * @param value: Value to check
- * @param prec: Desired decimal precision
- * @param len: Total length of the bin to put value in
- * @return boolean indicating whether the desired prec is possible.
- */
-bool IsBinTooSmall(float value, uint8_t prec, uint8_t len)
-{
-    // If value is greater than 10^(dataLen - prec+1 (+1 due to decimal point))
-    // , then we know
-    //  that the bin is too small (ie. we have to increase len or dec prec).
-    // This function helps floatToAscii by detecting a condition where
-    //  we need to reduce the precision to fit the desired float into the bin.
-    // Its important because we don't always know the order of magnitude of
-    //  the float that is passed to floatToAscii.
-    if(value > TenToPower(len - (prec + 1)))
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
-
 /**
  * Description: Checks if the SIM800 is on by its status light
  * @return boolean indicating whether the sim is on or not.
@@ -428,66 +283,24 @@ bool IsSimOn(void)
 }
 
 /**
- * Description: Checks if the SIM800 is reporting as connected to the network.
+ * Description: Checks if the SIM800 is reporting as connected to the network,
+ *                  from its netlight blink pattern.
  * @return boolean indicating whether it is connected or not.
  */
 bool IsSimOnNetwork(void)
 {
-    return isNetlightOn;
+    return (netState == NET_REGISTERED) || (netState == NET_GPRS);
 }
 
 /**
- * Description: Checks if the WPS is currently sensing water
+ * Description: Checks if the WPS is currently sensing water. This is the
+ *                  result of the last WPS measurement window, taken at
+ *                  waterCheckedMS, so it never waits on the WPS.
  * @return boolean indicating whether water is present or not.
  */
 bool IsThereWater(void)
 {
-    if(IsWPSIOCOn())
-    {
-        return isWaterPresent;
-    }
-    // If we do not have the interrupt on, we need to detect if there is
-    //  water.
-    else
-    {
-        // Set there is no water to clear false positive condition
-        isWaterPresent = false;
-        // turn on the interrupt
-        TurnOnWPSIOC();
-        // if water is on, the signal comes at 2kHz, so 1ms should catch
-        //  two pulses
-        DelayMS(1);
-        // There being water isn't sufficient, because the ~100Hz signal
-        //  could have possibly ticked during the 1ms that we were on.
-        // So we have to check again
-        if(IsThereWater())
-        {
-            // Clear the possible false positive
-            isWaterPresent = false;
-            // Again, if water is there it will tick in 1ms. If it is not,
-            //  then it can't have ticked in both this and prev test
-            DelayMS(1);
-            if(IsThereWater())
-            {
-                // If we found water, turn off IOC and return true
-                TurnOffWPSIOC();
-                return true;
-            }
-            else
-            {
-                TurnOffWPSIOC();
-                return false;
-            }
-        }
-        else
-        {
-            // If the first or second conditions were false, then we
-            //  will end up here eventually. Clean up by turning off
-            //  the WPS IOC and returning there was no water.
-            TurnOffWPSIOC();
-            return false;
-        }
-    }
+    return isWaterPresent;
 }
 
 //uint8_t SendUART1(char *dataPtr, uint16_t dataCnt)
@@ -544,188 +357,216 @@ bool IsThereWater(void)
 //    }
 //}
 
+// Diagnostic counters as they were at the last report
+static uint16_t reportedModemFailures = 0;
+static uint16_t reportedReportsLost = 0;
+static uint16_t reportedUARTErrors = 0;
+
 /**
- * Description: Turns on the SIM800 by cycling its pwrkey
+ * Description: Clamps an accumulator to what fits in a report.
+ * @param value: Value to clamp
+ * @return uint16_t the value, or 65535 if it is bigger
  */
-void TurnOnSim(void)
+static uint16_t ClampToReport(uint32_t value)
 {
-    simVioPin_SetHigh();
-    if (!IsSimOn())
+    return (value > 0xFFFF) ? 0xFFFF : (uint16_t)value;
+}
+
+/**
+ * Description: Fills a report from the accumulators, for the day that just
+ *                  ended.
+ * @param report: Report to fill
+ */
+void FillDailyReport(daily_report *report)
+{
+    uint32_t avgBatVoltage = 0;
+    int i;
+    
+    // The hourly alarm before midnight
+    report->year = PreviousTime.year;
+    report->month = PreviousTime.month;
+    report->day = PreviousTime.mnDay;
+    
+    // mL/hr / 100 is tenths of L/hr, mm / 100 is tenths of meters
+    report->leakRate = ClampToReport(fastestLeakRate / 100);
+    report->longestPrime = ClampToReport(longestPrime / 100);
+    
+    if(batteryAccumAmt != 0)
+    {
+        // Get the average battery voltage
+        //  throughout the day
+        avgBatVoltage = batteryAccumulator / 
+                batteryAccumAmt;
+    }
+    report->batteryMV = ClampToReport(TurnBattADCToMillivolts(avgBatVoltage));
+    
+    for(i = 0; i < 12; i++)
     {
-        // If sim isn't on, set pwrkey Low
-        simPwrKey_SetLow();
+        // mL / 100 is tenths of liters
+        report->volume[i] = ClampToReport(volumeArray[i] / 100);
     }
     
-    while(!IsSimOn()) 
+    report->fastMinutes = ClampToReport(fastRateMS / 60000);
+    report->idleMinutes = ClampToReport(idleRateMS / 60000);
+    report->modemSeconds = Modem_GetOnSeconds();
+    
+    // Counters that moved since the last report
+    uint16_t modemFailures = modemBootFailures + modemPowerFailures;
+    uint16_t uartErrors = rxOverrunCount + rxFramingErrorCount +
+            rxDroppedCount;
+    
+    report->diagnostics = 0;
+    if(isBatteryLow)
+    {
+        report->diagnostics |= REPORT_DIAG_BATTERY_LOW;
+    }
+    if(modemFailures != reportedModemFailures)
+    {
+        report->diagnostics |= REPORT_DIAG_MODEM_FAILED;
+    }
+    if(outboxReportsLost != reportedReportsLost)
+    {
+        report->diagnostics |= REPORT_DIAG_REPORT_LOST;
+    }
+    if(uartErrors != reportedUARTErrors)
     {
-        // Wait for the sim to come on
+        report->diagnostics |= REPORT_DIAG_UART_ERRORS;
     }
-    // Set PwrKey back to high
-    simPwrKey_SetHigh();
     
-    DelayMS(100); // wait for the SIM to be ready to go
+    reportedModemFailures = modemFailures;
+    reportedReportsLost = outboxReportsLost;
+    reportedUARTErrors = uartErrors;
 }
 
 /**
- * Description: Turns off the SIM800 by cycling its pwrkey
+ * Description: Puts the day's accumulators in the outbox and starts the next
+ *                  day. The outbox keeps the report in the data EEPROM until
+ *                  a text with it in has gone, so the accumulators can be
+ *                  reset whether or not the modem gets through.
  */
-void TurnOffSim(void)
+void SendMidnightMessage(void)
 {
-    if(IsSimOn())
+    daily_report report;
+    CLOCK_MODE savedMode = GetClockMode();
+    SetClockMode(CLOCK_FAST);
+    
+    FillDailyReport(&report);
+    SetClockMode(savedMode);
+    
+    Outbox_Add(&report);
+    
+    ResetAccumulators();
+}
+
+// The one command a text message needs, run by the AT engine once the modem
+//  is registered. Text mode is set up by the modem at boot.
+static char sendTextCommandString[32]; // AT+CMGS="<phone number>"
+static CLOCK_MODE textSavedMode = CLOCK_LOW;
+static bool isTextSending = false;
+static void TextModemReady(bool isRegistered);
+static void TextCommandDone(at_command *command);
+static at_command sendTextCommand = {
+    sendTextCommandString,
+    NULL, 0, // The message, set by SendTextMessage
+    AT_CMGS_TIMEOUT_MS,
+    TextCommandDone,
+    AT_OK, -1
+};
+
+/**
+ * Description: Writes the AT+CMGS="<number>" command that starts a text.
+ *                  Any NULL on the end of the number is left out.
+ * @param command: Where the command goes
+ * @param size: Size of command, the number is cut short to fit
+ * @param numPtr: Pointer to first byte of the phone number to send to
+ * @param numLen: Length of the phone number to send to
+ */
+void BuildTextCommand(char *command, uint8_t size, const char *numPtr,
+        int numLen)
+{
+    uint8_t loc = 0;
+    strcpy(command, "AT+CMGS=\"");
+    loc = strlen(command);
+    int i;
+    for(i = 0; i < numLen && numPtr[i] != '\0' && loc < size - 2; i++)
     {
-        // Assert pwrkey low to toggle
-        simPwrKey_SetLow();
+        command[loc++] = numPtr[i];
     }
-    while(IsSimOn()) 
-    {
-        // Wait for sim to turn off
-    } 
-    simPwrKey_SetHigh();
+    command[loc++] = '"';
+    command[loc] = '\0';
 }
 
 /**
- * Description: Assembles the midnight message array using accumulated values
+ * Description: Sends a text message via the SIM800. The modem is asked for
+ *                  and this returns, TextModemReady sends the message once
+ *                  the modem is on the network. The message and number must
+ *                  stay put until IsTextSending is false.
+ * @param msgPtr: Pointer to first byte of the message
+ * @param msgLen: Length of the message
+ * @param numPtr: Pointer to first byte of the phone number to send to
+ * @param numLen: Length of the phone number to send to
  */
-void AssembleMidnightMessage(void)
+void SendTextMessage(char *msgPtr, int msgLen, char *numPtr, int numLen)
 {
-    UpdateMessageVolume();
-    UpdateMessageBattery();
-    UpdateMessagePrime();
-    UpdateMessageLeakage();
+    if(isTextSending)
+    {
+        // The last one is still going
+        return;
+    }
+    
+    BuildTextCommand(sendTextCommandString, sizeof(sendTextCommandString),
+            numPtr, numLen);
+    
+    sendTextCommand.payload = msgPtr;
+    sendTextCommand.payloadLength = msgLen;
+    
+    isTextSending = Modem_Request(TextModemReady);
 }
 
 /**
- * Description: Checks if the SIM800 successfully sent a text message
- * @return boolean indicating whether the SIM800 was successful or not.
+ * Description: Modem callback for a text message. Sends it if the modem
+ *                  made it onto the network, otherwise it is dropped.
+ * @param isRegistered: Whether the modem is ours to use
  */
-bool DidMessageSend(void)
+static void TextModemReady(bool isRegistered)
 {
-//    char buf[8]; // Build an array to hold a response
-//    
-//    // If there is something in the array
-//    if(UART1_ReceiveBufferSizeGet() > 1)
-//    {
-//        uint8_t charsReceived = ReceiveUART1(buf, sizeof(buf));
-//
-//        if (charsReceived == 0)
-//        {
-//            // We didn't receive anything
-//            return false;
-//        }
-//        else
-//        {
-//            char *s;
-//            s = strstr(buf, "OK");
-//            if (s != NULL)
-//            {
-//                return true;
-//            }
-//            else
-//            {
-//                return false;
-//            }
-//        }
-//    }
-    
-    char recArray[10];
-    if(UART_Read(recArray, sizeof(recArray)) >= 1)
+    if(!isRegistered)
     {
-        char *s;
-        s = strstr(recArray, "OK");
-        if(s != NULL)
-        {
-            return true;
-        }
-        else
-        {
-            return false;
-        }
+        isTextSending = false;
+        return;
     }
-    // There is nothing in the receive buffer
-    else
+    
+    // Talking to the modem is done at full speed
+    textSavedMode = GetClockMode();
+    SetClockMode(CLOCK_FAST);
+    
+    if(!AT_SubmitCommand(&sendTextCommand))
     {
-        return false;
+        TextCommandDone(&sendTextCommand);
     }
-
 }
 
 /**
- * Description: Assembles neccesary accumulators into the char array in order
- *                  to send the midnight message
+ * Description: AT engine callback for AT+CMGS. The modem is handed back
+ *                  whether or not the message went, a failed one is dropped.
+ * @param command: The finished command
  */
-void SendMidnightMessage(void)
+static void TextCommandDone(at_command *command)
 {
-    // Update values in text message
-    AssembleMidnightMessage();
-
-    SendTextMessage(TextMessageString, sizeof(TextMessageString),
-                        phoneNumber, sizeof(phoneNumber));
-    
+    (void)command; // Only ever sendTextCommand, its status isn't needed
     
-    ResetAccumulators();
+    Modem_Release();
+    SetClockMode(textSavedMode);
+    isTextSending = false;
 }
 
 /**
- * Description: Sends a text message via the SIM800.
- * @param msgPtr: Pointer to first byte of the message
- * @param msgLen: Length of the message
- * @param numPtr: Pointer to first byte of the phone number to send to
- * @param numLen: Length of the phone number to send to
+ * Description: Whether a text message is still on its way out.
+ * @return bool true while the SIM is busy with one
  */
-void SendTextMessage(char *msgPtr, int msgLen, char *numPtr, int numLen)
+bool IsTextSending(void)
 {
-    TurnOnSim();
-    
-    int timeOutMS = 0;
-    while(!IsSimOnNetwork())
-    {
-        if(timeOutMS >= NETWORK_SEARCH_TIMEOUT_MS)
-        {
-            break;
-        }
-        
-        DelayMS(1);
-        timeOutMS++;
-    }
-    
-    // Enter text mode
-    UART_Write_Buffer("AT+CMGF=1\r\n", sizeof("AT+CMFG=1\r\n"));
-    // Give SIM time to switch
-    DelayMS(250);
-    // Tell it we're about to send a phone number
-    UART_Write_Buffer("AT+CMGS=\"", sizeof("AT+CMGS=\""));
-    // Send the phone number
-    UART_Write_Buffer(numPtr, numLen);
-    // Tell it the phone number is done
-    UART_Write_Buffer("\"\r\n", sizeof("\"\r\n"));
-    // Wait for it to be ready to send a text
-    DelayMS(250);
-    // Tell it what we want our text to say
-    UART_Write_Buffer(msgPtr, msgLen);
-    // Wait for it to finish receiving
-    DelayMS(250);
-    // Control character ending to text
-    UART_Write_Buffer("\x1A", sizeof("\x1A"));
-    
-    // Wait for either our text to send, or our timeout to be reached
-    DelayMS(5000);
-    bool suc = false;
-    int timeout = 0;
-    while((!suc) && (timeout < TEXT_SEND_TIMEOUT_SECONDS))
-    {
-        DelayS(1);
-        timeout++;
-        suc = DidMessageSend();
-        
-        if(suc)
-        {
-            TurnOffSim();
-        }   
-    }
-    
-    // Regardless of if it sends, we have to turn off
-    //  the SIM to conserve power.
-    TurnOffSim();
+    return isTextSending;
 }
 
 /**
@@ -734,46 +575,90 @@ void SendTextMessage(char *msgPtr, int msgLen, char *numPtr, int numLen)
 void ResetAccumulators(void)
 {
     memset(volumeArray, 0, sizeof(volumeArray));
+    volumeFraction = 0;
     fastestLeakRate = 0;
     longestPrime = 0;
     batteryAccumulator = 0;
     batteryAccumAmt = 0;
+    fastRateMS = 0;
+    idleRateMS = 0;
+    Modem_ResetOnTime();
+    UpdateLeakPerSample();
 }
 
-static float curAngle;
-static float prevAngle;
-static float primingUpstroke = 0;
+static int16_t curAngle;
+static int16_t prevAngle;
+static int16_t prevRawAngle;
+static uint32_t primingUpstroke = 0;
 static uint16_t leakTime = 0;
+static uint32_t stillTimeMS = 0;
+static uint8_t samplePeriodMS = ACCEL_FAST_PERIOD_MS;
 bool lastEventWasPriming = false;
 bool lastEventWasLeaking = false;
 
 /**
- * Description: Processes the ADXL queue by removing one value from X and Y queues
- *                  and turning that value into an angle. It then reports the angle
- *                  change and decides where we currently are in the water pumping state
- *                  machine - Not pumping, priming, extracting, or leaking.
+ * Description: Processes a full block of accelerometer samples handed over by
+ *                  the ADC ISR, one X/Y pair at a time.
+ * @param block: Pointer to the block of X/Y samples to process
  */
-void ProcessAccelQueue(void)
+void ProcessAccelBlock(accel_block *block)
 {
-    // We get here when both x and y queues are not empty
+    // All samples in a block share one period
+    if(samplePeriodMS != block->periodMS)
+    {
+        samplePeriodMS = block->periodMS;
+        UpdateLeakPerSample();
+    }
     
-    if(float_IsQueueFull(&angleQueue))
+    uint8_t i;
+    for(i = 0; i < block->length; i++)
     {
-        float_PullQueue(&angleQueue); // Empty one slot FIFO
+        ProcessAccelSample(block->x[i], block->y[i]);
     }
     
-    float_PushQueue(&angleQueue, 
-            GetHandleAngle(
-                uint16_PullQueue(&xQueue), uint16_PullQueue(&yQueue)));
+    if(samplePeriodMS == ACCEL_FAST_PERIOD_MS)
+    {
+        fastRateMS += (uint32_t)samplePeriodMS * block->length;
+    }
+    else
+    {
+        idleRateMS += (uint32_t)samplePeriodMS * block->length;
+    }
+}
+
+/**
+ * Description: Turns one X and Y sample into an angle. It then reports the angle
+ *                  change and decides where we currently are in the water pumping state
+ *                  machine - Not pumping, priming, extracting, or leaking.
+ * @param xAxis: 12 bit ADC value from xAxis
+ * @param yAxis: 12 bit ADC value from yAxis
+ */
+void ProcessAccelSample(uint16_t xAxis, uint16_t yAxis)
+{
+    int16_t rawAngle = GetHandleAngle(xAxis, yAxis);
+    
+    curAngle = UpdateMovingAverage(&angleFilter, rawAngle);
     
-    curAngle = float_AverageQueueElements(&angleQueue);
+    // At the idle and deep sleep rates the filter spans most of a second or
+    //  more and would smooth the first stroke away, so the raw angle
+    //  decides when to wake up
+    if(samplePeriodMS != ACCEL_FAST_PERIOD_MS)
+    {
+        UpdateAccelSampleRate(rawAngle - prevRawAngle);
+    }
+    else
+    {
+        UpdateAccelSampleRate(curAngle - prevAngle);
+    }
+    prevRawAngle = rawAngle;
 
     // Finish calculations from previous entries
     if(!lastEventWasPriming && primingUpstroke > 0)
     {
-        if(longestPrime < primingUpstroke)
+        uint32_t prime = UpstrokeToMillimeters(primingUpstroke);
+        if(longestPrime < prime)
         {
-            longestPrime = primingUpstroke;
+            longestPrime = prime;
         }
             
         primingUpstroke = 0;
@@ -781,9 +666,11 @@ void ProcessAccelQueue(void)
         
     if(!lastEventWasLeaking && leakTime > 0)
     {
-        if(LeakMSToRate(leakTime) > fastestLeakRate)
+        uint32_t leakRate = LeakMSToRate(leakTime);
+        if(leakRate > fastestLeakRate)
         {
-            fastestLeakRate = LeakMSToRate(leakTime);
+            fastestLeakRate = leakRate;
+            UpdateLeakPerSample();
         }
         
         leakTime = 0;
@@ -791,7 +678,8 @@ void ProcessAccelQueue(void)
     switch(GetPumpingState(curAngle, prevAngle))
     {
         case PRIMING:
-            primingUpstroke += UpstrokeToMeters(curAngle - prevAngle);
+            // Priming only happens on an upstroke, so this is positive
+            primingUpstroke += curAngle - prevAngle;
             lastEventWasPriming = true;
             lastEventWasLeaking = false;
             break;
@@ -801,7 +689,7 @@ void ProcessAccelQueue(void)
             lastEventWasLeaking = false;
             break;
         case LEAKING:
-            leakTime += 10;
+            leakTime += samplePeriodMS;
             lastEventWasLeaking = true;
             lastEventWasPriming = false;
             break;
@@ -814,6 +702,55 @@ void ProcessAccelQueue(void)
     prevAngle = curAngle;
 }
 
+/**
+ * Description: Picks the accelerometer sample rate from handle activity. Any
+ *                  movement past HANDLE_MOVEMENT_THRESHOLD goes straight to the
+ *                  fast rate, while ACCEL_IDLE_AFTER_MS of stillness drops to
+ *                  the idle rate. After DEEP_SLEEP_AFTER_MS still with no
+ *                  water (so no leak is being timed) it drops to the deep
+ *                  sleep rate, which also powers the WPS down. Every
+ *                  accumulator is in RAM, which Sleep keeps, so nothing is
+ *                  lost going in or out of deep sleep.
+ * @param angleDelta: Change in the angle since the last sample, averaged at
+ *                      the fast rate and raw below it, in hundredths of a
+ *                      degree
+ */
+void UpdateAccelSampleRate(int16_t angleDelta)
+{
+    if((angleDelta > HANDLE_MOVEMENT_THRESHOLD) ||
+            (angleDelta < -HANDLE_MOVEMENT_THRESHOLD))
+    {
+        if(stillTimeMS > 0)
+        {
+            // The handle just started moving, don't wait for the next
+            //  scheduled water check
+            RequestWaterCheck();
+        }
+        stillTimeMS = 0;
+        RequestAccelSamplePeriod(ACCEL_FAST_PERIOD_MS);
+    }
+    else if(stillTimeMS < ACCEL_IDLE_AFTER_MS)
+    {
+        stillTimeMS += samplePeriodMS;
+    }
+    else
+    {
+        if(stillTimeMS < DEEP_SLEEP_AFTER_MS)
+        {
+            stillTimeMS += samplePeriodMS;
+        }
+        
+        if(stillTimeMS >= DEEP_SLEEP_AFTER_MS && !IsThereWater())
+        {
+            RequestAccelSamplePeriod(ACCEL_DEEP_PERIOD_MS);
+        }
+        else
+        {
+            RequestAccelSamplePeriod(ACCEL_IDLE_PERIOD_MS);
+        }
+    }
+}
+
 /**
  * Description: Figures out which state we are pumping in based on angle delta and
  *                  whether water is currently present
@@ -821,7 +758,7 @@ void ProcessAccelQueue(void)
  * @param prevAngle: Previous angle to compare to get angle delta
  * @return PUMPING_STATE enum to indicate what state we are currently pumping in.
  */
-PUMPING_STATE GetPumpingState(float curAngle, float prevAngle)
+PUMPING_STATE GetPumpingState(int16_t curAngle, int16_t prevAngle)
 {
     if((curAngle - prevAngle) > HANDLE_MOVEMENT_THRESHOLD )
     {
@@ -850,63 +787,84 @@ PUMPING_STATE GetPumpingState(float curAngle, float prevAngle)
 /**
  * Description: Accumulates volume into the correct bin based on current time
  *                  and the angle change. This correctly takes into account leaking
- * @param angleDelta: Angle change to convert to volume
+ * @param angleDelta: Angle change to convert to volume, in hundredths of a degree
  */
-void AccumulateVolume(float angleDelta)
+void AccumulateVolume(int16_t angleDelta)
 {
+    // Volume only comes from moving the handle up
+    if(angleDelta <= 0)
+    {
+        return;
+    }
+    
     // Get the current hour
     int curHour = CurrentTime.hour;
     curHour >>= 1; // One bit shift to divide by two
     // This makes it so we can avoid a switch case
     
-    volumeArray[curHour] += UpstrokeToLiters(angleDelta);
-    // Subtract leaking. 10mS per sample = .01 sec/sample. Leak rate in L/sec
-    // This has to be in an if statement because if the handle isn't moving we don't
-    // subtract
-    if(angleDelta > 0)
+    uint32_t volume = UpstrokeToMilliliters(angleDelta);
+    // Subtract leaking over one sample period
+    // If it is leaking faster than pumping, there is no volume
+    if(leakPerSample > volume)
     {
-        // Assuming 10mS
-        float leakAmount = (fastestLeakRate / 100);
-        // If it is leaking faster than pumping, there is no volume
-        if(leakAmount > UpstrokeToLiters(angleDelta))
-        {
-            leakAmount = UpstrokeToLiters(angleDelta);
-        }
-        volumeArray[curHour] -= leakAmount;
-    } 
+        volume = 0;
+    }
+    else
+    {
+        volume -= leakPerSample;
+    }
+    
+    // Whole mL go in the bin, the fraction carries to the next sample
+    volume += volumeFraction;
+    volumeArray[curHour] += volume >> 16;
+    volumeFraction = volume & 0xFFFF;
 }
 
 /**
- * Description: Conversion function to turn upstroke in degrees to meters
- * @param upstroke: Degrees of upstroke
- * @return float meters of upstroke
+ * Description: Works out how much leaks over one sample period at the
+ *                  fastest leak rate. Called whenever either changes.
  */
-float UpstrokeToMeters(float upstroke)
+void UpdateLeakPerSample(void)
 {
-    // Returns Meters from degrees of upstroke
-    return (upstroke * c_UpstrokeToMeters);
+    // mL/hr * ms / 3600 is uL leaked per sample
+    uint32_t leakMicroliters = (fastestLeakRate * samplePeriodMS) / 3600;
+    // uL * 65536 / 1000 is mL in Q16
+    leakPerSample = (leakMicroliters << 13) / 125;
 }
 
 /**
- * Description: Conversion function to turn upstroke in degrees to liters
- * @param upstroke: Degrees of upstroke
- * @return float liters of dispensed water
+ * Description: Conversion function to turn upstroke in hundredths of a degree
+ *                  to millimeters
+ * @param upstroke: Hundredths of a degree of upstroke
+ * @return uint32_t millimeters of upstroke
  */
-float UpstrokeToLiters(float upstroke)
+uint32_t UpstrokeToMillimeters(uint32_t upstroke)
 {
-    // Returns liters from degrees of upstroke
-    return (upstroke * c_MKIILiterPerDegree);
+    // Returns mm from hundredths of a degree of upstroke
+    return (upstroke * c_UpstrokeMillimeterPerCentidegree) >> 12;
 }
 
 /**
- * Description: Conversion function to turn leak time to L/s
+ * Description: Conversion function to turn upstroke in hundredths of a degree
+ *                  to milliliters
+ * @param upstroke: Hundredths of a degree of upstroke
+ * @return uint32_t milliliters of dispensed water in Q16
+ */
+uint32_t UpstrokeToMilliliters(uint16_t upstroke)
+{
+    // Returns mL in Q16 from hundredths of a degree of upstroke
+    return (uint32_t)upstroke * c_MKIIMilliliterPerCentidegree;
+}
+
+/**
+ * Description: Conversion function to turn leak time to mL/hr
  * @param milsec: leak time in ms
- * @return float leak rate in L/s
+ * @return uint32_t leak rate in mL/hr
  */
-float LeakMSToRate(uint16_t milsec)
+uint32_t LeakMSToRate(uint16_t milsec)
 {
-    // Returns liters per second (L/s)
-    return (c_MaxLitersToLeak / (milsec * 1000));
+    // Returns milliliters per hour (mL/hr)
+    return (c_MaxLeakMilliliterHourMS / milsec);
 }
 
 /**
@@ -932,3 +890,190 @@ void HandleBatteryBufferEvent(void)
         batteryAccumAmt++;
     }
 }
+
+// Burst read of the MCP7940 time registers, run by the I2C engine
+static uint8_t rtccTimeAddr = RTCC_SECONDS_ADDR;
+static uint8_t rtccTimeRegs[RTCC_TIME_REGISTERS];
+static void LoadRTCCTime(i2c_transaction *transaction);
+static i2c_transaction rtccTimeRead = {
+    RTCC_I2C_ADDRESS,
+    &rtccTimeAddr, 1, // Write the register address
+    rtccTimeRegs, RTCC_TIME_REGISTERS, // Then read seconds through year
+    I2C_DEFAULT_TIMEOUT_MS,
+    LoadRTCCTime,
+    I2C_TR_COMPLETE
+};
+static soft_timer rtccSyncTimer;
+static uint8_t rtccSyncTries;
+static uint32_t rtccSyncRetryMS;
+static void TryRTCCSync(void);
+static void RTCCSyncFailed(void);
+static void RTCCSyncDue(void);
+
+/**
+ * Description: Starts loading the internal RTCC from the MCP7940, which keeps
+ *                  the time through a reset. Called at boot and once a day, so
+ *                  the RTCC never drifts more than a few seconds from it. The
+ *                  read is queued on the I2C engine and finished by
+ *                  LoadRTCCTime, nothing waits on the bus.
+ */
+void SyncRTCCTime(void)
+{
+    if((rtccTimeRead.status == I2C_TR_PENDING) || rtccSyncTimer.isScheduled)
+    {
+        // Already on its way
+        return;
+    }
+    
+    rtccSyncTries = 0;
+    rtccSyncRetryMS = RTCC_SYNC_RETRY_MS;
+    TryRTCCSync();
+}
+
+/**
+ * Description: Tries the MCP7940 read again once the backoff has passed.
+ *                  Called from the main loop on EVENT_RTCC_SYNC.
+ */
+void RetryRTCCSync(void)
+{
+    TryRTCCSync();
+}
+
+/**
+ * Description: Queues one read of the MCP7940 time registers.
+ */
+static void TryRTCCSync(void)
+{
+    if(rtccTimeRead.status == I2C_TR_PENDING)
+    {
+        return;
+    }
+    
+    rtccSyncTries++;
+    if(!I2C_SubmitTransaction(&rtccTimeRead))
+    {
+        // The bus is backed up
+        RTCCSyncFailed();
+    }
+}
+
+/**
+ * Description: Schedules the next try, each waiting twice as long as the
+ *                  last. After RTCC_SYNC_TRIES the internal RTCC is left
+ *                  running on the time it has, so a dead MCP7940 can not keep
+ *                  the part awake. Runs in the main loop or the MI2C1 ISR.
+ */
+static void RTCCSyncFailed(void)
+{
+    if(rtccSyncTries >= RTCC_SYNC_TRIES)
+    {
+        // Give up until tomorrow's sync, the hourly alarm still runs
+        IFS3bits.RTCIF = false;
+        IEC3bits.RTCIE = true;
+        return;
+    }
+    
+    ScheduleTimerAt(&rtccSyncTimer, GetTimeMS() + rtccSyncRetryMS,
+            RTCCSyncDue);
+    rtccSyncRetryMS *= 2;
+}
+
+/**
+ * Description: Retry timer callback, runs in the Timer1 ISR.
+ */
+static void RTCCSyncDue(void)
+{
+    RaiseEvent(EVENT_RTCC_SYNC);
+}
+
+/**
+ * Description: I2C engine callback for the MCP7940 time read. Loads the time
+ *                  into the internal RTCC, or backs off and tries again.
+ *                  This runs in the MI2C1 ISR, CurrentTime is picked up by
+ *                  the main loop from the work it posts.
+ * @param transaction: The finished read
+ */
+static void LoadRTCCTime(i2c_transaction *transaction)
+{
+    if(transaction->status != I2C_TR_COMPLETE)
+    {
+        RTCCSyncFailed();
+        return;
+    }
+    
+    time_s rtccTime = RTCCRegistersToTime(rtccTimeRegs);
+    
+    RTCC_TimeSet(&rtccTime);
+    IFS3bits.RTCIF = false;
+    IEC3bits.RTCIE = true;
+    PostWork(WORK_RTCC_LOADED, 0);
+}
+
+/**
+ * Description: Reads the internal RTCC into CurrentTime, which moves
+ *                  AccumulateVolume on to the next 2 hour bin. On the hourly
+ *                  alarm a change of day is the midnight event, and once a day
+ *                  the RTCC is resynced from the MCP7940.
+ * @param isAlarm: true for the hourly alarm, false when the RTCC was just
+ *                  loaded and the day change only means the time was set
+ */
+void UpdateCurrentTime(bool isAlarm)
+{
+    time_s rtccTime;
+    
+    while(!RTCC_TimeGet(&rtccTime))
+    {
+        // The RTCC is rolling over, this clears within a millisecond
+    }
+    
+    PreviousTime = CurrentTime;
+    CurrentTime = rtccTime;
+    
+    if(!isAlarm)
+    {
+        return;
+    }
+    
+    if(PreviousTime.mnDay != CurrentTime.mnDay)
+    {
+        RaiseEvent(EVENT_MIDNIGHT);
+    }
+    
+    if(CurrentTime.hour == RTCC_SYNC_HOUR)
+    {
+        SyncRTCCTime();
+    }
+}
+
+/**
+ * Description: Does the work the ISRs have posted, highest priority first.
+ *                  Called from the main loop on EVENT_WORK_POSTED.
+ */
+void RunDeferredWork(void)
+{
+    work_item item;
+    
+    while(PullWork(&item))
+    {
+        switch(item.id)
+        {
+            case WORK_RTCC_ALARM:
+                UpdateCurrentTime(true);
+                break;
+            case WORK_RTCC_LOADED:
+                UpdateCurrentTime(false);
+                break;
+            case WORK_I2C_RECOVER:
+                I2C_RecoverBus((I2C_TR_STATUS)item.payload);
+                break;
+            case WORK_NETLIGHT_EDGE:
+                UpdateNetStatus(item.payload, item.timestamp);
+                break;
+            case WORK_NETLIGHT_QUIET:
+                ResetNetStatus();
+                break;
+            default:
+                break;
+        }
+    }
+}
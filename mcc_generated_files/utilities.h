@@ -4,13 +4,15 @@
 #define	UTILITIES_H
 
 #include <xc.h> // include processor files - each processor file is guarded.  
-#include <math.h>
 #include <string.h>
 #include <stdbool.h>
 #include "constants.h"
 #include "interrupt_handlers.h"
 #include "I2C_Functions.h"
 #include "UART_Functions.h"
+#include "AT_Commands.h"
+#include "modem.h"
+#include "outbox.h"
 #include "queue.h"
 
 
@@ -24,23 +26,24 @@ typedef enum {
 /*
  Public Variables
  */
-extern char TextMessageString[MESSAGE_LENGTH];
 extern char phoneNumber[12];
 extern bool isBatteryLow;
-extern const float c_MKIILiterPerDegree;
-extern const float c_UpstrokeToMeters;
-extern const float c_MaxLitersToLeak;
 
 // Accumulates battery voltage for an end of day average
 extern uint32_t batteryAccumulator;
 extern uint16_t batteryAccumAmt;
 
-// Volume accumulator array
-extern float volumeArray[12];
-// Longest leak rate recorded for the day
-extern float fastestLeakRate;
-// Longest prime time recorded for the day
-extern float longestPrime;
+// Volume accumulator array in mL
+extern uint32_t volumeArray[12];
+// Fastest leak rate recorded for the day in mL/hr
+extern uint32_t fastestLeakRate;
+// Longest prime recorded for the day in mm
+extern uint32_t longestPrime;
+// Time spent at each accelerometer sample rate today
+extern uint32_t fastRateMS;
+extern uint32_t idleRateMS;
+// Longest Atan2Centidegrees has taken, in Timer5 ticks (0.5us)
+extern uint16_t atan2WorstTicks;
 
 /*
  Public Functions
@@ -50,44 +53,45 @@ void DelayMS(int ms);
 void DelayS(int sec);
 void KickWatchdog(void);
 
-float GetHandleAngle(uint16_t xAxis, uint16_t yAxis);
+int16_t GetHandleAngle(uint16_t xAxis, uint16_t yAxis);
+int16_t Atan2Centidegrees(int16_t y, int16_t x);
 
-void UpdateMessageVolume(void);
-void UpdateMessageBattery(void);
-float TurnBattADCToFloat(uint32_t avgBatVoltage);
-void UpdateMessagePrime(void);
-void UpdateMessageLeakage(void);
+uint32_t TurnBattADCToMillivolts(uint32_t avgBatVoltage);
+void UintToAscii(uint32_t value, char *dataPtr, uint8_t dataLen);
 // len of data must INCLUDE decimal point
-//  Cannot handle higher than 6 decimal precision due to implementation
-void FloatToAscii(float value, uint8_t decimalPrecision, 
+void FixedToAscii(uint32_t value, uint8_t decimalPrecision, 
         char *dataPtr, uint8_t dataLen);
-int NumDigits(uint32_t num);
 uint32_t TenToPower(int exponent);
-bool IsNumberTooBig(uint32_t value, uint8_t dataLen);
-bool IsBinTooSmall(float value, uint8_t prec, uint8_t len);
 bool IsSimOn(void);
 bool IsSimOnNetwork(void);
 bool IsThereWater(void);
 
 //uint8_t SendUART1(char *dataPtr, uint16_t dataCnt);
 //uint8_t ReceiveUART1(char *ptr, uint16_t ptrLen);
-void TurnOnSim(void);
-void TurnOffSim(void);
 
-void AssembleMidnightMessage(void);
-bool DidMessageSend(void);
+void FillDailyReport(daily_report *report);
 void SendMidnightMessage(void);
+void BuildTextCommand(char *command, uint8_t size, const char *numPtr,
+        int numLen);
 void SendTextMessage(char *msgPtr, int msgLen, char *numPtr, int numLen);
+bool IsTextSending(void);
 void ResetAccumulators(void);
 
-void ProcessAccelQueue(void);
-PUMPING_STATE GetPumpingState(float curAngle, float prevAngle);
-void AccumulateVolume(float angleDelta);
-float UpstrokeToMeters(float upstroke);
-float UpstrokeToLiters(float upstroke);
-float LeakMSToRate(uint16_t milsec);
+void ProcessAccelBlock(accel_block *block);
+void ProcessAccelSample(uint16_t xAxis, uint16_t yAxis);
+void UpdateAccelSampleRate(int16_t angleDelta);
+PUMPING_STATE GetPumpingState(int16_t curAngle, int16_t prevAngle);
+void AccumulateVolume(int16_t angleDelta);
+void UpdateLeakPerSample(void);
+uint32_t UpstrokeToMillimeters(uint32_t upstroke);
+uint32_t UpstrokeToMilliliters(uint16_t upstroke);
+uint32_t LeakMSToRate(uint16_t milsec);
 
 void HandleBatteryBufferEvent(void);
+void SyncRTCCTime(void);
+void RetryRTCCSync(void);
+void UpdateCurrentTime(bool isAlarm);
+void RunDeferredWork(void);
 
 /*
  Private Functions
@@ -0,0 +1,201 @@
+/*
+ * File:   host.c
+ */
+
+
+#define HOST_SFR_STORAGE
+#include "xc.h"
+#include <string.h>
+#include "host.h"
+#include "UART_Functions.h"
+
+int testFailures = 0;
+void (*hostIdleHook)(void) = NULL;
+void (*hostSfrHook)(volatile host_sfr_bits *sfr) = NULL;
+bool hostInISR = false;
+
+#define HOST_UART_FIFO_SIZE     4 // U1TXREG hardware FIFO
+
+static const char *uartRxData = NULL;
+static uint16_t uartRxLeft = 0;
+static volatile uint16_t uartTxFifo[HOST_UART_FIFO_SIZE];
+static uint8_t uartTxIn = 0; // Bytes written to U1TXREG
+static uint8_t uartTxOut = 0; // Bytes shifted out
+
+/**
+ * Description: Prints the result of a test program.
+ * @param name: Test program name
+ * @return int exit code for main, 0 if every CHECK passed
+ */
+int TestsFinished(const char *name)
+{
+    if (testFailures == 0)
+    {
+        printf("%s: passed\n", name);
+        return 0;
+    }
+
+    printf("%s: %d checks failed\n", name, testFailures);
+    return 1;
+}
+
+/**
+ * Description: Stands in for Idle() and Sleep().
+ */
+void HostIdle(void)
+{
+    if (hostIdleHook != NULL)
+    {
+        hostIdleHook();
+    }
+}
+
+/**
+ * Description: Runs an ISR, unless the CPU priority is holding it off. All
+ *      the firmware's interrupts are priority 4.
+ * @param isr: The ISR
+ */
+void HostInterrupt(void (*isr)(void))
+{
+    if (SRbits.IPL >= 4)
+    {
+        return;
+    }
+
+    hostInISR = true;
+    isr();
+    hostInISR = false;
+}
+
+/**
+ * Description: One tick of the 31kHz LPRC on Timer1. The counter runs up to
+ *      PR1 and starts again from 0 on the tick after, setting T1IF.
+ */
+void HostTimer1Tick(void)
+{
+    if (!T1CONbits.TON)
+    {
+        return;
+    }
+
+    if (TMR1 == PR1)
+    {
+        TMR1 = 0;
+        IFS0bits.T1IF = true;
+    }
+    else
+    {
+        TMR1++;
+    }
+
+    if (IFS0bits.T1IF && IEC0bits.T1IE)
+    {
+        HostInterrupt(_T1Interrupt);
+    }
+}
+
+/**
+ * Description: Use of an SFR a test may be playing the peripheral behind.
+ * @param sfr: The SFR
+ * @return the SFR, once the test has had its look
+ */
+volatile host_sfr_bits *HostSfrAccess(volatile host_sfr_bits *sfr)
+{
+    if (hostSfrHook != NULL)
+    {
+        hostSfrHook(sfr);
+    }
+
+    return sfr;
+}
+
+/**
+ * Description: Use of RTCVAL. Each use steps RTCPTR down until it is 0, as
+ *      each use of RTCVALH does on the part.
+ * @return the RTCC register pair RTCPTR pointed at
+ */
+volatile uint16_t *HostRtccValue(void)
+{
+    volatile uint16_t *value = &hostRTCVAL[RCFGCALbits.RTCPTR & 0x3];
+
+    if (RCFGCALbits.RTCPTR > 0)
+    {
+        RCFGCALbits.RTCPTR--;
+    }
+
+    return value;
+}
+
+/**
+ * Description: Has the U1RX ISR take in text, as if the SIM800 sent it.
+ * @param text: Bytes received, NULL terminated
+ */
+void HostUartReceive(const char *text)
+{
+    uartRxData = text;
+    uartRxLeft = strlen(text);
+    U1STAbits.URXDA = (uartRxLeft > 0);
+    IFS0bits.U1RXIF = true;
+    HostInterrupt(_U1RXInterrupt);
+}
+
+/**
+ * Description: Read of U1RXREG, takes the next byte from HostUartReceive.
+ * @return uint16_t the byte, 0 once there is nothing left
+ */
+uint16_t HostUartRead(void)
+{
+    uint8_t rxByte = 0;
+
+    if (uartRxLeft > 0)
+    {
+        rxByte = (uint8_t)*uartRxData++;
+        uartRxLeft--;
+    }
+    U1STAbits.URXDA = (uartRxLeft > 0);
+
+    return rxByte;
+}
+
+/**
+ * Description: Write of U1TXREG, the byte goes into the FIFO.
+ * @return the FIFO slot for it
+ */
+volatile uint16_t *HostUartWrite(void)
+{
+    volatile uint16_t *slot = &uartTxFifo[uartTxIn++ % HOST_UART_FIFO_SIZE];
+
+    U1STAbits.UTXBF = ((uint8_t)(uartTxIn - uartTxOut) >= HOST_UART_FIFO_SIZE);
+    U1STAbits.TRMT = false;
+
+    return slot;
+}
+
+/**
+ * Description: One byte time of the UART. The oldest byte in the FIFO goes
+ *      out, and the U1TX ISR runs if it is on. With UTXISEL0 set that is
+ *      only once the last byte is out.
+ * @return int the byte sent, -1 if there was none
+ */
+int HostUartSend(void)
+{
+    int txByte = -1;
+
+    if (uartTxIn != uartTxOut)
+    {
+        txByte = (uint8_t)uartTxFifo[uartTxOut++ % HOST_UART_FIFO_SIZE];
+    }
+    U1STAbits.UTXBF = false;
+    U1STAbits.TRMT = (uartTxIn == uartTxOut);
+    if (!U1STAbits.UTXISEL0 || U1STAbits.TRMT)
+    {
+        IFS0bits.U1TXIF = true;
+    }
+
+    if (IEC0bits.U1TXIE)
+    {
+        HostInterrupt(_U1TXInterrupt);
+    }
+
+    return txByte;
+}
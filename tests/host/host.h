@@ -0,0 +1,46 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef HOST_H
+#define	HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "xc.h"
+
+/*
+ What every test shares: CHECK counts failures and carries on, so one run
+ reports everything that is wrong, and TestsFinished turns the count into
+ the exit code make looks at.
+ */
+#define CHECK(condition)                                                       \
+    do                                                                         \
+    {                                                                          \
+        if (!(condition))                                                      \
+        {                                                                      \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,            \
+                    #condition);                                               \
+            testFailures++;                                                    \
+        }                                                                      \
+    } while (0)
+
+extern int testFailures;
+// Called from Idle(), for a test to move the peripherals on while the
+//  firmware waits
+extern void (*hostIdleHook)(void);
+// Called before each use of I2C1CONbits and PORTBbits
+extern void (*hostSfrHook)(volatile host_sfr_bits *sfr);
+// true while HostInterrupt is running an ISR
+extern bool hostInISR;
+
+int TestsFinished(const char *name);
+void HostInterrupt(void (*isr)(void));
+void HostTimer1Tick(void);
+void HostUartReceive(const char *text);
+int HostUartSend(void);
+
+void _T1Interrupt(void);
+void _ADC1Interrupt(void);
+void _RTCCInterrupt(void);
+
+#endif	/* HOST_H */
@@ -0,0 +1,11 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef HOST_LIBPIC30_H
+#define	HOST_LIBPIC30_H
+
+// Delays don't wait on the PC
+#define __delay_ms(ms)      ((void)(ms))
+#define __delay_us(us)      ((void)(us))
+#define __delay32(cycles)   ((void)(cycles))
+
+#endif	/* HOST_LIBPIC30_H */
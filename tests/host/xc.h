@@ -0,0 +1,111 @@
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef HOST_XC_H
+#define	HOST_XC_H
+
+#include <stdint.h>
+
+/*
+ Stand-in for the XC16 device header, so the firmware sources build with the
+ PC compiler for the tests in this directory. Every SFR the firmware touches
+ is a plain variable, defined once in host.c. Each bits struct has a whole
+ uint16_t per field, which is enough to watch and drive the peripherals from
+ a test, not a model of the real layout. Reads of U1RXREG come from
+ HostUartRead, so a test can feed the RX ISR, and writes of U1TXREG go into
+ a 4 byte FIFO that HostUartSend empties. The ADC result buffers are one
+ array, the firmware walks them from ADC1BUF0 as on the part. RTCVAL is the
+ RTCC register pair RTCPTR points at, see HostRtccValue.
+ */
+
+#ifdef HOST_SFR_STORAGE
+#define SFR volatile
+#else
+#define SFR extern volatile
+#endif
+
+// XC16 attributes the PC compiler doesn't know
+#define interrupt       unused
+#define __interrupt__   unused
+#define no_auto_psv     unused
+#define auto_psv        unused
+#define space(x)        unused
+#define _ISR
+
+typedef struct {
+    uint16_t ACKDT; uint16_t ACKEN; uint16_t ACKSTAT; uint16_t AD1IE; uint16_t AD1IF;
+    uint16_t AD1IP; uint16_t ADDRERR; uint16_t ALRMEN; uint16_t ALRMPTR; uint16_t ASAM;
+    uint16_t BCL; uint16_t CN12IE; uint16_t CN9IE; uint16_t CNIE; uint16_t CNIF;
+    uint16_t CNIP; uint16_t CSCNA; uint16_t DONE; uint16_t DOZE; uint16_t DOZEN;
+    uint16_t FERR; uint16_t I2CEN; uint16_t IPL; uint16_t IWCOL; uint16_t MI2C1IE;
+    uint16_t MI2C1IF; uint16_t MI2C1IP; uint16_t OERR; uint16_t PEN; uint16_t PVCFG;
+    uint16_t RB8; uint16_t RB9; uint16_t RBF; uint16_t RCEN; uint16_t RSEN;
+    uint16_t RTCEN; uint16_t RTCIE; uint16_t RTCIF; uint16_t RTCIP; uint16_t RTCPTR;
+    uint16_t RTCSYNC; uint16_t RTCWREN; uint16_t SAMP; uint16_t SEN; uint16_t SMPI;
+    uint16_t SOSCEN; uint16_t T1IE; uint16_t T1IF; uint16_t T1IP; uint16_t T2IF;
+    uint16_t T3IF; uint16_t T4IE; uint16_t T4IF; uint16_t T4IP; uint16_t T5IE;
+    uint16_t T5IF; uint16_t T5IP; uint16_t TBF; uint16_t TON; uint16_t TRISB8;
+    uint16_t TRISB9; uint16_t TRMT; uint16_t TRSTAT; uint16_t U1ERIE; uint16_t U1ERIF;
+    uint16_t U1ERIP; uint16_t U1RXIE; uint16_t U1RXIF; uint16_t U1RXIP; uint16_t U1TXIE;
+    uint16_t U1TXIF; uint16_t U1TXIP; uint16_t URXDA; uint16_t UTXBF; uint16_t UTXEN;
+    uint16_t UTXISEL0; uint16_t WR;
+} host_sfr_bits;
+
+SFR host_sfr_bits AD1CON1bits, AD1CON2bits, ALCFGRPTbits, CLKDIVbits;
+SFR host_sfr_bits CNEN1bits, CNEN2bits, CNPU1bits;
+SFR host_sfr_bits I2C1STATbits, IEC0bits, IEC1bits, IEC3bits;
+SFR host_sfr_bits IEC4bits, IFS0bits, IFS1bits, IFS3bits;
+SFR host_sfr_bits IFS4bits, INTCON1bits, IPC0bits, IPC15bits;
+SFR host_sfr_bits IPC16bits, IPC2bits, IPC3bits, IPC4bits;
+SFR host_sfr_bits IPC6bits, IPC7bits, NVMCONbits, OSCCONbits;
+SFR host_sfr_bits RCFGCALbits, SRbits, T1CONbits;
+SFR host_sfr_bits T2CONbits, T3CONbits, T4CONbits, T5CONbits;
+SFR host_sfr_bits TRISBbits, U1STAbits;
+SFR uint16_t AD1CHS, AD1CON1, AD1CON2, AD1CON3, AD1CSSH, AD1CSSL;
+SFR uint16_t ALCFGRPT, ALRMVAL, ANSA, ANSB, CLKDIV;
+SFR uint16_t I2C1BRG, I2C1CON, I2C1RCV, I2C1TRN, LATA, LATB;
+SFR uint16_t NVMCON, PADCFG1, PR1, PR2, PR3, PR4;
+SFR uint16_t PR5, RTCPWC, T1CON, T2CON, T3CON;
+SFR uint16_t T4CON, T5CON, TBLPAG, TMR1, TMR2, TMR3;
+SFR uint16_t TMR4, TMR5, TRISA, TRISB, U1BRG, U1MODE;
+SFR uint16_t U1STA;
+SFR uint16_t _LATA1, _LATB15, _LATB6, _RA4, _RA7, _RB14;
+SFR uint16_t _RB5;
+
+SFR uint16_t hostADC1BUF[16];
+#define ADC1BUF0        (hostADC1BUF[0])
+
+SFR uint16_t hostRTCVAL[4];
+volatile uint16_t *HostRtccValue(void);
+#define RTCVAL          (*HostRtccValue())
+
+uint16_t HostUartRead(void);
+#define U1RXREG         (HostUartRead())
+volatile uint16_t *HostUartWrite(void);
+#define U1TXREG         (*HostUartWrite())
+
+// Every use of these goes through HostSfrAccess first, so a test can play
+//  the I2C module and the pins behind them
+SFR host_sfr_bits hostI2C1CONbits, hostPORTBbits;
+volatile host_sfr_bits *HostSfrAccess(volatile host_sfr_bits *sfr);
+#define I2C1CONbits     (*HostSfrAccess(&hostI2C1CONbits))
+#define PORTBbits       (*HostSfrAccess(&hostPORTBbits))
+
+void HostIdle(void);
+#define Idle()          HostIdle()
+#define Sleep()         HostIdle()
+#define ClrWdt()        ((void)0)
+#define Nop()           ((void)0)
+
+#define __builtin_disi(x)           ((void)(x))
+#define __builtin_divud(num, den)   ((uint16_t)((uint32_t)(num) / (den)))
+#define __builtin_write_RTCWEN()    ((void)0)
+#define __builtin_write_OSCCONL(x)  ((void)(x))
+#define __builtin_write_OSCCONH(x)  ((void)(x))
+// The data EEPROM reads back erased and ignores writes
+#define __builtin_tblpage(p)        0
+#define __builtin_tbloffset(p)      0
+#define __builtin_tblrdl(offset)    0xFFFF
+#define __builtin_tblwtl(offset, x) ((void)(offset), (void)(x))
+#define __builtin_write_NVM()       ((void)0)
+
+#endif	/* HOST_XC_H */
@@ -0,0 +1,175 @@
+/*
+ * File:   test_adc_scan.c
+ */
+
+
+#include "host.h"
+#include "interrupt_handlers.h"
+
+/*
+ The accelerometer scan against a stand-in for the ADC. The test plays the
+ ADC: it checks each scan is set up to convert both axes and interrupt once,
+ loads the pair into the result buffers, and runs the ADC ISR. Every
+ interrupt has to store exactly that one pair, wherever it falls in the
+ block, and a full block is handed over by switching blocks, not copying.
+ */
+
+#define SCAN_BLOCKS     50
+#define UNSCANNED       0xDEAD // Result buffers past the scan
+
+static uint16_t pairsConverted = 0;
+
+static uint16_t XSample(uint16_t pair)
+{
+    return (uint16_t)((pair * 7) % 1024);
+}
+
+static uint16_t YSample(uint16_t pair)
+{
+    return (uint16_t)(1023 - (pair * 13) % 1024);
+}
+
+/**
+ * Description: Does what the ADC does with a scan StartAccelScan set up,
+ *      and raises the one interrupt for it.
+ */
+static void ConvertScan(uint16_t x, uint16_t y)
+{
+    uint8_t i;
+
+    CHECK(AD1CON2bits.CSCNA);
+    CHECK(AD1CSSL == ACCEL_SCAN_MASK);
+    // One interrupt for both conversions
+    CHECK(AD1CON2bits.SMPI == ACCEL_SCAN_CONVERSIONS - 1);
+    CHECK(AD1CON1bits.ASAM);
+
+    for (i = 0; i < 16; i++)
+    {
+        hostADC1BUF[i] = UNSCANNED;
+    }
+    // AN11 (Y) before AN15 (X)
+    hostADC1BUF[0] = y;
+    hostADC1BUF[1] = x;
+
+    IFS0bits.AD1IF = true;
+    HostInterrupt(_ADC1Interrupt);
+    pairsConverted++;
+
+    CHECK(!IFS0bits.AD1IF);
+    // No second sequence until the next sample is due
+    CHECK(!AD1CON1bits.ASAM);
+}
+
+/**
+ * Description: Checks the main loop was handed a full block of the pairs
+ *      from firstPair on.
+ */
+static void CheckBlock(accel_block *block, uint16_t firstPair)
+{
+    uint8_t i;
+
+    CHECK(block->length == ACCEL_BLOCK_SIZE);
+    CHECK(block->periodMS == ACCEL_FAST_PERIOD_MS);
+    for (i = 0; i < ACCEL_BLOCK_SIZE; i++)
+    {
+        CHECK(block->x[i] == XSample(firstPair + i));
+        CHECK(block->y[i] == YSample(firstPair + i));
+    }
+}
+
+static void TestScanBlocks(void)
+{
+    uint16_t pair;
+    uint8_t expectedBlock = fullAccelBlock;
+
+    for (pair = 0; pair < SCAN_BLOCKS * ACCEL_BLOCK_SIZE; pair++)
+    {
+        StartAccelScan();
+        ConvertScan(XSample(pair), YSample(pair));
+
+        if ((pair + 1) % ACCEL_BLOCK_SIZE != 0)
+        {
+            CHECK(!accelBlockIsFull);
+            CHECK(!(TakeEvents() & EVENT_ACCEL_BLOCK));
+            continue;
+        }
+
+        CHECK(accelBlockIsFull);
+        CHECK(TakeEvents() & EVENT_ACCEL_BLOCK);
+        // The block the ISR filled, in place
+        CHECK(fullAccelBlock == expectedBlock);
+        CheckBlock(&accelBlocks[fullAccelBlock], pair + 1 - ACCEL_BLOCK_SIZE);
+        expectedBlock ^= 1;
+        accelBlockIsFull = false;
+    }
+
+    // One interrupt per pair, nothing left over
+    CHECK(pairsConverted == SCAN_BLOCKS * ACCEL_BLOCK_SIZE);
+    CHECK(accelBlockOverruns == 0);
+}
+
+/**
+ * Description: The main loop holds on to a block while the ISR fills two
+ *      more. The held block must not change.
+ */
+static void TestOverrun(void)
+{
+    uint16_t pair;
+    uint8_t heldBlock;
+
+    for (pair = 0; pair < ACCEL_BLOCK_SIZE; pair++)
+    {
+        StartAccelScan();
+        ConvertScan(XSample(pair), YSample(pair));
+    }
+    CHECK(accelBlockIsFull);
+    heldBlock = fullAccelBlock;
+
+    for (pair = 100; pair < 100 + 2 * ACCEL_BLOCK_SIZE; pair++)
+    {
+        StartAccelScan();
+        ConvertScan(XSample(pair), YSample(pair));
+    }
+    CHECK(accelBlockOverruns == 2);
+    CHECK(fullAccelBlock == heldBlock);
+    CheckBlock(&accelBlocks[heldBlock], 0);
+
+    accelBlockIsFull = false;
+    TakeEvents();
+}
+
+/**
+ * Description: A battery read shares the ADC ISR, it must leave the scan
+ *      and take the single conversion path.
+ */
+static void TestBatteryBetweenScans(void)
+{
+    uint8_t depth = batteryBufferDepth;
+
+    StartAccelScan();
+    ConvertScan(XSample(0), YSample(0));
+
+    StartBatteryRead();
+    CHECK(!AD1CON2bits.CSCNA);
+    CHECK(AD1CHS == ADC1_BATTERY_SENSOR);
+    hostADC1BUF[0] = 612;
+    AD1CON1bits.DONE = true;
+    IFS0bits.AD1IF = true;
+    HostInterrupt(_ADC1Interrupt);
+    AD1CON1bits.DONE = false;
+    CHECK(batteryBufferDepth == depth + 1);
+    CHECK(batteryBuffer[depth] == 612);
+
+    // And the next scan carries on the block
+    StartAccelScan();
+    ConvertScan(XSample(1), YSample(1));
+}
+
+int main(void)
+{
+    TestScanBlocks();
+    TestOverrun();
+    TestBatteryBetweenScans();
+
+    return TestsFinished("test_adc_scan");
+}
@@ -0,0 +1,527 @@
+/*
+ * File:   test_at_commands.c
+ */
+
+
+#include <string.h>
+#include "host.h"
+#include "AT_Commands.h"
+#include "UART_Functions.h"
+#include "deferred_work.h"
+#include "timer_service.h"
+#include "tmr1.h"
+
+/*
+ The AT engine run against a scripted SIM800, through the real UART ISRs, a
+ millisecond at a time on a simulated Timer1. At 9600 baud a byte takes
+ about a ms, so the UART sends one byte a ms. The SIM800 collects what it is
+ sent into lines, a "\r" or the ctrl-Z after a payload ends one, and checks
+ each against the next step of the script. The step's reply goes back after
+ its delay. Until ATE0 the SIM800 echoes each line back first, the way it
+ does after power up.
+ */
+
+#define NO_REPLY        NULL // The SIM800 says nothing back
+#define SCRIPT_STEPS    8
+#define SIM_LINE_SIZE   256
+
+typedef struct {
+    const char *expect; // Line the SIM800 should be sent, ctrl-Z included
+    const char *reply;
+    uint32_t delayMS; // From the end of the line to the reply
+} script_step;
+
+typedef struct {
+    const script_step *script;
+    uint8_t step;
+    bool isEchoOn;
+    bool isPrompted; // "> " sent, the payload ends with ctrl-Z
+    char line[SIM_LINE_SIZE];
+    uint16_t lineLength;
+    char echo[SIM_LINE_SIZE + 2];
+    const char *reply; // Waiting to go out at replyMS
+    uint32_t replyMS;
+    uint16_t wrongLines; // Lines that weren't the next step
+} sim800;
+
+static sim800 modem;
+static uint32_t nowMS = 0;
+static uint32_t idleCalls = 0;
+
+static at_command *finished[SCRIPT_STEPS]; // In the order they finished
+static uint8_t finishedCount = 0;
+static uint32_t finishedMS[SCRIPT_STEPS];
+
+/**
+ * Description: The SIM800 has a whole line, checks it against the script.
+ */
+static void ModemLine(void)
+{
+    const script_step *step = &modem.script[modem.step];
+
+    modem.line[modem.lineLength] = '\0';
+
+    if (modem.isEchoOn)
+    {
+        snprintf(modem.echo, sizeof(modem.echo), "%s\r", modem.line);
+        HostUartReceive(modem.echo);
+    }
+
+    if (step->expect == NULL || strcmp(modem.line, step->expect) != 0)
+    {
+        printf("SIM800 was sent \"%s\"\n", modem.line);
+        modem.wrongLines++;
+    }
+    else
+    {
+        if (strcmp(modem.line, "ATE0") == 0)
+        {
+            modem.isEchoOn = false;
+        }
+        modem.isPrompted = (step->reply != NO_REPLY) &&
+                (strstr(step->reply, "> ") != NULL);
+        modem.reply = step->reply;
+        modem.replyMS = nowMS + step->delayMS;
+        modem.step++;
+    }
+
+    modem.lineLength = 0;
+}
+
+/**
+ * Description: A byte from the UART reaches the SIM800.
+ */
+static void ModemReceive(uint8_t rxByte)
+{
+    if (modem.lineLength < SIM_LINE_SIZE - 1)
+    {
+        modem.line[modem.lineLength++] = (char)rxByte;
+    }
+
+    if ((rxByte == '\r' && !modem.isPrompted) ||
+            (rxByte == 0x1A && modem.isPrompted))
+    {
+        if (rxByte == '\r')
+        {
+            modem.lineLength--;
+        }
+        modem.isPrompted = false;
+        ModemLine();
+    }
+}
+
+/**
+ * Description: What main does on EVENT_MODEM.
+ */
+static void RunMainLoop(void)
+{
+    if (TakeEvents() & EVENT_MODEM)
+    {
+        AT_Process();
+    }
+}
+
+/**
+ * Description: A ms of the UART, the SIM800 and Timer1.
+ */
+static void StepMS(void)
+{
+    int txByte = HostUartSend();
+    uint8_t tick;
+
+    if (txByte >= 0)
+    {
+        ModemReceive((uint8_t)txByte);
+    }
+
+    if (modem.reply != NO_REPLY && nowMS >= modem.replyMS)
+    {
+        const char *reply = modem.reply;
+
+        modem.reply = NO_REPLY;
+        HostUartReceive(reply);
+    }
+
+    for (tick = 0; tick < TMR1_TICKS_PER_MS; tick++)
+    {
+        HostTimer1Tick();
+    }
+    nowMS++;
+}
+
+static void RunMS(uint32_t ms)
+{
+    uint32_t i;
+
+    for (i = 0; i < ms; i++)
+    {
+        StepMS();
+        RunMainLoop();
+    }
+}
+
+/**
+ * Description: Idle() in the firmware. The CPU sleeps until the next
+ *      interrupt, and a pending ISR runs as soon as the IPL is put back, so
+ *      it is run here as if the IPL were already back down.
+ */
+static void IdleUntilInterrupt(void)
+{
+    uint16_t savedIPL = SRbits.IPL;
+
+    idleCalls++;
+    SRbits.IPL = 0;
+    StepMS();
+    SRbits.IPL = savedIPL;
+}
+
+static void CommandDone(at_command *command)
+{
+    if (finishedCount < SCRIPT_STEPS)
+    {
+        finishedMS[finishedCount] = nowMS;
+        finished[finishedCount++] = command;
+    }
+}
+
+static void Reset(const script_step *script)
+{
+    RunMS(20); // Anything left over goes out
+    memset(&modem, 0, sizeof(modem));
+    modem.script = script;
+    modem.isEchoOn = true;
+    finishedCount = 0;
+    textsReceived = 0;
+    lastTextIndex = -1;
+    modemStatus = 0;
+}
+
+static void InitCommand(at_command *command, const char *text,
+        uint16_t timeoutMS)
+{
+    memset(command, 0, sizeof(*command));
+    command->command = text;
+    command->timeoutMS = timeoutMS;
+    command->callback = CommandDone;
+}
+
+static void TestTextMessage(void)
+{
+    static char payload[160];
+    static char payloadLine[sizeof(payload) + 2];
+    static const script_step script[] = {
+        { "ATE0", "\r\nOK\r\n", 5 },
+        { "AT+CMGF=1", "\r\nOK\r\n", 5 },
+        { "AT+CMGS=\"+15555550100\"", "\r\n> ", 50 },
+        { payloadLine, "\r\n+CMGS: 12\r\n\r\nOK\r\n", 3000 },
+        { NULL, NO_REPLY, 0 }
+    };
+    static at_command echoOff, textMode, send;
+    uint8_t i;
+
+    // Longer than the TX queue, so TxDrained has to bring the engine back
+    for (i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = 'A' + i % 26;
+    }
+    memcpy(payloadLine, payload, sizeof(payload));
+    payloadLine[sizeof(payload)] = 0x1A;
+    payloadLine[sizeof(payload) + 1] = '\0';
+
+    Reset(script);
+    InitCommand(&echoOff, "ATE0", AT_DEFAULT_TIMEOUT_MS);
+    InitCommand(&textMode, "AT+CMGF=1", AT_DEFAULT_TIMEOUT_MS);
+    InitCommand(&send, "AT+CMGS=\"+15555550100\"", AT_CMGS_TIMEOUT_MS);
+    send.payload = payload;
+    send.payloadLength = sizeof(payload);
+
+    CHECK(AT_IsEngineIdle());
+    CHECK(AT_SubmitCommand(&echoOff));
+    CHECK(AT_SubmitCommand(&textMode));
+    CHECK(AT_SubmitCommand(&send));
+    CHECK(!AT_IsEngineIdle());
+    CHECK(echoOff.status == AT_PENDING);
+    RunMS(5000);
+
+    CHECK(modem.step == 4);
+    CHECK(modem.wrongLines == 0);
+    CHECK(finishedCount == 3);
+    CHECK(finished[0] == &echoOff && finished[1] == &textMode &&
+            finished[2] == &send);
+    CHECK(echoOff.status == AT_OK);
+    CHECK(textMode.status == AT_OK);
+    CHECK(send.status == AT_OK);
+    CHECK(send.result == 12);
+    CHECK(AT_IsEngineIdle());
+
+    // Each step goes as soon as the last is answered, a byte a ms and the
+    //  SIM800's delay
+    CHECK(finishedMS[1] - finishedMS[0] <= strlen("AT+CMGF=1\r") + 5 + 2);
+    CHECK(finishedMS[2] - finishedMS[1] <=
+            strlen("AT+CMGS=\"+15555550100\"\r") + 50 + sizeof(payload) + 1 +
+            3000 + 10);
+}
+
+static void TestErrors(void)
+{
+    static const script_step script[] = {
+        { "AT+CREG?", "\r\nERROR\r\n", 5 },
+        { "AT+CPIN?", "\r\n+CME ERROR: 10\r\n", 5 },
+        { "AT+CMGR=1", "\r\n+CMS ERROR: 321\r\n", 5 },
+        { NULL, NO_REPLY, 0 }
+    };
+    static at_command plain, cme, cms;
+
+    Reset(script);
+    InitCommand(&plain, "AT+CREG?", AT_DEFAULT_TIMEOUT_MS);
+    InitCommand(&cme, "AT+CPIN?", AT_DEFAULT_TIMEOUT_MS);
+    InitCommand(&cms, "AT+CMGR=1", AT_DEFAULT_TIMEOUT_MS);
+    CHECK(AT_SubmitCommand(&plain));
+    CHECK(AT_SubmitCommand(&cme));
+    CHECK(AT_SubmitCommand(&cms));
+    RunMS(200);
+
+    CHECK(modem.wrongLines == 0);
+    CHECK(finishedCount == 3);
+    CHECK(plain.status == AT_ERROR && plain.result == -1);
+    CHECK(cme.status == AT_CME_ERROR && cme.result == 10);
+    CHECK(cms.status == AT_CMS_ERROR && cms.result == 321);
+    CHECK(AT_IsEngineIdle());
+}
+
+static void TestTimeout(void)
+{
+    static const script_step script[] = {
+        { "AT", NO_REPLY, 0 },
+        { "AT+CSQ", "\r\n+CSQ: 18,0\r\n\r\nOK\r\n", 5 },
+        { NULL, NO_REPLY, 0 }
+    };
+    static at_command silent, next;
+    uint32_t startMS;
+
+    Reset(script);
+    InitCommand(&silent, "AT", AT_DEFAULT_TIMEOUT_MS);
+    InitCommand(&next, "AT+CSQ", AT_DEFAULT_TIMEOUT_MS);
+    startMS = nowMS;
+    CHECK(AT_SubmitCommand(&silent));
+    CHECK(AT_SubmitCommand(&next));
+
+    RunMS(AT_DEFAULT_TIMEOUT_MS - 10);
+    CHECK(silent.status == AT_PENDING);
+    CHECK(finishedCount == 0);
+
+    // The next command is only sent once the silent one has given up
+    RunMS(100);
+    CHECK(silent.status == AT_TIMEOUT);
+    CHECK(finishedCount == 2);
+    CHECK(finishedMS[0] - startMS >= AT_DEFAULT_TIMEOUT_MS);
+    CHECK(finishedMS[0] - startMS <= AT_DEFAULT_TIMEOUT_MS + 2);
+    CHECK(next.status == AT_OK);
+    CHECK(modem.wrongLines == 0);
+    CHECK(AT_IsEngineIdle());
+}
+
+static void TestURCs(void)
+{
+    static const script_step script[] = {
+        { "AT+CMGS=\"+15555550100\"", "\r\n> ", 20 },
+        { "Hi\x1A", "\r\n+CMGS: 200\r\n\r\nOK\r\n", 500 },
+        { NULL, NO_REPLY, 0 }
+    };
+    static at_command send;
+
+    Reset(script);
+    HostUartReceive("\r\nRDY\r\n\r\n+CPIN: READY\r\n\r\nCall Ready\r\n");
+    RunMS(5);
+    HostUartReceive("\r\nSMS Ready\r\n");
+    RunMS(5);
+    CHECK(modemStatus == (MODEM_STATUS_READY | MODEM_STATUS_SIM_READY |
+            MODEM_STATUS_CALL_READY | MODEM_STATUS_SMS_READY));
+
+    InitCommand(&send, "AT+CMGS=\"+15555550100\"", AT_CMGS_TIMEOUT_MS);
+    send.payload = "Hi";
+    send.payloadLength = 2;
+    modem.isEchoOn = false;
+    CHECK(AT_SubmitCommand(&send));
+    RunMS(100);
+
+    // A text comes in while the send waits, it doesn't finish the send
+    HostUartReceive("\r\n+CMTI: \"SM\",7\r\n");
+    RunMS(5);
+    CHECK(textsReceived == 1);
+    CHECK(lastTextIndex == 7);
+    CHECK(send.status == AT_PENDING);
+
+    HostUartReceive("\r\nUNDER-VOLTAGE WARNNING\r\n");
+    RunMS(1000);
+    CHECK(modemStatus & MODEM_STATUS_VOLTAGE_WARN);
+    CHECK(send.status == AT_OK);
+    CHECK(send.result == 200);
+    CHECK(modem.wrongLines == 0);
+}
+
+static void TestLongLine(void)
+{
+    static const script_step script[] = {
+        { "AT+CIMI", NO_REPLY, 0 },
+        { NULL, NO_REPLY, 0 }
+    };
+    static char junk[200 + 3];
+    static at_command command;
+    uint16_t droppedBefore = rxDroppedCount;
+
+    memset(junk, 'x', sizeof(junk) - 3);
+    strcpy(junk + sizeof(junk) - 3, "\r\n");
+
+    Reset(script);
+    modem.isEchoOn = false;
+    InitCommand(&command, "AT+CIMI", AT_DEFAULT_TIMEOUT_MS);
+    CHECK(AT_SubmitCommand(&command));
+    RunMS(20);
+
+    // More than the RX queue holds, the end of it is dropped, the line is
+    //  still closed
+    HostUartReceive(junk);
+    CHECK(rxDroppedCount - droppedBefore ==
+            sizeof(junk) - 3 - (UART_RX_QUEUE_SIZE - 1));
+    RunMS(1);
+    CHECK(command.status == AT_PENDING);
+
+    HostUartReceive("\r\nOK\r\n");
+    RunMS(1);
+    CHECK(command.status == AT_OK);
+    CHECK(AT_IsEngineIdle());
+}
+
+/**
+ * Description: Callback that tries its command again, as the modem does
+ *      with "AT" while syncing.
+ */
+static void RetryCommand(at_command *command)
+{
+    CommandDone(command);
+    if (command->status != AT_OK && finishedCount < 4)
+    {
+        CHECK(AT_SubmitCommand(command));
+    }
+}
+
+static void TestPowerDown(void)
+{
+    static const script_step script[] = {
+        { "AT+CSQ", NO_REPLY, 0 },
+        { NULL, NO_REPLY, 0 }
+    };
+    static at_command out, queued, retried;
+    uint16_t wrongLines;
+
+    Reset(script);
+    modem.isEchoOn = false;
+    InitCommand(&out, "AT+CSQ", AT_DEFAULT_TIMEOUT_MS);
+    InitCommand(&queued, "AT+CREG?", AT_DEFAULT_TIMEOUT_MS);
+    InitCommand(&retried, "AT", AT_DEFAULT_TIMEOUT_MS);
+    retried.callback = RetryCommand;
+    CHECK(AT_SubmitCommand(&out));
+    CHECK(AT_SubmitCommand(&queued));
+    CHECK(AT_SubmitCommand(&retried));
+    RunMS(20);
+    CHECK(modem.step == 1);
+
+    // Everything out or queued fails straight away, in order, even what a
+    //  callback submits while it happens
+    HostUartReceive("\r\nUNDER-VOLTAGE POWER DOWN\r\n");
+    RunMS(1);
+    CHECK(modemStatus == MODEM_STATUS_POWERED_DOWN);
+    CHECK(finishedCount == 4);
+    CHECK(finished[0] == &out && finished[1] == &queued &&
+            finished[2] == &retried && finished[3] == &retried);
+    CHECK(out.status == AT_POWERED_DOWN);
+    CHECK(queued.status == AT_POWERED_DOWN);
+    CHECK(retried.status == AT_POWERED_DOWN);
+    CHECK(AT_IsEngineIdle());
+
+    // Nothing more goes to the SIM800, and no timeout goes off later
+    wrongLines = modem.wrongLines;
+    RunMS(AT_DEFAULT_TIMEOUT_MS * 2);
+    CHECK(modem.wrongLines == wrongLines);
+    CHECK(modem.lineLength == 0);
+    CHECK(finishedCount == 4);
+    CHECK(U1STAbits.TRMT);
+}
+
+static void TestBlockingWrites(void)
+{
+    static char line[200 + 2];
+    static char sent[200 + 8]; // line with NULL chars through it
+    static const script_step script[] = {
+        { line, NO_REPLY, 0 },
+        { NULL, NO_REPLY, 0 }
+    };
+    uint8_t i, j = 0;
+
+    memset(line, 'A', sizeof(line) - 2);
+    line[sizeof(line) - 2] = '\0';
+    for (i = 0; i < sizeof(line) - 2; i++)
+    {
+        if ((i % 50) == 0 || i == 127)
+        {
+            sent[j++] = '\0';
+        }
+        sent[j++] = line[i];
+    }
+    sent[j++] = '\0';
+
+    Reset(script);
+    modem.isEchoOn = false;
+    hostIdleHook = IdleUntilInterrupt;
+
+    // More than the TX queue holds, it waits in Idle for room. The IPL it
+    //  was called at is put back, not forced to 0. The NULL chars
+    //  in it are skipped
+    idleCalls = 0;
+    SRbits.IPL = 2;
+    UART_Write_Buffer(sent, j);
+    CHECK(SRbits.IPL == 2);
+    CHECK(idleCalls > 0);
+    CHECK(uartTx_QueueCount(&TX_Queue) > 0);
+
+    // Waits through the last byte out of the shift register, waking once a
+    //  byte
+    UART_Write_Buffer("\r", 1);
+    idleCalls = 0;
+    UART_WaitTxDone();
+    CHECK(SRbits.IPL == 2);
+    CHECK(U1STAbits.TRMT);
+    CHECK(UART_IsTxIdle());
+    CHECK(idleCalls <= UART_TX_QUEUE_SIZE + 4 + 1);
+    CHECK(U1STAbits.UTXISEL0 == 0);
+    CHECK(modem.step == 1);
+    CHECK(modem.wrongLines == 0);
+
+    SRbits.IPL = 0;
+    hostIdleHook = NULL;
+
+    // Nothing left waiting on the U1TX interrupt
+    RunMS(5);
+    CHECK(!IEC0bits.U1TXIE);
+}
+
+int main(void)
+{
+    InitDeferredWork();
+    TMR1_Initialize();
+    InitTimerService();
+    UART_Init();
+    AT_Init();
+    U1STAbits.TRMT = true;
+
+    TestTextMessage();
+    TestErrors();
+    TestTimeout();
+    TestURCs();
+    TestLongLine();
+    TestPowerDown();
+    TestBlockingWrites();
+
+    return TestsFinished("test_at_commands");
+}
@@ -0,0 +1,92 @@
+/*
+ * File:   test_atan2.c
+ */
+
+
+#include <math.h>
+#include "host.h"
+#include "utilities.h"
+
+/*
+ Atan2Centidegrees against the C library atan2 for every pair of 12 bit ADC
+ readings GetHandleAngle can be handed, 4096 x 4096 of them. The lookup
+ table interpolation is good to 2 hundredths of a degree everywhere.
+ */
+
+#define ADC_COUNTS          4096
+#define WORST_ERROR_LIMIT   2.0 // Hundredths of a degree
+
+static double LibraryCentidegrees(int y, int x)
+{
+    return atan2(y, x) * 18000.0 / M_PI;
+}
+
+static void TestEveryReading(void)
+{
+    double worstError = 0;
+    int worstX = 0, worstY = 0;
+    int xAxis, yAxis;
+
+    for (xAxis = 0; xAxis < ADC_COUNTS; xAxis++)
+    {
+        for (yAxis = 0; yAxis < ADC_COUNTS; yAxis++)
+        {
+            int x = xAxis - c_AdjustmentFactor;
+            int y = yAxis - c_AdjustmentFactor;
+            double error = Atan2Centidegrees(y, x) - LibraryCentidegrees(y, x);
+
+            // -18000 and 18000 are the same direction
+            if (error > 18000)
+            {
+                error -= 36000;
+            }
+            else if (error < -18000)
+            {
+                error += 36000;
+            }
+
+            if (fabs(error) > worstError)
+            {
+                worstError = fabs(error);
+                worstX = x;
+                worstY = y;
+            }
+        }
+    }
+
+    printf("atan2: worst error %.3f centidegrees at x %d, y %d\n",
+            worstError, worstX, worstY);
+    CHECK(worstError < WORST_ERROR_LIMIT);
+}
+
+static void TestAxes(void)
+{
+    CHECK(Atan2Centidegrees(0, 0) == 0);
+    CHECK(Atan2Centidegrees(0, 2047) == 0);
+    CHECK(Atan2Centidegrees(2047, 0) == 9000);
+    CHECK(Atan2Centidegrees(0, -2047) == 18000);
+    CHECK(Atan2Centidegrees(-2047, 0) == -9000);
+    CHECK(Atan2Centidegrees(1000, 1000) == 4500);
+    CHECK(Atan2Centidegrees(-1000, -1000) == -13500);
+}
+
+static void TestHandleLimits(void)
+{
+    uint16_t center = c_AdjustmentFactor;
+
+    // Straight along x is level, past the pump's stops it is held at them
+    CHECK(GetHandleAngle(center + 1000, center) == 0);
+    CHECK(GetHandleAngle(center + 1000, center + 1000) == 2000);
+    CHECK(GetHandleAngle(center + 1000, center - 1000) == -3000);
+    CHECK(GetHandleAngle(center + 1000, center - 300) ==
+            Atan2Centidegrees(-300, 1000));
+}
+
+int main(void)
+{
+    TestAxes();
+    TestHandleLimits();
+    TestEveryReading();
+
+    return TestsFinished("test_atan2");
+}
@@ -0,0 +1,297 @@
+/*
+ * File:   test_filter.c
+ */
+
+
+#include <stdlib.h>
+#include <time.h>
+#include "host.h"
+#include "filter.h"
+
+/*
+ The running-sum moving average against a plain average of the last
+ ANGLE_FILTER_SIZE samples, worked out from scratch every update, and against
+ the float queue average it replaced. The plain average floors, as the shift
+ does, and must match exactly. The float average must be within a hundredth
+ of a degree. Then both filters are timed on the PC.
+ */
+
+#define TRACE_SAMPLES       100000UL
+#define BENCH_SAMPLES       10000000UL
+#define OLD_WINDOW          10 // ANGLES_TO_AVERAGE before the running sum
+
+/*
+ The float queue average as it was, pulling and re-pushing every element for
+ each average. Only kept here to compare against.
+ */
+typedef struct float_queue {
+    float contents[OLD_WINDOW];
+    int front;
+    int back;
+    int maxSize;
+    int cnt;
+} float_queue;
+
+static void float_InitQueue(float_queue *queueP, uint8_t queueSize)
+{
+    queueP->maxSize = queueSize;
+    queueP->cnt = 0;
+    queueP->front = -1;
+    queueP->back = -1;
+}
+
+static bool float_PushQueue(float_queue *queueP, float element)
+{
+    if (queueP->cnt == queueP->maxSize)
+    {
+        return false;
+    }
+    queueP->back++;
+    if (queueP->back == queueP->maxSize)
+    {
+        queueP->back = 0;
+    }
+    queueP->contents[queueP->back % queueP->maxSize] = element;
+    queueP->cnt++;
+    return true;
+}
+
+static float float_PullQueue(float_queue *queueP)
+{
+    if (queueP->cnt == 0)
+    {
+        return 0;
+    }
+    queueP->front++;
+    if (queueP->front == queueP->maxSize)
+    {
+        queueP->front = 0;
+    }
+    queueP->cnt--;
+    return queueP->contents[queueP->front % queueP->maxSize];
+}
+
+static float float_AverageQueueElements(float_queue *queueP)
+{
+    int i;
+    int cnt = queueP->cnt;
+    float acc = 0;
+
+    if (cnt == 0)
+    {
+        return 0;
+    }
+    for (i = 0; i < cnt; i++)
+    {
+        float added = float_PullQueue(queueP);
+        acc += added;
+        float_PushQueue(queueP, added);
+    }
+
+    return acc / cnt;
+}
+
+/**
+ * Description: One sample through the old average, as ProcessAccelQueue did.
+ */
+static float OldAverage(float_queue *queueP, int16_t sample)
+{
+    if (queueP->cnt == queueP->maxSize)
+    {
+        float_PullQueue(queueP);
+    }
+    float_PushQueue(queueP, sample);
+
+    return float_AverageQueueElements(queueP);
+}
+
+/**
+ * Description: The last ANGLE_FILTER_SIZE samples summed from scratch. Before
+ *      there are that many, the first sample stands in for the rest.
+ */
+static int16_t PlainAverage(const int16_t *history, uint32_t count)
+{
+    int32_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < ANGLE_FILTER_SIZE; i++)
+    {
+        sum += (i < count) ? history[count - 1 - i] : history[0];
+    }
+
+    // Floored, like the shift
+    if (sum < 0)
+    {
+        return (int16_t)-((-sum + ANGLE_FILTER_SIZE - 1) / ANGLE_FILTER_SIZE);
+    }
+    return (int16_t)(sum / ANGLE_FILTER_SIZE);
+}
+
+/**
+ * Description: A handle angle trace: strokes between the -30 and 20 degree
+ *      limits with some noise, then stretches of anything in the full range.
+ */
+static int16_t TraceSample(uint32_t i)
+{
+    if ((i / 5000) & 0x1)
+    {
+        return (int16_t)(rand() % 36001 - 18000);
+    }
+
+    return (int16_t)(-500 + 2500 * ((int32_t)(i % 60) - 30) / 30 +
+            rand() % 101 - 50);
+}
+
+static void TestAgainstPlainAverage(void)
+{
+    static int16_t history[TRACE_SAMPLES];
+    moving_average filter;
+    float_queue oldQueue;
+    uint32_t i;
+    uint32_t mismatches = 0;
+    float worstOld = 0;
+
+    InitMovingAverage(&filter);
+    float_InitQueue(&oldQueue, ANGLE_FILTER_SIZE);
+    for (i = 0; i < TRACE_SAMPLES; i++)
+    {
+        int16_t average;
+        float old;
+        float error;
+
+        history[i] = TraceSample(i);
+        average = UpdateMovingAverage(&filter, history[i]);
+        if (average != PlainAverage(history, i + 1))
+        {
+            mismatches++;
+        }
+
+        // The old queue ramps up from empty, so only once it is full
+        old = OldAverage(&oldQueue, history[i]);
+        error = (old > average) ? old - average : average - old;
+        if (i >= ANGLE_FILTER_SIZE && error > worstOld)
+        {
+            worstOld = error;
+        }
+    }
+
+    printf("filter: worst %.3f centidegrees from the float average\n",
+            worstOld);
+    CHECK(mismatches == 0);
+    CHECK(worstOld < 1.0f);
+}
+
+static void TestPrimed(void)
+{
+    moving_average filter;
+
+    InitMovingAverage(&filter);
+    CHECK(UpdateMovingAverage(&filter, -2400) == -2400);
+    // The first sample filled the whole window
+    CHECK(UpdateMovingAverage(&filter, 800) ==
+            (-2400 * (ANGLE_FILTER_SIZE - 1) + 800) / ANGLE_FILTER_SIZE);
+
+    // Init empties it again
+    InitMovingAverage(&filter);
+    CHECK(UpdateMovingAverage(&filter, 1500) == 1500);
+}
+
+/**
+ * Description: Angles near +-180 degrees, where the sum of a full window is
+ *      well past int16_t. The average is a straight one, not around the
+ *      circle, which is all the -30 to 20 degree handle needs.
+ */
+static void TestSigns(void)
+{
+    moving_average filter;
+    uint8_t i;
+    int16_t average = 0;
+
+    InitMovingAverage(&filter);
+    for (i = 0; i < ANGLE_FILTER_SIZE; i++)
+    {
+        average = UpdateMovingAverage(&filter, -17999);
+    }
+    CHECK(average == -17999);
+
+    // Walks up to the other end without wrapping
+    for (i = 0; i < ANGLE_FILTER_SIZE; i++)
+    {
+        int16_t next = UpdateMovingAverage(&filter, 18000);
+
+        CHECK(next > average);
+        average = next;
+    }
+    CHECK(average == 18000);
+
+    // Half each way is 0, and a hundredth below it floors to -1
+    for (i = 0; i < ANGLE_FILTER_SIZE; i++)
+    {
+        average = UpdateMovingAverage(&filter, (i & 0x1) ? 18000 : -18000);
+    }
+    CHECK(average == 0);
+    InitMovingAverage(&filter);
+    UpdateMovingAverage(&filter, 0);
+    CHECK(UpdateMovingAverage(&filter, -1) == -1);
+    CHECK(UpdateMovingAverage(&filter, 1) == 0);
+}
+
+static double ElapsedNS(const struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * Description: Times both filters over the same samples. The sums are
+ *      printed so the compiler keeps the work.
+ */
+static void Benchmark(void)
+{
+    static int16_t samples[4096];
+    moving_average filter;
+    float_queue oldQueue;
+    struct timespec start;
+    double newNS, oldNS;
+    int32_t newSum = 0;
+    float oldSum = 0;
+    uint32_t i;
+
+    for (i = 0; i < 4096; i++)
+    {
+        samples[i] = TraceSample(i);
+    }
+
+    InitMovingAverage(&filter);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_SAMPLES; i++)
+    {
+        newSum += UpdateMovingAverage(&filter, samples[i & 4095]);
+    }
+    newNS = ElapsedNS(&start) / BENCH_SAMPLES;
+
+    float_InitQueue(&oldQueue, OLD_WINDOW);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_SAMPLES; i++)
+    {
+        oldSum += OldAverage(&oldQueue, samples[i & 4095]);
+    }
+    oldNS = ElapsedNS(&start) / BENCH_SAMPLES;
+
+    printf("filter: %.1fns an update, %.1fns for the float queue average "
+            "(%ld, %.0f)\n", newNS, oldNS, (long)newSum, oldSum);
+    CHECK(newNS < oldNS);
+}
+
+int main(void)
+{
+    srand(6);
+    TestAgainstPlainAverage();
+    TestPrimed();
+    TestSigns();
+    Benchmark();
+
+    return TestsFinished("test_filter");
+}
@@ -0,0 +1,375 @@
+/*
+ * File:   test_i2c_engine.c
+ */
+
+
+#include <string.h>
+#include "host.h"
+#include "utilities.h"
+#include "I2C_Engine.h"
+#include "I2C_Functions.h"
+#include "deferred_work.h"
+#include "timer_service.h"
+#include "tmr1.h"
+
+/*
+ The RTCC sync run against a simulated I2C module with an MCP7940 on the
+ bus, a millisecond at a time on a simulated Timer1. The MCP7940 can be
+ made to NACK its address, as if it were missing, to hang the bus until the
+ module is reset, or to hold SDA low until the master clocks SCL, as if it
+ were reset half way through a read. A start, restart or stop with SDA held
+ low is a bus collision.
+ */
+
+#define NO_BYTE         0xFFFF // I2C1TRN when there is nothing to send
+
+typedef enum {
+            BUS_IDLE,
+            BUS_ADDRESS, // Start or restart sent, next byte is the address
+            BUS_WRITE,
+            BUS_READ,
+            BUS_IGNORED // Address NACKed, nothing answers till the stop
+} BUS_PHASE;
+
+typedef struct {
+    bool isMissing; // NACK the address
+    bool isHung; // Nothing completes until the module is reset
+    bool isSdaStuck; // Hold SDA low
+    uint8_t clocksToRelease; // SCL clocks before a stuck SDA is let go
+    uint8_t clocks;
+    uint8_t lastScl;
+    BUS_PHASE phase;
+    uint8_t pointer; // Register the next read comes from
+    uint8_t registers[RTCC_TIME_REGISTERS];
+    uint8_t reads; // Bytes read in this transaction
+    uint8_t acks; // ACKs the master sent in this transaction
+    uint8_t nacks;
+    uint16_t starts; // Start conditions the module was asked for
+    uint16_t stops;
+    uint16_t completeReads; // Read all the time registers, ACKed right
+    uint16_t resets; // The module was turned off to reset the bus
+    uint16_t resetsInISR;
+    uint32_t startTimes[16]; // GetTimeMS of each start
+} mcp7940;
+
+static mcp7940 slave;
+
+/**
+ * Description: Moves the I2C module on by one operation, the way the real
+ *      one would have finished it by the next tick.
+ */
+static void StepI2CModule(void)
+{
+    volatile host_sfr_bits *con = &hostI2C1CONbits;
+
+    if (!con->I2CEN)
+    {
+        // Turning the module off ends whatever it was doing
+        if (con->SEN || con->RSEN || con->PEN || con->RCEN || con->ACKEN)
+        {
+            slave.resets++;
+            slave.resetsInISR += hostInISR;
+        }
+        con->SEN = con->RSEN = con->PEN = con->RCEN = con->ACKEN = 0;
+        I2C1TRN = NO_BYTE;
+        slave.phase = BUS_IDLE;
+        slave.isHung = false;
+        return;
+    }
+
+    if (slave.isHung)
+    {
+        // Nothing gets onto the bus, and no interrupt comes
+        return;
+    }
+
+    if (slave.isSdaStuck && (con->SEN || con->RSEN || con->PEN))
+    {
+        slave.starts += con->SEN;
+        con->SEN = con->RSEN = con->PEN = 0;
+        I2C1STATbits.BCL = 1;
+        IFS1bits.MI2C1IF = true;
+        return;
+    }
+
+    if (con->SEN || con->RSEN)
+    {
+        if (con->SEN && slave.starts < 16)
+        {
+            slave.startTimes[slave.starts] = GetTimeMS();
+        }
+        slave.starts += con->SEN;
+        con->SEN = con->RSEN = 0;
+        slave.phase = BUS_ADDRESS;
+    }
+    else if (con->PEN)
+    {
+        con->PEN = 0;
+        slave.stops++;
+        if (slave.reads == RTCC_TIME_REGISTERS &&
+                slave.acks == RTCC_TIME_REGISTERS - 1 && slave.nacks == 1)
+        {
+            slave.completeReads++;
+        }
+        slave.reads = slave.acks = slave.nacks = 0;
+        slave.phase = BUS_IDLE;
+    }
+    else if (I2C1TRN != NO_BYTE)
+    {
+        uint8_t txByte = I2C1TRN;
+
+        I2C1TRN = NO_BYTE;
+        I2C1STATbits.ACKSTAT = 0;
+        if (slave.phase == BUS_ADDRESS)
+        {
+            if (slave.isMissing || (txByte >> 1) != RTCC_I2C_ADDRESS)
+            {
+                I2C1STATbits.ACKSTAT = 1;
+                slave.phase = BUS_IGNORED;
+            }
+            else
+            {
+                slave.phase = (txByte & 0x01) ? BUS_READ : BUS_WRITE;
+            }
+        }
+        else if (slave.phase == BUS_WRITE)
+        {
+            slave.pointer = txByte;
+        }
+        else
+        {
+            I2C1STATbits.ACKSTAT = 1;
+        }
+    }
+    else if (con->RCEN)
+    {
+        con->RCEN = 0;
+        I2C1RCV = slave.registers[slave.pointer++ % RTCC_TIME_REGISTERS];
+        slave.reads++;
+    }
+    else if (con->ACKEN)
+    {
+        con->ACKEN = 0;
+        if (con->ACKDT)
+        {
+            slave.nacks++;
+        }
+        else
+        {
+            slave.acks++;
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    IFS1bits.MI2C1IF = true;
+}
+
+/**
+ * Description: Watches SCL while the firmware bit bangs the bus. A stuck
+ *      slave lets SDA go after clocksToRelease clocks.
+ */
+static void WatchPins(volatile host_sfr_bits *sfr)
+{
+    if (sfr == &hostI2C1CONbits)
+    {
+        // The blocking I2C functions spin on these, finish them as they do
+        StepI2CModule();
+        return;
+    }
+
+    if (hostPORTBbits.RB8 && !slave.lastScl && slave.isSdaStuck)
+    {
+        slave.clocks++;
+        if (slave.clocks >= slave.clocksToRelease)
+        {
+            slave.isSdaStuck = false;
+        }
+    }
+    slave.lastScl = hostPORTBbits.RB8;
+    hostPORTBbits.RB9 = !slave.isSdaStuck;
+}
+
+/**
+ * Description: What main does with the events the test cares about.
+ */
+static void RunMainLoop(void)
+{
+    uint16_t events = TakeEvents();
+
+    if (events & EVENT_WORK_POSTED)
+    {
+        RunDeferredWork();
+    }
+
+    if (events & EVENT_RTCC_SYNC)
+    {
+        RetryRTCCSync();
+    }
+}
+
+static void RunMS(uint32_t ms)
+{
+    uint32_t tick;
+
+    for (tick = 0; tick < ms * TMR1_TICKS_PER_MS; tick++)
+    {
+        StepI2CModule();
+        if (IFS1bits.MI2C1IF && IEC1bits.MI2C1IE)
+        {
+            HostInterrupt(_MI2C1Interrupt);
+        }
+
+        HostTimer1Tick();
+
+        if (tick % TMR1_TICKS_PER_MS == 0)
+        {
+            RunMainLoop();
+        }
+    }
+}
+
+static void Reset(void)
+{
+    uint8_t registers[RTCC_TIME_REGISTERS] = {
+        0x80 | 0x30, 0x15, 0x01, 0x08 | 0x05, 0x16, 0x10, 0x26
+    };
+
+    memset(&slave, 0, sizeof(slave));
+    memcpy(slave.registers, registers, sizeof(registers));
+    hostI2C1CONbits.I2CEN = 1;
+    hostPORTBbits.RB9 = 1;
+    I2C1TRN = NO_BYTE;
+    IEC3bits.RTCIE = false;
+    RunMS(1);
+}
+
+static void TestRead(void)
+{
+    // ~99kHz from the 2MHz Tcy, the pulse gobbler delay included
+    CHECK(I2C1BRG == 0x13);
+
+    Reset();
+    SyncRTCCTime();
+    RunMS(10);
+
+    CHECK(slave.starts == 1);
+    CHECK(slave.completeReads == 1);
+    CHECK(slave.stops == 1);
+    CHECK(IEC3bits.RTCIE);
+    CHECK(I2C_IsEngineIdle());
+}
+
+static void TestMissingRTCC(void)
+{
+    uint32_t expectedGapMS = RTCC_SYNC_RETRY_MS;
+    uint8_t i;
+
+    Reset();
+    slave.isMissing = true;
+    SyncRTCCTime();
+    RunMS(60000);
+
+    // Each try waits twice as long, then it gives up and keeps the time
+    //  the internal RTCC has
+    CHECK(slave.starts == RTCC_SYNC_TRIES);
+    for (i = 1; i < RTCC_SYNC_TRIES && i < slave.starts; i++)
+    {
+        uint32_t gapMS = slave.startTimes[i] - slave.startTimes[i - 1];
+
+        CHECK(gapMS >= expectedGapMS && gapMS <= expectedGapMS + 2);
+        expectedGapMS *= 2;
+    }
+    CHECK(slave.completeReads == 0);
+    CHECK(IEC3bits.RTCIE);
+
+    RunMS(60000);
+    CHECK(slave.starts == RTCC_SYNC_TRIES);
+    CHECK(I2C_IsEngineIdle());
+
+    // The next daily sync starts over
+    slave.isMissing = false;
+    SyncRTCCTime();
+    RunMS(10);
+    CHECK(slave.completeReads == 1);
+}
+
+static void TestHungBus(void)
+{
+    Reset();
+    slave.isHung = true;
+    SyncRTCCTime();
+
+    // The start never finishes, the timeout resets the bus from the main
+    //  loop
+    RunMS(I2C_DEFAULT_TIMEOUT_MS + 5);
+    CHECK(slave.resets == 1);
+    CHECK(slave.resetsInISR == 0);
+    CHECK(slave.completeReads == 0);
+    CHECK(I2C_IsEngineIdle());
+
+    // The retry gets through
+    RunMS(RTCC_SYNC_RETRY_MS);
+    CHECK(slave.completeReads == 1);
+    CHECK(IEC3bits.RTCIE);
+}
+
+static void TestStuckSDA(void)
+{
+    Reset();
+    slave.isSdaStuck = true;
+    slave.clocksToRelease = 3;
+    SyncRTCCTime();
+
+    // The start collides, and the bus is reset from the main loop, clocking
+    //  SDA free
+    RunMS(5);
+    CHECK(slave.starts == 1);
+    CHECK(slave.clocks == 3);
+    CHECK(!slave.isSdaStuck);
+    CHECK(I2C1STATbits.BCL == 0);
+    CHECK(slave.completeReads == 0);
+    CHECK(I2C_IsEngineIdle());
+
+    // The retry gets through
+    RunMS(RTCC_SYNC_RETRY_MS);
+    CHECK(slave.starts == 2);
+    CHECK(slave.completeReads == 1);
+    CHECK(IEC3bits.RTCIE);
+}
+
+static void TestSDAStuckForGood(void)
+{
+    Reset();
+    slave.isSdaStuck = true;
+    slave.clocksToRelease = 255;
+    SyncRTCCTime();
+    RunMS(60000);
+
+    // Every try collides and has the bus clocked, then it gives up
+    CHECK(slave.starts == RTCC_SYNC_TRIES);
+    CHECK(slave.clocks >= RTCC_SYNC_TRIES * 9);
+    CHECK(slave.completeReads == 0);
+    CHECK(IEC3bits.RTCIE);
+    CHECK(I2C_IsEngineIdle());
+}
+
+int main(void)
+{
+    InitDeferredWork();
+    I2C_Init();
+    I2C_EngineInit();
+    TMR1_Initialize();
+    InitTimerService();
+    hostSfrHook = WatchPins;
+
+    TestRead();
+    TestMissingRTCC();
+    TestHungBus();
+    TestStuckSDA();
+    TestSDAStuckForGood();
+
+    return TestsFinished("test_i2c_engine");
+}
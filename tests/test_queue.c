@@ -0,0 +1,180 @@
+/*
+ * File:   test_queue.c
+ */
+
+
+#include <signal.h>
+#include <sys/time.h>
+#include "host.h"
+#include "queue.h"
+
+/*
+ The queues are shared by an ISR and the main loop with nothing turned off.
+ Here a timer signal plays the ISR: it cuts into the main thread wherever it
+ happens to be, runs to the end and returns, just as an interrupt does. It
+ pushes the next part of a counting sequence, while the main thread pulls it
+ with every consumer call. Any lost, repeated or reordered element breaks
+ the count.
+ */
+
+#define STRESS_ELEMENTS     1000000UL
+#define STRESS_QUEUE_SIZE   16
+#define STRESS_PERIOD_US    20 // Between "interrupts"
+
+DECLARE_QUEUE(stress, uint8_t, STRESS_QUEUE_SIZE)
+DEFINE_QUEUE(stress, uint8_t, STRESS_QUEUE_SIZE)
+
+static stress_queue queue;
+static volatile uint32_t sent = 0;
+static volatile uint32_t interrupts = 0;
+
+/**
+ * Description: The ISR side. Pushes the next 1 to 16 of 0, 1, 2, ...
+ *      (mod 256), one at a time or as a run, as many as fit.
+ */
+static void Producer(int signal)
+{
+    uint8_t run[STRESS_QUEUE_SIZE];
+    uint8_t count = 1 + interrupts % STRESS_QUEUE_SIZE;
+    uint8_t i;
+
+    interrupts++;
+    if (sent + count > STRESS_ELEMENTS)
+    {
+        count = STRESS_ELEMENTS - sent;
+    }
+
+    if (interrupts & 0x1)
+    {
+        for (i = 0; i < count && stress_PushQueue(&queue, (uint8_t)sent); i++)
+        {
+            sent++;
+        }
+    }
+    else
+    {
+        for (i = 0; i < count; i++)
+        {
+            run[i] = (uint8_t)(sent + i);
+        }
+        sent += stress_PushNQueue(&queue, run, count);
+    }
+}
+
+/**
+ * Description: Takes the next element out with the consumer call picked by
+ *      step, and checks it against the count.
+ * @return the number of elements taken
+ */
+static uint8_t Consume(uint32_t step, uint8_t expected)
+{
+    uint8_t data[STRESS_QUEUE_SIZE];
+    uint8_t count = stress_QueueCount(&queue);
+    uint8_t taken = 0;
+    uint8_t i;
+
+    CHECK(count <= STRESS_QUEUE_SIZE);
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    switch (step % 4)
+    {
+        case 0:
+            CHECK(stress_PullQueue(&queue) == expected);
+            taken = 1;
+            break;
+
+        case 1:
+            taken = stress_PullNQueue(&queue, data, 1 + step % 7);
+            for (i = 0; i < taken; i++)
+            {
+                CHECK(data[i] == (uint8_t)(expected + i));
+            }
+            break;
+
+        case 2:
+            // Only what was counted is sure to be there, more may arrive
+            CHECK(stress_PeekQueue(&queue, count - 1) ==
+                    (uint8_t)(expected + count - 1));
+            data[0] = expected + count - 1;
+            CHECK(stress_FindQueue(&queue, data, 1) == count - 1);
+            stress_DiscardQueue(&queue, count);
+            taken = count;
+            break;
+
+        default:
+            CHECK(!stress_IsQueueEmpty(&queue));
+            CHECK(stress_PullQueue(&queue) == expected);
+            taken = 1;
+            break;
+    }
+
+    return taken;
+}
+
+static void TestInterleaving(void)
+{
+    struct itimerval period = { { 0, STRESS_PERIOD_US }, { 0, STRESS_PERIOD_US } };
+    struct itimerval stop = { { 0, 0 }, { 0, 0 } };
+    uint32_t received = 0;
+    uint32_t step = 0;
+    int failuresBefore = testFailures;
+
+    stress_InitQueue(&queue);
+    signal(SIGALRM, Producer);
+    setitimer(ITIMER_REAL, &period, NULL);
+
+    // Stop at the first failure, after that every element would fail
+    while (received < STRESS_ELEMENTS && testFailures == failuresBefore)
+    {
+        received += Consume(step++, (uint8_t)received);
+    }
+
+    setitimer(ITIMER_REAL, &stop, NULL);
+    printf("queue: %u elements over %u interrupts\n", (unsigned)received,
+            (unsigned)interrupts);
+    CHECK(received == STRESS_ELEMENTS);
+    CHECK(sent == STRESS_ELEMENTS);
+    CHECK(stress_IsQueueEmpty(&queue));
+}
+
+static void TestFullAndWrap(void)
+{
+    uint8_t data[STRESS_QUEUE_SIZE + 4];
+    uint8_t i;
+
+    stress_InitQueue(&queue);
+
+    // Run head and tail most of the way round their uint8_t range
+    for (i = 0; i < 250; i++)
+    {
+        CHECK(stress_PushQueue(&queue, i));
+        CHECK(stress_PullQueue(&queue) == i);
+    }
+
+    for (i = 0; i < sizeof(data); i++)
+    {
+        data[i] = i;
+    }
+    CHECK(stress_PushNQueue(&queue, data, sizeof(data)) == STRESS_QUEUE_SIZE);
+    CHECK(stress_IsQueueFull(&queue));
+    CHECK(!stress_PushQueue(&queue, 0xFF));
+    CHECK(stress_QueueCount(&queue) == STRESS_QUEUE_SIZE);
+
+    for (i = 0; i < STRESS_QUEUE_SIZE; i++)
+    {
+        CHECK(stress_PullQueue(&queue) == i);
+    }
+    CHECK(stress_IsQueueEmpty(&queue));
+    CHECK(stress_PullQueue(&queue) == 0);
+}
+
+int main(void)
+{
+    TestFullAndWrap();
+    TestInterleaving();
+
+    return TestsFinished("test_queue");
+}
@@ -0,0 +1,399 @@
+/*
+ * File:   test_report_codec.c
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+#include "report_codec.h"
+
+/*
+ Reports packed into text and read back with Report_Decode, the way the
+ server reads them. Random days of typical pumping and random days of junk,
+ every field at its largest, days going backwards and across the whole
+ range the RTCC has, texts a gateway trimmed the spaces off, and texts that
+ aren't reports at all, which must read back as nothing.
+ */
+
+#define ROUND_TRIPS     100000
+#define MAX_REPORTS     10
+#define FIRMWARE        0x20
+
+static uint32_t typicalTexts = 0;
+static uint32_t typicalReports = 0;
+
+static void RandomReport(daily_report *report, bool isTypical)
+{
+    uint8_t i;
+
+    memset(report, 0, sizeof(*report));
+    report->year = rand() % 100;
+    report->month = 1 + rand() % 12;
+    report->day = 1 + rand() % 28;
+    report->diagnostics = rand() & 0xFF;
+
+    if (isTypical)
+    {
+        report->leakRate = rand() % 200;
+        report->longestPrime = rand() % 100;
+        report->batteryMV = 3500 + rand() % 800;
+        for (i = 0; i < 12; i++)
+        {
+            report->volume[i] = rand() % 1500;
+        }
+        report->fastMinutes = rand() % 300;
+        report->idleMinutes = 1440 - report->fastMinutes;
+        report->modemSeconds = rand() % 3000;
+    }
+    else
+    {
+        report->leakRate = rand();
+        report->longestPrime = rand();
+        report->batteryMV = rand();
+        for (i = 0; i < 12; i++)
+        {
+            report->volume[i] = (rand() & 1) ? 0xFFFF : rand();
+        }
+        report->fastMinutes = rand();
+        report->idleMinutes = rand();
+        report->modemSeconds = ((uint32_t)rand() << 1) ^ rand();
+    }
+}
+
+static void SetDay(daily_report *report, uint8_t year, uint8_t month,
+        uint8_t day)
+{
+    report->year = year;
+    report->month = month;
+    report->day = day;
+}
+
+/**
+ * Description: Whether two reports hold the same day, field by field. The
+ *      PC compiler pads the struct, so it can't be compared whole.
+ */
+static bool SameReports(const daily_report *a, const daily_report *b,
+        uint8_t count)
+{
+    uint8_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (a[i].year != b[i].year || a[i].month != b[i].month ||
+                a[i].day != b[i].day ||
+                a[i].diagnostics != b[i].diagnostics ||
+                a[i].leakRate != b[i].leakRate ||
+                a[i].longestPrime != b[i].longestPrime ||
+                a[i].batteryMV != b[i].batteryMV ||
+                memcmp(a[i].volume, b[i].volume, sizeof(a[i].volume)) != 0 ||
+                a[i].fastMinutes != b[i].fastMinutes ||
+                a[i].idleMinutes != b[i].idleMinutes ||
+                a[i].modemSeconds != b[i].modemSeconds)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Description: Sends reports as one text and checks they all come back.
+ * @return uint8_t characters in the text
+ */
+static uint8_t RoundTrip(const daily_report *reports, uint8_t count,
+        char *text)
+{
+    report_message message;
+    daily_report decoded[MAX_REPORTS];
+    uint8_t firmware = 0;
+    uint8_t length;
+    uint8_t i;
+
+    Report_Begin(&message, FIRMWARE);
+    for (i = 0; i < count; i++)
+    {
+        CHECK(Report_Add(&message, &reports[i]));
+    }
+    CHECK(message.count == count);
+    CHECK(message.length <= REPORT_MAX_BYTES);
+
+    length = Report_ToText(&message, text);
+    CHECK(length == Report_TextLength(message.length));
+    CHECK(length <= REPORT_TEXT_LENGTH);
+
+    CHECK(Report_Decode(text, length, decoded, MAX_REPORTS, &firmware) ==
+            count);
+    CHECK(firmware == FIRMWARE);
+    CHECK(SameReports(reports, decoded, count));
+
+    return length;
+}
+
+static void TestDayIndex(void)
+{
+    uint16_t index;
+
+    // Against the C library, every day the RTCC can hold
+    for (index = 0; index < 36525; index++)
+    {
+        time_t seconds = 946684800 + (time_t)index * 86400;
+        struct tm date;
+
+        gmtime_r(&seconds, &date);
+        if (Report_DayIndex(date.tm_year - 100, date.tm_mon + 1,
+                date.tm_mday) != index)
+        {
+            printf("day index %u is wrong\n", index);
+            testFailures++;
+            break;
+        }
+    }
+}
+
+static void TestRandomRoundTrips(void)
+{
+    daily_report reports[MAX_REPORTS];
+    report_message message;
+    char text[REPORT_TEXT_LENGTH];
+    uint32_t trip;
+    uint8_t count;
+
+    for (trip = 0; trip < ROUND_TRIPS; trip++)
+    {
+        bool isTypical = (trip % 2) == 0;
+
+        // As many as fit in one text, the way the outbox fills them
+        Report_Begin(&message, FIRMWARE);
+        for (count = 0; count < MAX_REPORTS; count++)
+        {
+            RandomReport(&reports[count], isTypical);
+            if (!Report_Add(&message, &reports[count]))
+            {
+                break;
+            }
+        }
+        CHECK(count > 0);
+
+        RoundTrip(reports, count, text);
+        if (isTypical)
+        {
+            typicalTexts++;
+            typicalReports += count;
+        }
+    }
+}
+
+static void TestLargestRecord(void)
+{
+    daily_report reports[2];
+    report_message message;
+    char text[REPORT_TEXT_LENGTH];
+    uint8_t i;
+
+    // Every varint at its longest, and the bins swinging end to end
+    memset(reports, 0xFF, sizeof(reports));
+    for (i = 0; i < 12; i++)
+    {
+        reports[0].volume[i] = (i % 2 == 0) ? 0xFFFF : 0;
+        reports[1].volume[i] = (i % 2 == 0) ? 0 : 0xFFFF;
+    }
+    SetDay(&reports[0], 99, 12, 31);
+    SetDay(&reports[1], 0, 1, 1);
+
+    Report_Begin(&message, FIRMWARE);
+    CHECK(Report_Add(&message, &reports[0]));
+    CHECK(message.length - REPORT_HEADER_BYTES <= REPORT_RECORD_MAX_BYTES);
+    CHECK(Report_Add(&message, &reports[1]));
+    CHECK(message.length <= REPORT_MAX_BYTES);
+    CHECK(message.length - REPORT_HEADER_BYTES <=
+            2 * REPORT_RECORD_MAX_BYTES);
+
+    // A text holds 2 of the largest records, not 3
+    CHECK(!Report_Add(&message, &reports[0]));
+    CHECK(message.count == 2);
+    RoundTrip(reports, 2, text);
+
+    // Filled to the last byte, the text is exactly as long as a text can be
+    Report_Begin(&message, FIRMWARE);
+    memset(&message.bytes[REPORT_HEADER_BYTES], 0x80, REPORT_MAX_BYTES);
+    message.length = REPORT_MAX_BYTES;
+    CHECK(Report_ToText(&message, text) == REPORT_TEXT_LENGTH);
+}
+
+static void TestDayChanges(void)
+{
+    daily_report reports[3];
+    char text[REPORT_TEXT_LENGTH];
+    uint8_t i;
+
+    for (i = 0; i < 3; i++)
+    {
+        RandomReport(&reports[i], true);
+    }
+
+    // Across the end of a year, a leap day and back again
+    SetDay(&reports[0], 23, 12, 31);
+    SetDay(&reports[1], 24, 2, 29);
+    SetDay(&reports[2], 23, 12, 30);
+    RoundTrip(reports, 3, text);
+
+    // The largest changes there are, from the first day to the last and
+    //  back
+    SetDay(&reports[0], 0, 1, 1);
+    SetDay(&reports[1], 99, 12, 31);
+    SetDay(&reports[2], 0, 1, 1);
+    RoundTrip(reports, 3, text);
+}
+
+static void TestTrimmedSpaces(void)
+{
+    daily_report reports[MAX_REPORTS];
+    daily_report decoded[MAX_REPORTS];
+    char text[REPORT_TEXT_LENGTH];
+    uint8_t firmware;
+    uint8_t length;
+    uint8_t trimmed;
+    uint16_t found = 0;
+    uint32_t trip;
+
+    // Space is the top digit, texts ending in one are common enough to find
+    for (trip = 0; trip < ROUND_TRIPS && found < 100; trip++)
+    {
+        uint8_t count = 1 + rand() % 2;
+        uint8_t i;
+
+        for (i = 0; i < count; i++)
+        {
+            RandomReport(&reports[i], false);
+        }
+        length = RoundTrip(reports, count, text);
+
+        trimmed = length;
+        while (trimmed > 0 && text[trimmed - 1] == ' ')
+        {
+            trimmed--;
+        }
+        if (trimmed == length)
+        {
+            continue;
+        }
+        found++;
+
+        CHECK(Report_Decode(text, trimmed, decoded, MAX_REPORTS,
+                &firmware) == count);
+        CHECK(SameReports(reports, decoded, count));
+    }
+    CHECK(found == 100);
+}
+
+static void TestMalformed(void)
+{
+    daily_report reports[MAX_REPORTS];
+    daily_report decoded[MAX_REPORTS];
+    report_message message;
+    char text[REPORT_TEXT_LENGTH + 1];
+    char bad[REPORT_TEXT_LENGTH + 1];
+    uint8_t firmware;
+    uint8_t length;
+    uint8_t trimmed;
+    uint8_t cut;
+    uint8_t i;
+
+    for (i = 0; i < 3; i++)
+    {
+        RandomReport(&reports[i], true);
+    }
+    length = RoundTrip(reports, 3, text);
+
+    // Every length short of the whole text. There is no checksum, a text
+    //  cut near the end may still read, but never as the reports sent. Only
+    //  trimmed spaces come back.
+    trimmed = length;
+    while (trimmed > 0 && text[trimmed - 1] == ' ')
+    {
+        trimmed--;
+    }
+    for (cut = 0; cut <= length; cut++)
+    {
+        uint8_t count = Report_Decode(text, cut, decoded, MAX_REPORTS,
+                &firmware);
+
+        CHECK((count == 3 && SameReports(reports, decoded, 3)) ==
+                (cut >= trimmed));
+    }
+
+    // Too long for what the header says, and longer than a text
+    memcpy(bad, text, length);
+    bad[length] = '0';
+    CHECK(Report_Decode(bad, length + 1, decoded, MAX_REPORTS,
+            &firmware) == 0);
+    CHECK(Report_Decode(bad, REPORT_TEXT_LENGTH + 1, decoded, MAX_REPORTS,
+            &firmware) == 0);
+
+    // Characters that aren't digits, and a NUL
+    memcpy(bad, text, length);
+    bad[length / 2] = '~';
+    CHECK(Report_Decode(bad, length, decoded, MAX_REPORTS, &firmware) == 0);
+    bad[length / 2] = '\0';
+    CHECK(Report_Decode(bad, length, decoded, MAX_REPORTS, &firmware) == 0);
+
+    // No room for them all
+    CHECK(Report_Decode(text, length, decoded, 2, &firmware) == 0);
+
+    // Another format version, and a length past the end of a text
+    Report_Begin(&message, FIRMWARE);
+    message.bytes[0] = REPORT_FORMAT_VERSION + 1;
+    length = Report_ToText(&message, text);
+    CHECK(Report_Decode(text, length, decoded, MAX_REPORTS, &firmware) == 0);
+    Report_Begin(&message, FIRMWARE);
+    message.bytes[1] = REPORT_MAX_BYTES;
+    length = Report_ToText(&message, text);
+    CHECK(Report_Decode(text, length, decoded, MAX_REPORTS, &firmware) == 0);
+
+    // A record cut off part way, and a record that runs past the end
+    Report_Begin(&message, FIRMWARE);
+    CHECK(Report_Add(&message, &reports[0]));
+    message.length--;
+    message.bytes[1]--;
+    length = Report_ToText(&message, text);
+    CHECK(Report_Decode(text, length, decoded, MAX_REPORTS, &firmware) == 0);
+    Report_Begin(&message, FIRMWARE);
+    memset(&message.bytes[REPORT_HEADER_BYTES], 0xFF, 10);
+    message.length = REPORT_HEADER_BYTES + 10;
+    message.bytes[1] = 10;
+    length = Report_ToText(&message, text);
+    CHECK(Report_Decode(text, length, decoded, MAX_REPORTS, &firmware) == 0);
+
+    // The plain text the pump sent before reports
+    CHECK(Report_Decode("I'm alive!", 10, decoded, MAX_REPORTS,
+            &firmware) == 0);
+
+    // Random damage mustn't crash it
+    length = RoundTrip(reports, 3, text);
+    for (i = 0; i < 200; i++)
+    {
+        memcpy(bad, text, length);
+        bad[rand() % length] = (char)(rand() & 0x7F);
+        Report_Decode(bad, length, decoded, MAX_REPORTS, &firmware);
+    }
+}
+
+int main(void)
+{
+    srand(1);
+
+    TestDayIndex();
+    TestRandomRoundTrips();
+    TestLargestRecord();
+    TestDayChanges();
+    TestTrimmedSpaces();
+    TestMalformed();
+
+    printf("report codec: %.1f typical days a text\n",
+            (double)typicalReports / typicalTexts);
+
+    return TestsFinished("test_report_codec");
+}
@@ -0,0 +1,437 @@
+/*
+ * File:   test_rtcc_rollover.c
+ */
+
+
+#include <string.h>
+#include "host.h"
+#include "utilities.h"
+#include "I2C_Engine.h"
+#include "I2C_Functions.h"
+#include "deferred_work.h"
+#include "timer_service.h"
+#include "interrupt_handlers.h"
+#include "rtcc.h"
+#include "tmr1.h"
+
+/*
+ The volume bins and the midnight event, a second at a time over month and
+ year ends. The internal RTCC is modelled through its RTCVAL registers and
+ raises the hourly alarm, and an MCP7940 register model answers the boot
+ and daily syncs over a simulated I2C module. The internal RTCC loses a
+ second every RTCC_LOSES_EVERY_S, so the daily sync has something to fix.
+
+ Volume is added just before and just after every hour, and must only go
+ into the bin for the hour the internal RTCC shows. The midnight event must
+ come with the 00:00 alarm, once a day, and never at any other hour.
+ */
+
+#define NO_BYTE             0xFFFF // I2C1TRN when there is nothing to send
+#define RTCC_LOSES_EVERY_S  7200
+#define VOLUME_DELTA        300 // Hundredths of a degree, a few mL
+
+typedef enum {
+            BUS_IDLE,
+            BUS_ADDRESS, // Start or restart sent, next byte is the address
+            BUS_WRITE,
+            BUS_READ
+} BUS_PHASE;
+
+typedef struct {
+    BUS_PHASE phase;
+    uint8_t pointer; // Register the next read comes from
+    uint8_t registers[RTCC_TIME_REGISTERS];
+    uint16_t completeReads;
+} mcp7940;
+
+static mcp7940 slave;
+static uint32_t secondsRun;
+static uint16_t midnights;
+static uint16_t alarms;
+
+static uint8_t ToBcd(uint8_t value)
+{
+    return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+static uint8_t FromBcd(uint8_t bcd)
+{
+    return (uint8_t)((bcd >> 4) * 10 + (bcd & 0x0F));
+}
+
+static uint8_t DaysInMonth(uint8_t month, uint8_t year)
+{
+    static const uint8_t days[12] = {
+        31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+
+    if (month == 2 && (year % 4) == 0)
+    {
+        return 29;
+    }
+    return days[month - 1];
+}
+
+/**
+ * Description: One second on a calendar, the way both clocks count.
+ */
+static void AddSecond(time_s *t)
+{
+    if (++t->second < 60)
+    {
+        return;
+    }
+    t->second = 0;
+    if (++t->minute < 60)
+    {
+        return;
+    }
+    t->minute = 0;
+    if (++t->hour < 24)
+    {
+        return;
+    }
+    t->hour = 0;
+    t->wkDay = (t->wkDay % 7) + 1;
+    if (++t->mnDay <= DaysInMonth(t->month, t->year))
+    {
+        return;
+    }
+    t->mnDay = 1;
+    if (++t->month <= 12)
+    {
+        return;
+    }
+    t->month = 1;
+    t->year = (t->year + 1) % 100;
+}
+
+/**
+ * Description: The internal RTCC registers, in the layout RTCC_TimeSet
+ *      writes them.
+ */
+static time_s RtccTime(void)
+{
+    time_s t;
+
+    t.year = FromBcd(hostRTCVAL[3] & 0xFF);
+    t.month = FromBcd(hostRTCVAL[2] >> 8);
+    t.mnDay = FromBcd(hostRTCVAL[2] & 0xFF);
+    t.wkDay = FromBcd(hostRTCVAL[1] >> 8);
+    t.hour = FromBcd(hostRTCVAL[1] & 0xFF);
+    t.minute = FromBcd(hostRTCVAL[0] >> 8);
+    t.second = FromBcd(hostRTCVAL[0] & 0xFF);
+    return t;
+}
+
+static void SetRtccTime(const time_s *t)
+{
+    hostRTCVAL[3] = ToBcd(t->year);
+    hostRTCVAL[2] = ((uint16_t)ToBcd(t->month) << 8) | ToBcd(t->mnDay);
+    hostRTCVAL[1] = ((uint16_t)ToBcd(t->wkDay) << 8) | ToBcd(t->hour);
+    hostRTCVAL[0] = ((uint16_t)ToBcd(t->minute) << 8) | ToBcd(t->second);
+}
+
+/**
+ * Description: The MCP7940 registers, with ST and VBATEN set as the firmware
+ *      leaves them.
+ */
+static time_s SlaveTime(void)
+{
+    time_s t;
+
+    t.second = FromBcd(slave.registers[0] & 0x7F);
+    t.minute = FromBcd(slave.registers[1]);
+    t.hour = FromBcd(slave.registers[2] & 0x3F);
+    t.wkDay = FromBcd(slave.registers[3] & 0x07);
+    t.mnDay = FromBcd(slave.registers[4]);
+    t.month = FromBcd(slave.registers[5] & 0x1F);
+    t.year = FromBcd(slave.registers[6]);
+    return t;
+}
+
+static void SetSlaveTime(const time_s *t)
+{
+    slave.registers[0] = 0x80 | ToBcd(t->second);
+    slave.registers[1] = ToBcd(t->minute);
+    slave.registers[2] = ToBcd(t->hour);
+    slave.registers[3] = 0x08 | ToBcd(t->wkDay);
+    slave.registers[4] = ToBcd(t->mnDay);
+    slave.registers[5] = ToBcd(t->month);
+    slave.registers[6] = ToBcd(t->year);
+}
+
+static bool SameTime(const time_s *a, const time_s *b)
+{
+    return a->second == b->second && a->minute == b->minute &&
+            a->hour == b->hour && a->wkDay == b->wkDay &&
+            a->mnDay == b->mnDay && a->month == b->month &&
+            a->year == b->year;
+}
+
+/**
+ * Description: Moves the I2C module on by one operation, with the MCP7940
+ *      answering every read.
+ */
+static bool StepI2CModule(void)
+{
+    volatile host_sfr_bits *con = &hostI2C1CONbits;
+
+    if (con->SEN || con->RSEN)
+    {
+        con->SEN = con->RSEN = 0;
+        slave.phase = BUS_ADDRESS;
+    }
+    else if (con->PEN)
+    {
+        con->PEN = 0;
+        if (slave.phase == BUS_READ)
+        {
+            slave.completeReads++;
+        }
+        slave.phase = BUS_IDLE;
+    }
+    else if (I2C1TRN != NO_BYTE)
+    {
+        uint8_t txByte = I2C1TRN;
+
+        I2C1TRN = NO_BYTE;
+        I2C1STATbits.ACKSTAT = 0;
+        if (slave.phase == BUS_ADDRESS)
+        {
+            slave.phase = (txByte & 0x01) ? BUS_READ : BUS_WRITE;
+            I2C1STATbits.ACKSTAT = ((txByte >> 1) != RTCC_I2C_ADDRESS);
+        }
+        else if (slave.phase == BUS_WRITE)
+        {
+            slave.pointer = txByte;
+        }
+    }
+    else if (con->RCEN)
+    {
+        con->RCEN = 0;
+        I2C1RCV = slave.registers[slave.pointer++ % RTCC_TIME_REGISTERS];
+    }
+    else if (con->ACKEN)
+    {
+        con->ACKEN = 0;
+    }
+    else
+    {
+        return false;
+    }
+
+    IFS1bits.MI2C1IF = true;
+    return true;
+}
+
+/**
+ * Description: What main does with the events the test cares about, after
+ *      the I2C module has finished whatever it was given.
+ */
+static void RunMainLoop(void)
+{
+    uint16_t events;
+
+    do
+    {
+        // A submitted transaction kicks the engine with MI2C1IF
+        while ((IFS1bits.MI2C1IF && IEC1bits.MI2C1IE) || StepI2CModule())
+        {
+            HostInterrupt(_MI2C1Interrupt);
+        }
+
+        events = TakeEvents();
+        if (events & EVENT_WORK_POSTED)
+        {
+            RunDeferredWork();
+        }
+        if (events & EVENT_MIDNIGHT)
+        {
+            CHECK(CurrentTime.hour == 0 && CurrentTime.minute == 0);
+            CHECK(PreviousTime.hour == 23);
+            midnights++;
+        }
+        if (events & EVENT_RTCC_SYNC)
+        {
+            RetryRTCCSync();
+        }
+    } while (events != 0 || !I2C_IsEngineIdle());
+}
+
+/**
+ * Description: Adds a little volume, which must go into the bin for the
+ *      hour the internal RTCC shows and nowhere else.
+ */
+static void CheckVolumeBin(void)
+{
+    uint32_t before[12];
+    uint8_t bin = RtccTime().hour >> 1;
+    uint8_t i;
+
+    memcpy(before, volumeArray, sizeof(before));
+    AccumulateVolume(VOLUME_DELTA);
+
+    CHECK(CurrentTime.hour == RtccTime().hour);
+    for (i = 0; i < 12; i++)
+    {
+        if (i == bin)
+        {
+            CHECK(volumeArray[i] > before[i]);
+        }
+        else
+        {
+            CHECK(volumeArray[i] == before[i]);
+        }
+    }
+}
+
+/**
+ * Description: One second for both clocks. The internal RTCC raises its
+ *      alarm at the top of the hour.
+ */
+static void RunSecond(void)
+{
+    time_s t = SlaveTime();
+
+    AddSecond(&t);
+    SetSlaveTime(&t);
+
+    secondsRun++;
+    if (secondsRun % RTCC_LOSES_EVERY_S != 0 && RCFGCALbits.RTCEN)
+    {
+        t = RtccTime();
+        AddSecond(&t);
+        SetRtccTime(&t);
+
+        if (t.minute == 0 && t.second == 0 && IEC3bits.RTCIE)
+        {
+            alarms++;
+            IFS3bits.RTCIF = true;
+            HostInterrupt(_RTCCInterrupt);
+        }
+    }
+
+    RunMainLoop();
+}
+
+/**
+ * Description: Boots on the MCP7940 time, then runs until the internal RTCC
+ *      reaches the end time, checking the bins at every hour boundary.
+ */
+static void RunThrough(const time_s *start, const time_s *end)
+{
+    uint16_t expectedMidnights = 0;
+    uint16_t syncs;
+    time_s rtcc;
+
+    memset(&slave, 0, sizeof(slave));
+    SetSlaveTime(start);
+    memset((void *)hostRTCVAL, 0, sizeof(hostRTCVAL));
+    secondsRun = 0;
+    midnights = 0;
+    alarms = 0;
+    ResetAccumulators();
+
+    // As main does at boot
+    RTCC_Initialize();
+    SyncRTCCTime();
+    RunMainLoop();
+    CHECK(slave.completeReads == 1);
+    CHECK(IEC3bits.RTCIE);
+    rtcc = RtccTime();
+    CHECK(SameTime(&rtcc, start));
+    CHECK(SameTime(&CurrentTime, start));
+    CHECK(midnights == 0);
+
+    do
+    {
+        uint8_t lastDay = RtccTime().mnDay;
+
+        RunSecond();
+        rtcc = RtccTime();
+        if (rtcc.mnDay != lastDay)
+        {
+            expectedMidnights++;
+        }
+
+        if (rtcc.second == 59 && rtcc.minute == 59)
+        {
+            // Last moment of the hour
+            CheckVolumeBin();
+        }
+        else if (rtcc.second == 0 && rtcc.minute == 0)
+        {
+            // Straight after the alarm
+            CHECK(SameTime(&CurrentTime, &rtcc));
+            CheckVolumeBin();
+        }
+        else if (rtcc.hour == RTCC_SYNC_HOUR && rtcc.minute == 0 &&
+                rtcc.second < 30)
+        {
+            // Resynced, so the slow internal RTCC is back on time
+            time_s mcp = SlaveTime();
+
+            CHECK(SameTime(&rtcc, &mcp));
+        }
+    } while (!SameTime(&rtcc, end));
+
+    // Boot, and one sync a day
+    syncs = 1 + expectedMidnights;
+    if (start->hour >= RTCC_SYNC_HOUR && end->hour < RTCC_SYNC_HOUR)
+    {
+        syncs--;
+    }
+    printf("rtcc: %u hours to %02u/%02u/%02u, %u alarms, %u midnights, "
+            "%u MCP7940 reads\n", (unsigned)(secondsRun / 3600), end->mnDay,
+            end->month, end->year, alarms, midnights, slave.completeReads);
+    CHECK(slave.completeReads >= syncs && slave.completeReads <= syncs + 1);
+    CHECK(midnights == expectedMidnights);
+    CHECK(expectedMidnights > 0);
+    CHECK(alarms >= secondsRun / 3600);
+}
+
+static void TestMonthEnd(void)
+{
+    // Friday the 27th of February 2026, then into March
+    static const time_s start = {0, 0, 22, 6, 27, 2, 26};
+    static const time_s end = {0, 0, 3, 2, 2, 3, 26};
+
+    RunThrough(&start, &end);
+    CHECK(CurrentTime.month == 3 && CurrentTime.mnDay == 2);
+}
+
+static void TestLeapDay(void)
+{
+    static const time_s start = {30, 59, 21, 2, 28, 2, 28};
+    static const time_s end = {0, 0, 2, 4, 1, 3, 28};
+
+    RunThrough(&start, &end);
+    CHECK(PreviousTime.month == 3 && PreviousTime.mnDay == 1);
+}
+
+static void TestYearEnd(void)
+{
+    static const time_s start = {0, 30, 20, 5, 31, 12, 26};
+    static const time_s end = {0, 0, 4, 6, 1, 1, 27};
+
+    RunThrough(&start, &end);
+    CHECK(CurrentTime.year == 27 && CurrentTime.month == 1);
+}
+
+int main(void)
+{
+    InitDeferredWork();
+    I2C_Init();
+    I2C_EngineInit();
+    TMR1_Initialize();
+    InitTimerService();
+    hostI2C1CONbits.I2CEN = 1;
+    I2C1TRN = NO_BYTE;
+
+    TestMonthEnd();
+    TestLeapDay();
+    TestYearEnd();
+
+    return TestsFinished("test_rtcc_rollover");
+}
@@ -0,0 +1,278 @@
+/*
+ * File:   test_timer_service.c
+ */
+
+
+#include <stdlib.h>
+#include "host.h"
+#include "timer_service.h"
+#include "tmr1.h"
+
+/*
+ A simulated day on Timer1. The LPRC ticks are counted here, so every
+ callback can be checked against the real time it ran at. The timers are
+ the firmware's own mix: a 10ms sample timer, a 30 minute battery timer,
+ one shots that reschedule themselves from the Timer1 ISR, and one shots the
+ main loop schedules and cancels at random in between. No timer may go off
+ early, or more than a ms late.
+ */
+
+#define DAY_MS              86400000UL
+#define SAMPLE_PERIOD_MS    10
+#define BATTERY_PERIOD_MS   1800000UL
+#define CHAIN_TIMERS        4
+#define MAIN_TIMERS         8
+
+typedef struct {
+    soft_timer timer;
+    uint32_t deadlineMS;
+    uint32_t fired;
+    bool isCancelled;
+} checked_timer;
+
+static uint64_t lprcTicks = 0; // Since InitTimerService
+static uint32_t worstLateMS = 0;
+static uint32_t earlyCount = 0;
+
+static checked_timer sampleTimer, batteryTimer;
+static checked_timer chainTimers[CHAIN_TIMERS];
+static checked_timer mainTimers[MAIN_TIMERS];
+
+static uint32_t TrueTimeMS(void)
+{
+    return (uint32_t)(lprcTicks / TMR1_TICKS_PER_MS);
+}
+
+/**
+ * Description: Checks a timer went off at its deadline, and moves the
+ *      deadline on by periodMS for a periodic one.
+ */
+static void Fired(checked_timer *checked, uint32_t periodMS)
+{
+    uint32_t nowMS = TrueTimeMS();
+    int32_t lateMS = (int32_t)(nowMS - checked->deadlineMS);
+
+    if (lateMS < 0)
+    {
+        earlyCount++;
+    }
+    else if ((uint32_t)lateMS > worstLateMS)
+    {
+        worstLateMS = lateMS;
+    }
+
+    CHECK(!checked->isCancelled);
+    checked->fired++;
+    checked->deadlineMS += periodMS;
+}
+
+static void SampleDue(void)
+{
+    Fired(&sampleTimer, SAMPLE_PERIOD_MS);
+}
+
+static void BatteryDue(void)
+{
+    Fired(&batteryTimer, BATTERY_PERIOD_MS);
+}
+
+/**
+ * Description: Schedules a one shot a random 1ms to 5s from now.
+ */
+static void ScheduleRandom(checked_timer *checked, void (*callback)(void))
+{
+    uint32_t delayMS = 1 + rand() % 5000;
+
+    checked->deadlineMS = GetTimeMS() + delayMS;
+    checked->isCancelled = false;
+    ScheduleTimerAt(&checked->timer, checked->deadlineMS, callback);
+}
+
+static void ChainDue(void)
+{
+    uint8_t i;
+
+    // The callback only knows which timer it is by which one is due
+    for (i = 0; i < CHAIN_TIMERS; i++)
+    {
+        checked_timer *checked = &chainTimers[i];
+
+        if (!checked->timer.isScheduled && checked->deadlineMS != 0 &&
+                (int32_t)(TrueTimeMS() - checked->deadlineMS) >= 0)
+        {
+            Fired(checked, 0);
+            ScheduleRandom(checked, ChainDue);
+        }
+    }
+}
+
+static void MainDue(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < MAIN_TIMERS; i++)
+    {
+        checked_timer *checked = &mainTimers[i];
+
+        if (!checked->timer.isScheduled && checked->deadlineMS != 0)
+        {
+            Fired(checked, 0);
+            checked->deadlineMS = 0;
+        }
+    }
+}
+
+/**
+ * Description: Lets count LPRC ticks go by, jumping straight to the end of
+ *      each Timer1 period.
+ */
+static void RunTicks(uint64_t count)
+{
+    while (count > 0)
+    {
+        uint16_t skip = (TMR1 < PR1) ? PR1 - TMR1 : 0;
+
+        if (skip > count)
+        {
+            skip = count;
+        }
+        TMR1 += skip;
+        lprcTicks += skip;
+        count -= skip;
+
+        if (count > 0)
+        {
+            lprcTicks++;
+            count--;
+            HostTimer1Tick();
+        }
+    }
+}
+
+/**
+ * Description: What the main loop does between wakes, schedules or cancels
+ *      one of its timers at random.
+ */
+static void MainLoopTurn(void)
+{
+    checked_timer *checked = &mainTimers[rand() % MAIN_TIMERS];
+
+    CHECK(GetTimeMS() == TrueTimeMS());
+
+    if (checked->timer.isScheduled && (rand() & 0x1))
+    {
+        CancelTimer(&checked->timer);
+        checked->isCancelled = true;
+        checked->deadlineMS = 0;
+    }
+    else
+    {
+        ScheduleRandom(checked, MainDue);
+    }
+}
+
+static void TestDay(void)
+{
+    uint8_t i;
+
+    TMR1_Initialize();
+    InitTimerService();
+    lprcTicks = 0;
+
+    sampleTimer.deadlineMS = SAMPLE_PERIOD_MS;
+    ScheduleTimerEvery(&sampleTimer.timer, SAMPLE_PERIOD_MS, SampleDue);
+    batteryTimer.deadlineMS = BATTERY_PERIOD_MS;
+    ScheduleTimerEvery(&batteryTimer.timer, BATTERY_PERIOD_MS, BatteryDue);
+    for (i = 0; i < CHAIN_TIMERS; i++)
+    {
+        ScheduleRandom(&chainTimers[i], ChainDue);
+    }
+
+    while (TrueTimeMS() < DAY_MS)
+    {
+        // Wake somewhere in the next 2s, not on a ms boundary
+        RunTicks(1 + rand() % (2000 * TMR1_TICKS_PER_MS));
+        MainLoopTurn();
+    }
+
+    printf("timer service: %u samples, %u battery reads, worst %ums late\n",
+            (unsigned)sampleTimer.fired, (unsigned)batteryTimer.fired,
+            (unsigned)worstLateMS);
+    CHECK(earlyCount == 0);
+    CHECK(worstLateMS <= 1);
+    // The day ran a little past midnight, to the next wake
+    CHECK(sampleTimer.fired >= DAY_MS / SAMPLE_PERIOD_MS);
+    CHECK(sampleTimer.fired <= (DAY_MS + 2000) / SAMPLE_PERIOD_MS);
+    CHECK(batteryTimer.fired == DAY_MS / BATTERY_PERIOD_MS);
+    for (i = 0; i < CHAIN_TIMERS; i++)
+    {
+        CHECK(chainTimers[i].fired > DAY_MS / 5000);
+    }
+}
+
+static void TestTimeAcrossPeriods(void)
+{
+    uint32_t lastMS;
+    uint32_t i;
+
+    TMR1_Initialize();
+    InitTimerService();
+    lprcTicks = 0;
+
+    // Nothing scheduled, Timer1 wakes every TIMER_MAX_PERIOD_MS
+    lastMS = GetTimeMS();
+    for (i = 0; i < 100000; i++)
+    {
+        uint32_t nowMS;
+
+        lprcTicks++;
+        HostTimer1Tick();
+        nowMS = GetTimeMS();
+        CHECK(nowMS == TrueTimeMS());
+        CHECK(nowMS >= lastMS);
+        lastMS = nowMS;
+    }
+}
+
+static uint16_t rescheduledFired = 0;
+
+static void RescheduledDue(void)
+{
+    rescheduledFired++;
+}
+
+static void TestInitDropsTimers(void)
+{
+    static soft_timer early, earlyPeriodic;
+
+    // Timers scheduled before InitTimerService, as the boot RTCC sync used
+    //  to, are dropped but can be scheduled again
+    TMR1_Initialize();
+    InitTimerService();
+    ScheduleTimerAt(&early, GetTimeMS() + 100, RescheduledDue);
+    ScheduleTimerEvery(&earlyPeriodic, 50, RescheduledDue);
+    CHECK(early.isScheduled && earlyPeriodic.isScheduled);
+
+    InitTimerService();
+    lprcTicks = 0;
+    CHECK(!early.isScheduled);
+    CHECK(!earlyPeriodic.isScheduled);
+    RunTicks(200 * TMR1_TICKS_PER_MS);
+    CHECK(rescheduledFired == 0);
+
+    ScheduleTimerAt(&early, GetTimeMS() + 100, RescheduledDue);
+    CHECK(early.isScheduled);
+    RunTicks(101 * TMR1_TICKS_PER_MS);
+    CHECK(rescheduledFired == 1);
+    CHECK(!early.isScheduled);
+}
+
+int main(void)
+{
+    srand(16);
+    TestTimeAcrossPeriods();
+    TestInitDropsTimers();
+    TestDay();
+
+    return TestsFinished("test_timer_service");
+}
@@ -0,0 +1,428 @@
+/*
+ * File:   test_trace_replay.c
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "host.h"
+#include "interrupt_handlers.h"
+#include "utilities.h"
+#include "tmr1.h"
+
+/*
+ Trace replay of the handle through the whole sampling path: Timer1 runs the
+ sample timer, the test plays the ADC and the WPS, and the main loop hands
+ every block to ProcessAccelBlock. Each test replays strokes twice and
+ compares the runs.
+
+ Deep sleep: the pump is used, sits still and dry long enough to go into
+ deep sleep, then is used again. The same strokes are replayed with a still
+ time short of deep sleep, which is the run to match: every stroke the
+ firmware caught there must be caught after the wake too, and the volume
+ from before deep sleep must still be there after it.
+
+ Adaptive rate: a morning of use, sessions of strokes with the pump still in
+ between, is replayed with the sample rate held at ACCEL_FAST_PERIOD_MS, as
+ before the idle rate, and as the firmware picks it. The volume totals must
+ agree within RATE_TOLERANCE.
+ */
+
+#define REST_ANGLE          -2800 // Handle down, hundredths of a degree
+#define TOP_ANGLE           1800
+#define STROKE_MS           600
+#define UPSTROKE_MS         60 // Fast enough to pass HANDLE_MOVEMENT_THRESHOLD
+#define TOP_HOLD_MS         40
+#define DOWNSTROKE_MS       400
+#define STROKES             40
+#define WATER_HZ            1000 // WPS frequency with water
+#define ACCEL_RADIUS        800 // ADC counts for 1g
+#define SESSIONS            6 // Uses of the pump in the adaptive rate trace
+#define MAX_STROKES         (SESSIONS * STROKES)
+#define WAKE_TOLERANCE      5 // Percent the volume after a deep sleep wake
+                              //  may differ by
+#define RATE_TOLERANCE      5 // Percent the adaptive rate volume may differ
+                              //  from the fixed rate by
+
+typedef struct {
+    uint32_t stillMS; // Still and dry before the strokes
+    uint16_t strokes;
+    uint32_t wetAfterMS; // Water stays this long after the last stroke
+} trace_segment;
+
+typedef struct {
+    uint16_t strokes;
+    uint32_t volumeML[MAX_STROKES]; // Added over each stroke
+    bool isFast[MAX_STROKES]; // Sampled at the fast rate on the upstroke
+    uint32_t volumeBeforeML; // Total at the start of the second segment
+    uint32_t kept[4]; // Accumulators going into deep sleep
+    bool isKept; // and the same coming out of it
+    uint32_t totalML;
+    uint32_t lengthMS;
+    uint32_t deepMS; // Time spent at the deep sleep rate
+} replay_result;
+
+static const trace_segment *segments;
+static uint8_t segmentCount;
+static uint32_t traceMS;
+static bool isRateFixed; // Held at the fast rate, the idle rate never used
+
+/**
+ * Description: Where the trace has the handle, and whether the WPS is wet.
+ */
+static int16_t TraceAngle(uint32_t ms, bool *isWet, int16_t *stroke)
+{
+    uint8_t i;
+    uint16_t strokeBase = 0;
+
+    *isWet = false;
+    *stroke = -1;
+    for (i = 0; i < segmentCount; i++)
+    {
+        const trace_segment *segment = &segments[i];
+        uint32_t strokesMS = (uint32_t)segment->strokes * STROKE_MS;
+
+        if (ms < segment->stillMS)
+        {
+            // A little noise, well under the movement threshold
+            return REST_ANGLE + (int16_t)((ms * 37) % 61) - 30;
+        }
+        ms -= segment->stillMS;
+
+        if (ms < strokesMS)
+        {
+            uint32_t inStroke = ms % STROKE_MS;
+            int32_t range = TOP_ANGLE - REST_ANGLE;
+
+            *isWet = true;
+            *stroke = strokeBase + ms / STROKE_MS;
+            if (inStroke < UPSTROKE_MS)
+            {
+                return REST_ANGLE + range * (int32_t)inStroke / UPSTROKE_MS;
+            }
+            inStroke -= UPSTROKE_MS;
+            if (inStroke < TOP_HOLD_MS)
+            {
+                return TOP_ANGLE;
+            }
+            inStroke -= TOP_HOLD_MS;
+            if (inStroke < DOWNSTROKE_MS)
+            {
+                return TOP_ANGLE - range * (int32_t)inStroke / DOWNSTROKE_MS;
+            }
+            return REST_ANGLE;
+        }
+        ms -= strokesMS;
+        *isWet = (ms < segment->wetAfterMS);
+        strokeBase += segment->strokes;
+    }
+
+    return REST_ANGLE;
+}
+
+static uint32_t TraceLengthMS(void)
+{
+    uint32_t lengthMS = 0;
+    uint8_t i;
+
+    for (i = 0; i < segmentCount; i++)
+    {
+        lengthMS += segments[i].stillMS +
+                (uint32_t)segments[i].strokes * STROKE_MS +
+                segments[i].wetAfterMS;
+    }
+
+    return lengthMS;
+}
+
+/**
+ * Description: Does the conversion the firmware started, if any, with the
+ *      handle where the trace has it now.
+ */
+static void PlayADC(void)
+{
+    bool isWet;
+    int16_t stroke;
+    double angle = TraceAngle(traceMS, &isWet, &stroke) * 3.14159265 / 18000.0;
+
+    if (AD1CON1bits.ASAM)
+    {
+        // AN11 (Y) before AN15 (X)
+        hostADC1BUF[0] = (uint16_t)(2047 + ACCEL_RADIUS * sin(angle) + 0.5);
+        hostADC1BUF[1] = (uint16_t)(2047 + ACCEL_RADIUS * cos(angle) + 0.5);
+        IFS0bits.AD1IF = true;
+        HostInterrupt(_ADC1Interrupt);
+    }
+    else if (AD1CON1bits.SAMP)
+    {
+        // Battery read
+        hostADC1BUF[0] = 3400;
+        AD1CON1bits.DONE = true;
+        IFS0bits.AD1IF = true;
+        HostInterrupt(_ADC1Interrupt);
+        AD1CON1bits.DONE = false;
+    }
+}
+
+static uint32_t TotalVolumeML(void);
+
+/**
+ * Description: The daily accumulators deep sleep must not touch.
+ */
+static void DailyAccumulators(uint32_t kept[4])
+{
+    kept[0] = TotalVolumeML();
+    kept[1] = longestPrime;
+    kept[2] = fastestLeakRate;
+    kept[3] = batteryAccumulator;
+}
+
+static uint32_t TotalVolumeML(void)
+{
+    uint32_t total = 0;
+    uint8_t i;
+
+    for (i = 0; i < 12; i++)
+    {
+        total += volumeArray[i];
+    }
+
+    return total;
+}
+
+/**
+ * Description: What the main loop does with the events that matter here.
+ */
+static void MainLoopTurn(void)
+{
+    work_item item;
+    uint16_t events = TakeEvents();
+
+    while (PullWork(&item))
+    {
+    }
+
+    if (events & EVENT_ACCEL_BLOCK)
+    {
+        ProcessAccelBlock(&accelBlocks[fullAccelBlock]);
+        accelBlockIsFull = false;
+        if (isRateFixed)
+        {
+            // Overrides what ProcessAccelBlock asked for before the ISR
+            //  reaches the end of the next block
+            RequestAccelSamplePeriod(ACCEL_FAST_PERIOD_MS);
+        }
+    }
+
+    if (events & EVENT_BATTERY_BUFFER)
+    {
+        HandleBatteryBufferEvent();
+    }
+}
+
+/**
+ * Description: Replays a trace a ms at a time.
+ */
+static void Replay(const trace_segment *trace, uint8_t count,
+        replay_result *result)
+{
+    uint32_t lengthMS;
+    int16_t lastStroke = -1;
+    uint32_t strokeStartML = 0;
+    uint8_t lastPeriodMS = accelPeriodMS;
+
+    segments = trace;
+    segmentCount = count;
+    lengthMS = TraceLengthMS();
+    memset(result, 0, sizeof(*result));
+
+    TMR1_Initialize();
+    InitTimerService();
+    InitTimers();
+    ResetAccumulators();
+
+    for (traceMS = 0; traceMS < lengthMS; traceMS++)
+    {
+        bool isWet;
+        int16_t stroke;
+        uint8_t tick;
+
+        TraceAngle(traceMS, &isWet, &stroke);
+
+        if (stroke != lastStroke)
+        {
+            uint32_t totalML = TotalVolumeML();
+
+            if (lastStroke >= 0)
+            {
+                result->volumeML[lastStroke] = totalML - strokeStartML;
+            }
+            if (stroke == segments[0].strokes)
+            {
+                result->volumeBeforeML = totalML;
+            }
+            if (stroke >= 0)
+            {
+                result->strokes = stroke + 1;
+                result->isFast[stroke] = true;
+            }
+            strokeStartML = totalML;
+            lastStroke = stroke;
+        }
+        if (stroke >= 0 && traceMS % STROKE_MS < UPSTROKE_MS &&
+                accelPeriodMS != ACCEL_FAST_PERIOD_MS)
+        {
+            result->isFast[stroke] = false;
+        }
+        if (accelPeriodMS == ACCEL_DEEP_PERIOD_MS)
+        {
+            if (lastPeriodMS != ACCEL_DEEP_PERIOD_MS)
+            {
+                DailyAccumulators(result->kept);
+            }
+            result->deepMS++;
+            // The WPS is off in deep sleep
+            CHECK(!_LATB15);
+        }
+        else if (lastPeriodMS == ACCEL_DEEP_PERIOD_MS)
+        {
+            uint32_t woke[4];
+
+            DailyAccumulators(woke);
+            result->isKept = (memcmp(woke, result->kept, sizeof(woke)) == 0);
+        }
+        lastPeriodMS = accelPeriodMS;
+
+        for (tick = 0; tick < TMR1_TICKS_PER_MS; tick++)
+        {
+            HostTimer1Tick();
+            PlayADC();
+        }
+
+        // Timer2 counts the WPS edges
+        if (T2CONbits.TON && _LATB15 && isWet)
+        {
+            TMR2 += WATER_HZ / 1000;
+        }
+
+        MainLoopTurn();
+    }
+
+    result->totalML = TotalVolumeML();
+    result->lengthMS = lengthMS;
+}
+
+static void TestWakeFromDeepSleep(void)
+{
+    // Used, then still and dry long enough for deep sleep, then used again
+    static const trace_segment deepTrace[] = {
+        {30000, STROKES, 2000},
+        {DEEP_SLEEP_AFTER_MS + 60000, STROKES, 2000},
+        {30000, 0, 0},
+    };
+    // The same, but used again before deep sleep
+    static const trace_segment awakeTrace[] = {
+        {30000, STROKES, 2000},
+        {DEEP_SLEEP_AFTER_MS / 2, STROKES, 2000},
+        {30000, 0, 0},
+    };
+    static replay_result deep, awake;
+    uint16_t i;
+    uint16_t caughtDeep = 0;
+    uint16_t caughtAwake = 0;
+    uint32_t deepML, awakeML, difference;
+
+    Replay(awakeTrace, 3, &awake);
+    Replay(deepTrace, 3, &deep);
+
+    CHECK(awake.deepMS == 0);
+    CHECK(deep.deepMS > 0);
+    CHECK(deep.strokes == 2 * STROKES);
+    CHECK(awake.strokes == 2 * STROKES);
+
+    for (i = STROKES; i < 2 * STROKES; i++)
+    {
+        if (awake.volumeML[i] > 0)
+        {
+            caughtAwake++;
+            // No stroke lost on the wake
+            CHECK(deep.volumeML[i] > 0);
+        }
+        if (deep.volumeML[i] > 0)
+        {
+            caughtDeep++;
+        }
+        // Every stroke after the first is sampled at the fast rate
+        if (i > STROKES)
+        {
+            CHECK(deep.isFast[i]);
+        }
+    }
+
+    // Accumulators kept through deep sleep
+    CHECK(deep.volumeBeforeML > 0);
+    CHECK(deep.kept[0] == deep.volumeBeforeML);
+    CHECK(deep.isKept);
+
+    // Volume from the strokes after the wake
+    deepML = deep.totalML - deep.volumeBeforeML;
+    awakeML = awake.totalML - awake.volumeBeforeML;
+    difference = (deepML > awakeML) ? deepML - awakeML : awakeML - deepML;
+    printf("deep sleep: %u strokes caught after the wake, %u staying awake, "
+            "%u mL against %u mL\n", (unsigned)caughtDeep,
+            (unsigned)caughtAwake, (unsigned)deepML, (unsigned)awakeML);
+    CHECK(caughtDeep >= caughtAwake);
+    CHECK(difference * 100 <= awakeML * WAKE_TOLERANCE);
+}
+
+static void TestAdaptiveRateVolume(void)
+{
+    static trace_segment trace[SESSIONS + 1];
+    static replay_result fixed, adaptive;
+    uint8_t i;
+    uint32_t fixedMS, difference;
+
+    // Uses a minute or more apart, some long enough apart for deep sleep
+    for (i = 0; i < SESSIONS; i++)
+    {
+        trace[i].stillMS = 60000UL * (1 + i * 3);
+        trace[i].strokes = STROKES;
+        trace[i].wetAfterMS = 2000;
+    }
+    trace[SESSIONS].stillMS = 30000;
+
+    isRateFixed = true;
+    Replay(trace, SESSIONS + 1, &fixed);
+    fixedMS = fastRateMS;
+    isRateFixed = false;
+    Replay(trace, SESSIONS + 1, &adaptive);
+
+    CHECK(fixed.deepMS == 0);
+    CHECK(adaptive.deepMS > 0);
+    // Mostly at the idle rates, and all of the time in one rate or another
+    CHECK(idleRateMS > 3 * fastRateMS);
+    CHECK(fastRateMS < fixedMS / 4);
+    CHECK(fixedMS + 1000 > fixed.lengthMS && fixedMS <= fixed.lengthMS);
+    CHECK(fastRateMS + idleRateMS + 1000 > adaptive.lengthMS);
+    CHECK(fastRateMS + idleRateMS <= adaptive.lengthMS);
+
+    difference = (adaptive.totalML > fixed.totalML) ?
+            adaptive.totalML - fixed.totalML : fixed.totalML - adaptive.totalML;
+    printf("adaptive rate: %u mL against %u mL at the fixed rate, "
+            "%u%% of the time fast\n", (unsigned)adaptive.totalML,
+            (unsigned)fixed.totalML,
+            (unsigned)(100 * fastRateMS / (fastRateMS + idleRateMS)));
+    CHECK(fixed.totalML > 0);
+    CHECK(difference * 100 <= fixed.totalML * RATE_TOLERANCE);
+}
+
+int main(void)
+{
+    // PIN_MANAGER_Initialize powers the WPS
+    _LATB15 = 1;
+    InitQueues();
+    TestWakeFromDeepSleep();
+    TestAdaptiveRateVolume();
+
+    return TestsFinished("test_trace_replay");
+}